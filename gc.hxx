@@ -1,9 +1,17 @@
 #ifndef __ALF_GC_HXX__
 #define __ALF_GC_HXX__
 
+#include <sys/uio.h>
+
+#include <cstdint>
 #include <exception>
+#include <functional>
 #include <iostream>
+#include <new>
 #include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
 
 namespace alf {
 
@@ -54,6 +62,58 @@ gcobj * gc_walk_(const std::string & txt, gcobj * ptr);
 void * allocate(size_t sz);
 void deallocate(void * ptr);
 
+// attributes for allocate().
+// ALLOC_NOFINAL - gc doesn't call the destructor when the object
+// becomes unreachable, see nofinal below.
+// ALLOC_PINNED - the object is frozen from the start, see pinned below.
+// ALLOC_LARGE - the object goes to the large pool whatever its size so
+// it never moves but is still reclaimed when unreachable.
+enum { ALLOC_NOFINAL = 1, ALLOC_PINNED = 2, ALLOC_LARGE = 4 };
+void * allocate(size_t sz, unsigned int attr);
+
+// new (gc::pinned) T(...) allocates a T that is frozen from the start,
+// as if you had done new T(...) and then freeze() but without moving
+// the object and without gc_update_pointers(). unfreeze() it when it
+// may move again. Large objects never move and just get their freeze
+// count set to 1.
+struct pinned_t { };
+inline constexpr pinned_t pinned { };
+
+// T(gc::image) is the constructor load_image() runs on a loaded object,
+// see image below.
+struct image_t { };
+inline constexpr image_t image { };
+
+// offsets of the gcobj pointers in an object, see mapped below.
+struct field_map {
+  std::size_t n; // number of fields.
+  const std::size_t * off; // offset of each pointer from the gcobj.
+  const std::type_info * type; // the map is used only for exactly this.
+};
+
+// as above and gc walks the object through fm instead of gc_walker.
+void * allocate(size_t sz, unsigned int attr, const field_map * fm);
+
+// walk the pointers in obj given by fm.
+void walk_fields_(const std::string & txt, gcobj * obj, const field_map & fm);
+
+// used by array below. Allocate an object of size hsz followed by n
+// elements of size esz, throws gc_allocation_error if that overflows.
+void * allocate_array_(std::size_t hsz, std::size_t n, std::size_t esz,
+		       unsigned int attr, const field_map * fm);
+
+// walk n pointers starting at p.
+void walk_array_(const std::string & txt, gcobj ** p, std::size_t n);
+
+struct heap_impl;
+struct arena;
+
+// the current heap of the calling thread. pointer, weak_pointer, data
+// and reference_queue keep the heap they were registered in and pass
+// it to the functions below that take one, so they unregister from
+// that heap wherever they are destroyed.
+heap_impl * current_heap_();
+
 // register a top level pointer.
 // any pointer registered this way will be a root pointer for gc walk.
 // if the pointer is inside a gcobj object directly or indirectly by
@@ -75,6 +135,12 @@ void unregister_all_root_ptrs(gcobj ** pp);
 // unregister all registrations.
 void unregister_all_root_ptrs();
 
+// the same in heap hp instead of the current heap.
+void register_root_ptr_(heap_impl * hp, const std::string & txt,
+			gcobj ** pp);
+void unregister_root_ptr_(heap_impl * hp, gcobj ** pp);
+void unregister_all_root_ptrs_(heap_impl * hp, gcobj ** pp);
+
 // register a non-gcobj object and gc_walk function.
 void register_obj_(const std::string & txt, void * obj,
 		   void f(const std::string &, void *));
@@ -83,11 +149,28 @@ void unregister_obj_(void * obj);
 void unregister_all_objs_(void * obj);
 void unregister_all_objs_();
 
+void register_obj_(heap_impl * hp, const std::string & txt, void * obj,
+		   void f(const std::string &, void *));
+void unregister_obj_(heap_impl * hp, void * obj);
+void unregister_all_objs_(heap_impl * hp, void * obj);
+
+class reference_queue;
+
 void register_weak_pointer_(gcobj * & p);
+void register_weak_pointer_(gcobj * & p, reference_queue & q, void * tag);
+void set_weak_pointer_queue_(gcobj * & p, reference_queue & q, void * tag);
 void unregister_weak_pointer_(gcobj * & p);
 void unregister_all_weak_pointers_(gcobj * & p);
 void unregister_all_weak_pointers();
 
+void register_weak_pointer_(heap_impl * hp, gcobj * & p);
+void register_weak_pointer_(heap_impl * hp, gcobj * & p,
+			    reference_queue & q, void * tag);
+void set_weak_pointer_queue_(heap_impl * hp, gcobj * & p,
+			     reference_queue & q, void * tag);
+void unregister_weak_pointer_(heap_impl * hp, gcobj * & p);
+void unregister_all_weak_pointers_(heap_impl * hp, gcobj * & p);
+
 //////////////////////////////
 // register_root_ptr
 
@@ -101,7 +184,7 @@ void register_root_ptr(const std::string & txt, T * & p)
 template <typename T>
 inline
 void unregister_root_ptr(T * & p)
-{ unregister_root_ptr_(& p); }
+{ unregister_root_ptr_(reinterpret_cast<gcobj **>(& p)); }
 
 ////////////////////////////////
 // register_obj
@@ -160,6 +243,16 @@ template <typename T>
 void register_weak_pointer(T * & p)
 { register_weak_pointer_(reinterpret_cast<gcobj * &>(p)); }
 
+// when gc sets p to 0, tag is put in q.
+template <typename T>
+void register_weak_pointer(T * & p, reference_queue & q, void * tag)
+{ register_weak_pointer_(reinterpret_cast<gcobj * &>(p), q, tag); }
+
+// let the registration of p put tag in q, register p if it isn't.
+template <typename T>
+void set_weak_pointer_queue(T * & p, reference_queue & q, void * tag)
+{ set_weak_pointer_queue_(reinterpret_cast<gcobj * &>(p), q, tag); }
+
 template <typename T>
 void unregister_weak_pointer(T * & p)
 { unregister_weak_pointer_(reinterpret_cast<gcobj * &>(p)); }
@@ -174,10 +267,16 @@ void unregister_all_weak_pointers(T * & p)
 
 // T has gcobj as baseclass.
 // txt can be used to describe the pointer.
+// ptr is only written if the object moved so walking an object that
+// doesn't move leaves its memory untouched.
 template <typename T>
 inline
 void gc_walk(const std::string & txt, T * & ptr)
-{ ptr = reinterpret_cast<T *>(gc_walk_(txt, ptr)); }
+{
+  T * p = reinterpret_cast<T *>(gc_walk_(txt, ptr));
+  if (p != ptr)
+    ptr = p;
+}
 
 
 ////////////////////////////
@@ -205,6 +304,13 @@ public:
   void * operator new(size_t sz) { return allocate(sz); }
   void operator delete(void * p) { deallocate(p); }
 
+  void * operator new(size_t sz, const pinned_t &)
+  { return allocate(sz, ALLOC_PINNED); }
+  void operator delete(void * p, const pinned_t &) { deallocate(p); }
+
+  // attributes for allocate() used by mapped, nofinal changes this.
+  static constexpr unsigned int gc_alloc_attr = 0;
+
   // reallocation is not provided - it may involve moving the object
   // which will invalidate any pointers to it.
   // You can achieve almost the same effect by allocating a new object
@@ -282,6 +388,338 @@ public:
 
 }; // end of class gcdataobj
 
+////////////////////////
+// nofinal
+
+// Base is gcobj or a class derived from it, for example
+//
+// class Foo : public gc::nofinal<gc::gcdataobj> { ... };
+//
+// gc never calls the destructor of an unreachable object of a class
+// derived from nofinal, it simply forgets it. Use it for classes where
+// the destructor, including those of all members and baseclasses, needs
+// not run - no memory outside gc to free, no files to close and so on.
+// gc then only has to look at the live objects and at the objects
+// that need their destructor called so a gc of a heap with mostly such
+// objects costs in proportion to live data, not to what was allocated.
+// delete still calls the destructor.
+// A class with its own operator new can do the same by calling
+// allocate(sz, ALLOC_NOFINAL).
+template <typename Base = gcobj>
+class nofinal : public Base {
+public:
+
+  using Base::Base;
+
+  static constexpr unsigned int gc_alloc_attr = ALLOC_NOFINAL;
+
+  void * operator new(size_t sz) { return allocate(sz, ALLOC_NOFINAL); }
+  void operator delete(void * p) { deallocate(p); }
+
+  void * operator new(size_t sz, const pinned_t &)
+  { return allocate(sz, ALLOC_NOFINAL | ALLOC_PINNED); }
+  void operator delete(void * p, const pinned_t &) { deallocate(p); }
+
+}; // end of class nofinal
+
+////////////////////////
+// fields and mapped
+
+// fields lists the pointer members of a class, for example
+//
+// class Node : public gc::mapped<Node> {
+// public:
+//   Node * left;
+//   Node * right;
+//   Node * parent;
+//   int val;
+//
+//   // after the members.
+//   typedef gc::fields<&Node::left, &Node::right, &Node::parent> gc_fields;
+// };
+//
+// mapped<T, Base> provides gc_walker and operator new for T. The offsets
+// of the fields in T::gc_fields are computed once per class and every
+// object of T carries them in its head, so gc walks the object with a
+// loop over the offsets instead of a virtual call to gc_walker and
+// a call to gc_walk() per pointer. Each field must be a pointer to a
+// class derived from gcobj and a member of T or of a non virtual
+// baseclass of T. The txt given to gc_walker is passed on unchanged.
+// Objects of a class derived from T that is larger than T get no map,
+// gc calls their gc_walker.
+// Base is gcobj or a class derived from it, nofinal<> for example.
+// Classes with pointers in containers or other irregular layouts
+// write a gc_walker as usual.
+template <auto... M>
+struct fields { };
+
+// offset of field m from the gcobj in T. No object is accessed, only the
+// address of the member in a T at a made up address is computed.
+template <typename T, typename C, typename U>
+inline
+std::size_t field_offset_(U * C::* m)
+{
+  static_assert(std::is_base_of<C, T>::value, "field is not a member of T");
+  static_assert(std::is_base_of<gcobj, U>::value,
+		"field must point to a gcobj");
+  const T * t = reinterpret_cast<const T *>(std::uintptr_t(alignof(T)*64));
+  return reinterpret_cast<std::uintptr_t>(& (t->*m)) -
+    reinterpret_cast<std::uintptr_t>(static_cast<const gcobj *>(t));
+}
+
+template <typename T, typename F>
+struct field_map_of;
+
+template <typename T, auto... M>
+struct field_map_of<T, fields<M...> > {
+
+  static const field_map * get()
+  {
+    // extra 0 so the array isn't empty.
+    static const std::size_t off[] = { field_offset_<T>(M)..., 0 };
+    static const field_map fm = { sizeof...(M), off, & typeid(T) };
+    return & fm;
+  }
+
+}; // end of struct field_map_of
+
+template <typename T, typename Base = gcobj>
+class mapped : public Base {
+public:
+
+  using Base::Base;
+
+  // used by tracers and for frozen objects, gc uses the map directly.
+  virtual void gc_walker(const std::string & txt)
+  { walk_fields_(txt, this, *field_map_of<T, typename T::gc_fields>::get()); }
+
+  void * operator new(size_t sz)
+  { return allocate(sz, T::gc_alloc_attr, fmap_(sz)); }
+  void operator delete(void * p) { deallocate(p); }
+
+  void * operator new(size_t sz, const pinned_t &)
+  { return allocate(sz, T::gc_alloc_attr | ALLOC_PINNED, fmap_(sz)); }
+  void operator delete(void * p, const pinned_t &) { deallocate(p); }
+
+private:
+
+  // a class derived from T is larger if it adds pointers, it is walked
+  // by its own gc_walker. gc checks the dynamic type for one that isn't.
+  static const field_map * fmap_(size_t sz)
+  {
+    if (sz != sizeof(T)) return 0;
+    return field_map_of<T, typename T::gc_fields>::get();
+  }
+
+}; // end of class mapped
+
+////////////////////////
+// array
+
+// array<T> is a managed object holding n elements of T in the same
+// block, in the gc pool or, if large, in the large pool. T is either a
+// pointer to a class derived from gcobj or plain data without pointers
+// to gcobj objects, for example
+//
+// gc::array<Node *> * a = gc::array<Node *>::make(100);
+// gc::array<double> * v = gc::array<double>::make(1000000);
+//
+// Elements start out 0. An array of pointers is walked by gc in one
+// loop over the elements, a data array is never looked at by gc.
+// Arrays are nofinal, i.e. no destructor runs when they become
+// unreachable so T must be trivially destructible. An array may move
+// as any other object, don't keep pointers to its elements across
+// anything that may gc. Hold the array itself in a pointer or a gcobj.
+template <typename T>
+class array : public nofinal<gcobj> {
+public:
+
+  typedef T value_type;
+  typedef T * iterator;
+  typedef const T * const_iterator;
+
+  // true if T is a pointer walked by gc.
+  static constexpr bool gc_pointers =
+    std::is_pointer<T>::value &&
+    std::is_base_of<gcobj, typename std::remove_pointer<T>::type>::value;
+
+  static_assert(gc_pointers || std::is_trivially_copyable<T>::value,
+		"array element must be a gcobj pointer or plain data");
+  static_assert(std::is_trivially_destructible<T>::value,
+		"array element must be trivially destructible");
+  static_assert(alignof(T) <= alignof(void *),
+		"array element alignment too large");
+
+  // new array with n elements.
+  static array * make(std::size_t n) { return make_(n, ALLOC_NOFINAL); }
+
+  // as above but pinned, for example a buffer for a system call.
+  static array * make(std::size_t n, const pinned_t &)
+  { return make_(n, ALLOC_NOFINAL | ALLOC_PINNED); }
+
+  // for load_image().
+  array(const image_t &) { }
+
+  virtual void gc_walker(const std::string & txt)
+  {
+    if constexpr (gc_pointers)
+      walk_array_(txt, reinterpret_cast<gcobj **>(data()), n_);
+  }
+
+  std::size_t size() const { return n_; }
+
+  T * data() { return reinterpret_cast<T *>(this + 1); }
+  const T * data() const { return reinterpret_cast<const T *>(this + 1); }
+
+  T & operator [] (std::size_t k) { return data()[k]; }
+  const T & operator [] (std::size_t k) const { return data()[k]; }
+
+  iterator begin() { return data(); }
+  iterator end() { return data() + n_; }
+  const_iterator begin() const { return data(); }
+  const_iterator end() const { return data() + n_; }
+
+private:
+
+  std::size_t n_;
+
+  array(std::size_t n) : n_(n)
+  {
+    T * p = data();
+    std::size_t k = 0;
+    while (k < n) ::new (p + k++) T();
+  }
+
+  static array * make_(std::size_t n, unsigned int attr)
+  {
+    // a data array gets an empty field map so gc doesn't even call
+    // gc_walker.
+    void * p = allocate_array_(sizeof(array), n, sizeof(T), attr,
+			       gc_pointers ? 0 : field_map_of<array, fields<> >::get());
+    return ::new (p) array(n);
+  }
+
+  // use make().
+  void * operator new(size_t sz) = delete;
+
+}; // end of class array
+
+////////////////////////
+// buffer
+
+// buffer is n bytes in the large pool, it never moves so data() can be
+// handed to read(), write(), readv() or writev() and gc may run while
+// the call is in progress in another thread. Unlike a pinned array it
+// isn't frozen and goes away when it is no longer reachable. Every
+// buffer is a block of its own so use it for I/O sized chunks, not for
+// many small ones.
+//
+// gc::buffer * b = gc::buffer::make(64*1024);
+// ssize_t n = ::read(fd, b->data(), b->size());
+class buffer : public nofinal<gcobj> {
+public:
+
+  static buffer * make(std::size_t n)
+  {
+    void * p = allocate_array_(sizeof(buffer), n, 1,
+			       ALLOC_NOFINAL | ALLOC_LARGE,
+			       field_map_of<buffer, fields<> >::get());
+    return ::new (p) buffer(n);
+  }
+
+  // for load_image(), a loaded buffer is frozen, not in the large pool.
+  buffer(const image_t &) { }
+
+  virtual void gc_walker(const std::string &) { }
+
+  std::size_t size() const { return n_; }
+
+  char * data() { return reinterpret_cast<char *>(this + 1); }
+  const char * data() const { return reinterpret_cast<const char *>(this + 1); }
+
+  // len bytes from off, len is cut at the end of the buffer.
+  struct iovec iov(std::size_t off = 0, std::size_t len = SIZE_MAX)
+  {
+    if (off > n_) off = n_;
+    if (len > n_ - off) len = n_ - off;
+    struct iovec v = { data() + off, len };
+    return v;
+  }
+
+private:
+
+  std::size_t n_;
+
+  buffer(std::size_t n) : n_(n) { }
+
+  // use make().
+  void * operator new(size_t sz) = delete;
+
+}; // end of class buffer
+
+////////////////////////
+// mapped_file
+
+// mapped_file is a managed object whose bytes are a region of a file
+// mapped with mmap(). Nothing is copied into the gc heap, the object
+// itself is in the large pool and the region is unmapped by its
+// destructor when gc finds it unreachable. Mapped bytes are counted
+// by size_mapped() and friends, not by size_allocated().
+//
+// gc::mapped_file * f = gc::mapped_file::open("data.bin");
+// ::writev(fd, iov, n); // with iov[k] = f->iov(...).
+//
+// READ_ONLY maps the file shared and read only, PRIVATE maps it copy on
+// write so wdata() may be changed without touching the file.
+class mapped_file : public gcobj {
+public:
+
+  enum { READ_ONLY, PRIVATE };
+
+  // map len bytes of path from off, len 0 maps the rest of the file.
+  // Throws gc_error if the file can't be opened or mapped.
+  static mapped_file * open(const std::string & path, int mode = READ_ONLY,
+			    std::size_t off = 0, std::size_t len = 0);
+
+  virtual ~mapped_file();
+
+  virtual void gc_walker(const std::string &) { }
+
+  int mode() const { return mode_; }
+  std::size_t size() const { return n_; }
+
+  const char * data() const { return p_; }
+
+  // 0 if the mapping is read only.
+  char * wdata() { return mode_ == PRIVATE ? p_ : 0; }
+
+  // len bytes from off, len is cut at the end of the region.
+  struct iovec iov(std::size_t off = 0, std::size_t len = SIZE_MAX) const
+  {
+    if (off > n_) off = n_;
+    if (len > n_ - off) len = n_ - off;
+    struct iovec v = { p_ + off, len };
+    return v;
+  }
+
+private:
+
+  char * p_; // first byte asked for.
+  std::size_t n_;
+  void * base_; // start of the mapping, page aligned.
+  std::size_t mlen_; // length of the mapping.
+  int mode_;
+
+  mapped_file(char * p, std::size_t n, void * base, std::size_t mlen,
+	      int mode)
+    : p_(p), n_(n), base_(base), mlen_(mlen), mode_(mode)
+  { }
+
+  // use open().
+  void * operator new(size_t sz) = delete;
+
+}; // end of class mapped_file
+
 ////////////////////////
 // pointer
 
@@ -298,32 +736,38 @@ public:
   typedef const T * const_pointer_type;
   typedef const T & const_ref_type;
 
-  pointer() : p_(0) { }
+  pointer() : p_(0), heap_(0) { }
 
   pointer(const std::string & txt)
-    : p_(0)
-  { register_root_ptr(txt, p_); }
+    : p_(0), heap_(0)
+  { gc_register(txt); }
 
   pointer(const std::string & txt, T * p)
-    : p_(p)
-  { register_root_ptr(txt, p_); }
+    : p_(p), heap_(0)
+  { gc_register(txt); }
 
   pointer(const std::string & txt, const pointer & p)
-    : p_(p.p_)
-  { register_root_ptr(txt, p_); }
+    : p_(p.p_), heap_(0)
+  { gc_register(txt); }
 
   ~pointer() { this->gc_unregister_all(); }
 
   pointer & operator = (T * p) { p_ = p; return *this; }
   pointer & operator = (const pointer & p) { p_ = p.p_; return *this; }
 
+  // all registrations are in the heap that was current at the first.
   pointer & gc_register(const std::string & txt)
-  { register_root_ptr(txt, p_); }
+  {
+    if (heap_ == 0) heap_ = current_heap_();
+    register_root_ptr_(heap_, txt, pp_());
+    return *this;
+  }
 
-  pointer & gc_unregister() { unregister_root_ptr(p_); }
+  pointer & gc_unregister()
+  { if (heap_) unregister_root_ptr_(heap_, pp_()); return *this; }
 
   pointer & gc_unregister_all()
-  { unregister_all_root_ptrs(reinterpret_cast<gcobj **>(& p_)); }
+  { if (heap_) unregister_all_root_ptrs_(heap_, pp_()); return *this; }
 
   operator const T * () const { return p_; }
   operator T * () { return p_; }
@@ -340,9 +784,81 @@ public:
 private:
 
   T * p_;
+  heap_impl * heap_; // registered in this heap, 0 if not yet.
+
+  gcobj ** pp_() { return reinterpret_cast<gcobj **>(& p_); }
 
 }; // end of class pointer
 
+////////////////////////////////////
+// reference_queue
+
+// A weak pointer registered with a reference_queue and a tag puts the
+// tag in the queue each time gc sets it to 0. The tags of one gc are
+// added in one batch at the end of it and wait there until you take
+// them, so a map of weak pointers can remove just the entries that
+// were cleared when it suits it instead of looking at all of them or
+// depending on destructors of the objects:
+//
+// gc::reference_queue q;
+// gc::weak_pointer<Sym> w(s, q, & key);
+// ...
+// void * tag;
+// while (q.poll(tag))
+//   remove(static_cast<Key *>(tag));
+//
+// A tag stays in the queue even if its weak pointer is destroyed or
+// set to another object before you take it. w.set_queue(q, tag) gives
+// a weak pointer that is already registered a queue, registering it
+// again would make gc update it twice. Copies of the weak pointer are
+// not registered with the queue. Destroy the queue while the heap
+// of its weak pointers is current.
+class reference_queue {
+public:
+
+  reference_queue() : first_(0), heap_(current_heap_()) { }
+  ~reference_queue(); // weak pointers no longer use this queue.
+
+  reference_queue(const reference_queue &) = delete;
+  reference_queue & operator = (const reference_queue &) = delete;
+
+  // tags waiting to be taken.
+  std::size_t size() const { return Q_.size() - first_; }
+  bool empty() const { return first_ == Q_.size(); }
+
+  // take the oldest tag, false if there is none.
+  bool poll(void * & tag)
+  {
+    if (empty()) return false;
+    tag = Q_[first_++];
+    if (first_ == Q_.size()) {
+      Q_.clear();
+      first_ = 0;
+    }
+    return true;
+  }
+
+  // take all tags, oldest first, and append them to v.
+  // Return number of tags taken.
+  std::size_t drain(std::vector<void *> & v)
+  {
+    std::size_t n = size();
+    v.insert(v.end(), Q_.begin() + first_, Q_.end());
+    Q_.clear();
+    first_ = 0;
+    return n;
+  }
+
+private:
+
+  std::vector<void *> Q_;
+  std::size_t first_; // Q_[first_] is the oldest tag not taken.
+  heap_impl * heap_; // the heap it was made in.
+
+  friend class WPtrPool;
+
+}; // end of class reference_queue
+
 ////////////////////////////////////
 // weak_pointer
 
@@ -350,14 +866,20 @@ template <typename T>
 class weak_pointer {
 public:
 
-  weak_pointer() : p_(0) { register_weak_pointer(p_); }
-  weak_pointer(T * p) : p_(p) { register_weak_pointer(p_); }
+  weak_pointer() : p_(0), heap_(current_heap_())
+  { register_weak_pointer_(heap_, pp_()); }
+  weak_pointer(T * p) : p_(p), heap_(current_heap_())
+  { register_weak_pointer_(heap_, pp_()); }
+  // tag is put in q when gc sets this pointer to 0.
+  weak_pointer(T * p, reference_queue & q, void * tag)
+    : p_(p), heap_(current_heap_())
+  { register_weak_pointer_(heap_, pp_(), q, tag); }
 
   weak_pointer(const weak_pointer & p)
-    : p_(p.p_)
-  { register_weak_pointer(p_); }
+    : p_(p.p_), heap_(current_heap_())
+  { register_weak_pointer_(heap_, pp_()); }
 
-  ~weak_pointer() { unregister_weak_pointer(p_); }
+  ~weak_pointer() { unregister_weak_pointer_(heap_, pp_()); }
 
   operator const T * () const { return p_; }
   operator T * () { return p_; }
@@ -367,11 +889,20 @@ public:
   const T & operator * () const { return *p_; }
   T & operator * () { return *p_; }
 
+  weak_pointer & operator = (T * p) { p_ = p; return *this; }
+  weak_pointer & operator = (const weak_pointer & p)
+  { p_ = p.p_; return *this; }
+
   weak_pointer & wptr_register()
-  { register_weak_ptr(p_); }
+  { register_weak_pointer_(heap_, pp_()); return *this; }
+  // from now on tag is put in q when gc sets this pointer to 0.
+  weak_pointer & set_queue(reference_queue & q, void * tag)
+  { set_weak_pointer_queue_(heap_, pp_(), q, tag); return *this; }
 
-  weak_pointer & wptr_unregister() { unregister_weak_pointer(p_); }
-  weak_pointer & wptr_unregister_all() { unregister_all_weak_pointers(p_); }
+  weak_pointer & wptr_unregister()
+  { unregister_weak_pointer_(heap_, pp_()); return *this; }
+  weak_pointer & wptr_unregister_all()
+  { unregister_all_weak_pointers_(heap_, pp_()); return *this; }
 
   static
   void unregister_all_weak_pointers()
@@ -380,6 +911,9 @@ public:
 private:
 
   T * p_;
+  heap_impl * heap_; // registered in this heap.
+
+  gcobj * & pp_() { return reinterpret_cast<gcobj * &>(p_); }
 
 };
 
@@ -390,6 +924,381 @@ inline
 void gc_walk(const std::string &, weak_pointer<T> &)
 { }
 
+////////////////////////////////////
+// weak_intern_table
+
+class WPtrPool;
+
+// the part of a weak table that gc sees. slots_ is an array of nslots_
+// weak pointers. After each gc and gc_update_pointers() gc updates
+// the pointers in one pass, sets those to dead objects to 0 and then
+// calls gc_purge_().
+// If values_ isn't 0 the table is an ephemeron table, values_[k] is
+// walked by gc only if the object at slots_[k] is reachable, and is set
+// to 0 when slots_[k] is.
+class weak_table_ {
+public:
+
+  weak_table_(); // register with gc.
+  virtual ~weak_table_(); // unregister.
+
+  weak_table_(const weak_table_ &) = delete;
+  weak_table_ & operator = (const weak_table_ &) = delete;
+
+protected:
+
+  gcobj ** slots_;
+  gcobj ** values_;
+  std::size_t nslots_;
+
+  // called after each update, n slots were set to 0.
+  // Must not allocate managed objects.
+  virtual void gc_purge_(std::size_t n) = 0;
+
+  friend class WPtrPool;
+
+private:
+
+  heap_impl * heap_; // registered in this heap.
+
+}; // end of class weak_table_
+
+// weak_intern_table<K, T> maps keys to weak pointers to T. An entry goes
+// away by itself when gc reclaims its object, no weak_pointer
+// registration per entry and no destructor callback is needed.
+//
+// gc::weak_intern_table<std::string, Sym> syms;
+//
+// Sym * s = syms.intern(name, [&] { return new Sym(name); });
+//
+// K is an ordinary type, hashed by H and compared by E, and must not
+// contain pointers to managed objects. The table itself is not managed,
+// put it in a static or on the stack, not in a gcobj since gc would
+// move it. Lookups are open addressing over flat arrays.
+template <typename K, typename T, typename H = std::hash<K>,
+	  typename E = std::equal_to<K> >
+class weak_intern_table : public weak_table_ {
+public:
+
+  static_assert(std::is_base_of<gcobj, T>::value, "T must be a gcobj");
+
+  weak_intern_table() : n_(0), used_(0) { }
+
+  std::size_t size() const { return n_; }
+  bool empty() const { return n_ == 0; }
+  std::size_t capacity() const { return st_.size(); }
+
+  // object for k or 0.
+  T * find(const K & k) const
+  {
+    std::size_t x = find_(k);
+    return x == NONE ? 0 : static_cast<T *>(vals_[x]);
+  }
+
+  // insert or replace. 0 erases k.
+  void insert(const K & k, T * v)
+  {
+    if (v == 0) {
+      erase(k);
+      return;
+    }
+    std::size_t x = find_(k);
+    if (x != NONE) {
+      vals_[x] = v;
+      return;
+    }
+    if ((used_ + 1)*4 > capacity()*3)
+      // grow unless most used slots are deleted ones.
+      rehash_(capacity() < 8 ? 8 : n_*2 >= used_ ? capacity()*2 : capacity());
+    put_(k, v);
+  }
+
+  // object for k, made by calling make() and inserted if not found.
+  // make() may allocate and so gc, the table is kept up to date.
+  template <typename F>
+  T * intern(const K & k, F make)
+  {
+    T * v = find(k);
+    if (v == 0) {
+      v = make();
+      insert(k, v);
+    }
+    return v;
+  }
+
+  // return true if k was there.
+  bool erase(const K & k)
+  {
+    std::size_t x = find_(k);
+    if (x == NONE) return false;
+    kill_(x);
+    return true;
+  }
+
+  void clear()
+  {
+    keys_.clear();
+    vals_.clear();
+    st_.clear();
+    slots_ = 0;
+    nslots_ = 0;
+    n_ = used_ = 0;
+  }
+
+  // call f(key, object) for each entry, f must not allocate.
+  template <typename F>
+  void for_each(F f) const
+  {
+    std::size_t k = 0;
+    while (k < st_.size()) {
+      if (st_[k] == FULL)
+	f(keys_[k], static_cast<T *>(vals_[k]));
+      ++k;
+    }
+  }
+
+protected:
+
+  virtual void gc_purge_(std::size_t n)
+  {
+    std::size_t k = 0;
+    while (n > 0 && k < st_.size()) {
+      if (st_[k] == FULL && vals_[k] == 0) {
+	kill_(k);
+	--n;
+      }
+      ++k;
+    }
+  }
+
+private:
+
+  enum { EMPTY, FULL, DELETED };
+  static constexpr std::size_t NONE = ~std::size_t(0);
+
+  std::vector<K> keys_;
+  std::vector<gcobj *> vals_;
+  std::vector<unsigned char> st_;
+  std::size_t n_; // number of keys.
+  std::size_t used_; // FULL or DELETED slots.
+
+  // first slot to probe, capacity is a power of 2.
+  static std::size_t slot_(std::size_t h, std::size_t cap)
+  {
+    h ^= h >> 29;
+    h *= 0x9e3779b97f4a7c15ULL;
+    return (h ^ (h >> 32)) & (cap - 1);
+  }
+
+  std::size_t find_(const K & k) const
+  {
+    std::size_t cap = capacity();
+    if (n_ == 0) return NONE;
+
+    std::size_t x = slot_(H()(k), cap);
+    for (;;) {
+      unsigned char s = st_[x];
+      if (s == EMPTY) return NONE;
+      if (s == FULL && E()(keys_[x], k)) return x;
+      x = (x + 1) & (cap - 1);
+    }
+  }
+
+  void kill_(std::size_t x)
+  {
+    st_[x] = DELETED;
+    keys_[x] = K();
+    vals_[x] = 0;
+    --n_;
+  }
+
+  // k is not in the table and there is room.
+  void put_(const K & k, T * v)
+  {
+    std::size_t cap = capacity();
+    std::size_t x = slot_(H()(k), cap);
+    while (st_[x] == FULL)
+      x = (x + 1) & (cap - 1);
+    if (st_[x] == EMPTY) ++used_;
+    st_[x] = FULL;
+    keys_[x] = k;
+    vals_[x] = v;
+    ++n_;
+  }
+
+  void rehash_(std::size_t cap)
+  {
+    std::vector<K> ok(cap);
+    std::vector<gcobj *> ov(cap, 0);
+    std::vector<unsigned char> os(cap, EMPTY);
+    std::size_t k = 0;
+
+    ok.swap(keys_);
+    ov.swap(vals_);
+    os.swap(st_);
+    slots_ = vals_.data();
+    nslots_ = cap;
+    n_ = used_ = 0;
+    while (k < os.size()) {
+      if (os[k] == FULL)
+	put_(ok[k], static_cast<T *>(ov[k]));
+      ++k;
+    }
+  }
+
+}; // end of class weak_intern_table
+
+// ephemeron_table<K, V> maps objects to objects. An entry keeps its value
+// alive only as long as its key is reachable some other way, and goes
+// away when gc reclaims the key, even if the value points back to the
+// key. Use it to attach data to objects you don't own:
+//
+// gc::ephemeron_table<Node, Meta> meta;
+//
+// Meta * m = new Meta; // allocate first, then look up n.
+// meta.insert(n, m);
+// Meta * x = meta.find(n);
+//
+// Keys are compared by address. Since gc moves objects, the table is
+// rehashed after each gc and gc_update_pointers(). Like
+// weak_intern_table it must not be inside a managed object.
+template <typename K, typename V>
+class ephemeron_table : public weak_table_ {
+public:
+
+  static_assert(std::is_base_of<gcobj, K>::value, "K must be a gcobj");
+  static_assert(std::is_base_of<gcobj, V>::value, "V must be a gcobj");
+
+  ephemeron_table() : n_(0), used_(0) { }
+
+  std::size_t size() const { return n_; }
+  bool empty() const { return n_ == 0; }
+  std::size_t capacity() const { return st_.size(); }
+
+  // value for k or 0.
+  V * find(const K * k) const
+  {
+    std::size_t x = find_(k);
+    return x == NONE ? 0 : static_cast<V *>(vals_[x]);
+  }
+
+  // insert or replace. 0 erases k.
+  void insert(K * k, V * v)
+  {
+    if (v == 0) {
+      erase(k);
+      return;
+    }
+    std::size_t x = find_(k);
+    if (x != NONE) {
+      vals_[x] = v;
+      return;
+    }
+    if ((used_ + 1)*4 > capacity()*3)
+      rehash_(capacity() < 8 ? 8 : n_*2 >= used_ ? capacity()*2 : capacity());
+    put_(k, v);
+  }
+
+  // return true if k was there.
+  bool erase(const K * k)
+  {
+    std::size_t x = find_(k);
+    if (x == NONE) return false;
+    st_[x] = DELETED;
+    keys_[x] = vals_[x] = 0;
+    --n_;
+    return true;
+  }
+
+  void clear() { rehash_(0); }
+
+  // call f(key, value) for each entry, f must not allocate.
+  template <typename F>
+  void for_each(F f) const
+  {
+    std::size_t k = 0;
+    while (k < st_.size()) {
+      if (st_[k] == FULL)
+	f(static_cast<K *>(keys_[k]), static_cast<V *>(vals_[k]));
+      ++k;
+    }
+  }
+
+protected:
+
+  // keys have moved, start over.
+  virtual void gc_purge_(std::size_t)
+  { rehash_(capacity()); }
+
+private:
+
+  enum { EMPTY, FULL, DELETED };
+  static constexpr std::size_t NONE = ~std::size_t(0);
+
+  std::vector<gcobj *> keys_;
+  std::vector<gcobj *> vals_;
+  std::vector<unsigned char> st_;
+  std::size_t n_; // number of keys.
+  std::size_t used_; // FULL or DELETED slots.
+
+  static std::size_t slot_(const gcobj * k, std::size_t cap)
+  {
+    std::size_t h = reinterpret_cast<std::uintptr_t>(k) >> 3;
+    h *= 0x9e3779b97f4a7c15ULL;
+    return (h ^ (h >> 32)) & (cap - 1);
+  }
+
+  std::size_t find_(const gcobj * k) const
+  {
+    std::size_t cap = capacity();
+    if (n_ == 0 || k == 0) return NONE;
+
+    std::size_t x = slot_(k, cap);
+    for (;;) {
+      unsigned char s = st_[x];
+      if (s == EMPTY) return NONE;
+      if (s == FULL && keys_[x] == k) return x;
+      x = (x + 1) & (cap - 1);
+    }
+  }
+
+  void put_(gcobj * k, gcobj * v)
+  {
+    std::size_t cap = capacity();
+    std::size_t x = slot_(k, cap);
+    while (st_[x] == FULL)
+      x = (x + 1) & (cap - 1);
+    if (st_[x] == EMPTY) ++used_;
+    st_[x] = FULL;
+    keys_[x] = k;
+    vals_[x] = v;
+    ++n_;
+  }
+
+  // entries whose key gc set to 0 are dropped.
+  void rehash_(std::size_t cap)
+  {
+    std::vector<gcobj *> ok(cap, 0);
+    std::vector<gcobj *> ov(cap, 0);
+    std::vector<unsigned char> os(cap, EMPTY);
+    std::size_t k = 0;
+
+    ok.swap(keys_);
+    ov.swap(vals_);
+    os.swap(st_);
+    slots_ = keys_.data();
+    values_ = vals_.data();
+    nslots_ = cap;
+    n_ = used_ = 0;
+    while (k < os.size()) {
+      if (os[k] == FULL && ok[k] != 0)
+	put_(ok[k], ov[k]);
+      ++k;
+    }
+  }
+
+}; // end of class ephemeron_table
+
 //////////////////////////////////////
 // data
 
@@ -470,23 +1379,43 @@ template <typename T>
 struct data : public T {
 
   data(const std::string & txt)
-  { alf::gc::register_obj(txt, this, T::gc_walker); }
+    : heap_(0)
+  { gc_register_obj(txt); }
 
-  data() { /* defer registration */ }
+  data() : heap_(0) { /* defer registration */ }
 
   // use this if T has constructor with args.
   template <typename... Args>
   data(const std::string & txt, Args... args)
-    : T(args...)
-  { alf::gc::register_obj(txt, this, T::gc_walker); }
+    : T(args...), heap_(0)
+  { gc_register_obj(txt); }
 
   ~data() { gc_unregister_all_objs(); }
 
+  // all registrations are in the heap that was current at the first.
   data & gc_register_obj(const std::string & txt)
-  { alf::gc::register_obj(txt, this, T::gc_walker); }
+  {
+    if (heap_ == 0) heap_ = current_heap_();
+    register_obj_(heap_, txt, this, walk_(T::gc_walker));
+    return *this;
+  }
+
+  data & gc_unregister_obj()
+  { if (heap_) unregister_obj_(heap_, this); return *this; }
+  data & gc_unregister_all_objs()
+  { if (heap_) unregister_all_objs_(heap_, this); return *this; }
 
-  data & gc_unregister_obj() { alf::gc::unregister_obj(this); }
-  data & gc_unregister_all_objs() { alf::gc::unregister_all_objs_(this); }
+private:
+
+  heap_impl * heap_; // registered in this heap, 0 if not yet.
+
+  typedef void walk_func(const std::string &, void *);
+
+  // T::gc_walker takes T & or T *.
+  static walk_func * walk_(void f(const std::string &, T &))
+  { return reinterpret_cast<walk_func *>(f); }
+  static walk_func * walk_(void f(const std::string &, T *))
+  { return reinterpret_cast<walk_func *>(f); }
 
 }; // end of struct data
 
@@ -549,6 +1478,127 @@ void gc_walk_s(const std::string & txt, data<T> * ptr)
 // }
 //
 
+//////////////////////////////////////
+// heaps
+
+// A heap has its own pools, registered pointers, statistics and
+// settings. Every function in this file works on the current heap of
+// the calling thread, which is the initial heap until a heap::scope
+// makes another heap current. gc() only collects the current heap so
+// the pause only depends on what is in it.
+//
+// Objects of a heap may only point to objects of the same heap and an
+// object must be allocated and used while its heap is current. A
+// gc::pointer, weak_pointer, data, reference_queue or weak table keeps
+// the heap it was registered in and may be destroyed while another
+// heap is current, as long as its heap still exists. A pointer or
+// object registered with the register functions themselves must be
+// unregistered while its heap is current. Nothing is locked, two
+// threads may each use their own heap at the same time but never the
+// same heap.
+//
+// gc::heap h(32*1024*1024);
+// {
+//   gc::heap::scope s(h);
+//   gc::pointer<Foo> p = new Foo; // in h.
+//   gc::gc(); // only h.
+// }
+class heap {
+public:
+
+  // pool_size is the size of each half of the gc pool as for resize()
+  // and frozen_size the size of the first frozen pool minipool.
+  explicit heap(std::size_t pool_size = 128*1024*1024,
+		std::size_t frozen_size = 32*1024*1024);
+
+  // destroys all objects left in the heap. It must not be current in
+  // any other thread.
+  ~heap();
+
+  heap(const heap &) = delete;
+  heap & operator = (const heap &) = delete;
+
+  // makes h current in the calling thread while in scope.
+  class scope {
+  public:
+    explicit scope(heap & h);
+    ~scope();
+
+    scope(const scope &) = delete;
+    scope & operator = (const scope &) = delete;
+
+  private:
+    heap_impl * old_;
+  }; // end of class scope
+
+  // the heap all threads start with.
+  static heap & initial();
+
+  // the current heap of the calling thread.
+  static heap & current();
+
+private:
+
+  heap_impl * impl_;
+  bool own_; // the initial heap isn't deleted by us.
+
+  heap(heap_impl * impl);
+
+}; // end of class heap
+
+//////////////////////////////////////
+// arenas
+
+// Objects that all become garbage at the same time, like those built
+// for one request, can be allocated in an arena. While an arena_scope
+// is the innermost one of the current heap, objects that would go to
+// the gc pool are allocated from chunks of the arena instead. gc
+// treats them as live and doesn't move them. When the scope ends the
+// chunks are dropped as a whole, only objects that aren't nofinal are
+// destroyed one by one and weak pointers to the arena are set to 0.
+//
+// Before that what is reachable from the roots outside the arena is
+// walked as gc would. If any pointer found that way points into the
+// arena the arena is promoted instead: the objects stay where they
+// are and the next gc moves what is reachable to the gc pool. That
+// walk costs about what a gc costs, it is skipped and the arena
+// promoted when the arena is small next to the gc pool and the heap
+// outside isn't small too. Scopes must end in the reverse order they
+// were made, closing an arena that isn't the innermost one throws
+// fatal_error from the destructor, which ends the program.
+//
+// {
+//   gc::arena_scope a;
+//   Request * r = new Request(...); // in the arena.
+//   ...
+// } // r and all it points to in the arena are gone.
+class arena_scope {
+public:
+
+  // chunk_size is the size of each chunk, objects larger than that
+  // get a chunk of their own.
+  explicit arena_scope(std::size_t chunk_size = 1024*1024);
+  ~arena_scope();
+
+  arena_scope(const arena_scope &) = delete;
+  arena_scope & operator = (const arena_scope &) = delete;
+
+private:
+
+  heap_impl * heap_; // the arena is in this heap.
+  arena * arena_;
+
+}; // end of class arena_scope
+
+struct arena_info {
+  int opened;
+  int discarded;
+  int promoted;
+  std::size_t size_discarded; // bytes of the discarded arenas.
+};
+
+arena_info arena_stats();
+
 //////////////////////////////////////
 // other functions.
 
@@ -579,13 +1629,109 @@ std::size_t size_frozen();
 std::size_t size_unfrozen();
 std::size_t size_cur_frozen();
 
+// file regions mapped by mapped_file.
+int num_mapped();
+int num_unmapped();
+int num_cur_mapped();
+
+std::size_t size_mapped();
+std::size_t size_unmapped();
+std::size_t size_cur_mapped();
+
+// the frozen pool, where frozen and pinned objects live. Space freed
+// there is reused for new frozen objects, at the end of each gc a
+// minipool left empty is deleted, except the first, and the pages of
+// large free blocks are given back to the system.
+struct frozen_pool_info {
+  std::size_t pools; // number of minipools.
+  std::size_t size; // their total size.
+  std::size_t unused; // never used or given back at the end of a minipool.
+  std::size_t free; // in free blocks between frozen objects.
+  std::size_t free_blocks; // number of free blocks.
+  std::size_t largest_free; // largest free block.
+  std::size_t released; // total bytes given back with madvise.
+  std::size_t pools_released; // total minipools deleted.
+};
+
+frozen_pool_info frozen_pool_stats();
+
+// the gc pool is two halves of pool_size() bytes each, gc copies live
+// objects from one to the other. The half copied from is empty after
+// gc but stays in memory until it is used again. RELEASE_DONTNEED
+// gives its pages back to the system with madvise() at the end of each
+// gc, RELEASE_FREE uses MADV_FREE which lets the system take them only
+// when it needs memory and falls back to MADV_DONTNEED where it isn't
+// available. The first warm bytes of the half are kept since they are
+// the first to be used again. With MADV_FREE the pages still count in
+// rss until the system takes them.
+enum { RELEASE_NONE, RELEASE_DONTNEED, RELEASE_FREE };
+
+// set mode and warm size, return old mode. Default is RELEASE_NONE.
+int set_semispace_release(int mode, std::size_t warm = 0);
+int semispace_release();
+
+struct semispace_info {
+  std::size_t size; // size of each half.
+  std::size_t warm; // bytes kept at the start of the inactive half.
+  int releases; // number of times pages were given back.
+  std::size_t released; // total bytes given back.
+  // resident set size of the process just before and just after
+  // the last release, 0 if it can't be read.
+  std::size_t rss_before;
+  std::size_t rss_after;
+};
+
+semispace_info semispace_stats();
+
+// The heap is the memory held by the pools: both halves of the gc pool,
+// the frozen pool, large objects and pages of medium objects. With a
+// limit set, a pool that must grow past it first calls the heap
+// callbacks and does one emergency gc. If it still must grow
+// gc_allocation_error is thrown. The frozen pool doesn't do the gc when
+// it grows while an object is being frozen, since gc would move that
+// object, and neither does resize(). The gc pool holds both the old and
+// the new halves while it grows, the limit counts both. 0 means no
+// limit, which is the default. Return old limit.
+std::size_t set_heap_limit(std::size_t limit);
+std::size_t heap_limit();
+
+// fn(heap, limit, data) is called when the heap is about to grow to at
+// least pct percent of the limit so caches can drop entries. Once called
+// it isn't called again until the heap has been below that. Callbacks
+// are never called during gc.
+typedef void (* heap_callback)(std::size_t heap, std::size_t limit,
+			       void * data);
+
+void add_heap_callback(unsigned int pct, heap_callback fn, void * data = 0);
+void remove_heap_callback(heap_callback fn, void * data = 0);
+
+struct heap_info {
+  std::size_t size; // bytes held by the pools.
+  std::size_t peak; // most they ever held.
+  std::size_t limit; // 0 if none.
+  std::size_t headroom; // limit - size, 0 if no limit.
+  int callbacks; // heap callbacks called.
+  int emergency_gcs;
+  int refused; // times a pool was not allowed to grow.
+};
+
+heap_info heap_stats();
+
 // return total time in seconds spent on gc.
 // pointer will receive time spent including nano seconds. 
 time_t time_gc(struct timeval * tv = 0);
 
 int num_gc(); // number of times gc() is called.
 
-void reset_num_gc(); // reset num_gc() and time_gc().
+void reset_num_gc(); // reset num_gc(), time_gc() and the pause data below.
+
+// gc pause distribution. Bucket 0 counts gc that took less than 1 us,
+// bucket k those that took at least 2^(k-1) but less than 2^k us.
+enum { GC_PAUSE_BUCKETS = 32 };
+int num_gc_pauses(int bucket);
+
+// longest gc in seconds, pointer receives it including micro seconds.
+time_t max_gc_pause(struct timeval * tv = 0);
 
 // return true if we have started but not yet completed a gc.
 // This should always be true inside gc_walker functions but if
@@ -613,18 +1759,201 @@ std::size_t pool_size(); // size of current gc pool.
 void resize(std::size_t newsz);
 
 // Set/get the size threshold for putting objects in large pool.
+// Objects this large get a block of their own.
 std::size_t large_size();
 
 // Set the size, return old size.
-// if newsz < 256, it is set to 256.
+// if newsz < 4096, it is set to 4096.
 std::size_t set_large_size(std::size_t newsz);
 
+// Set/get the size threshold for putting objects in medium pool.
+// Objects from medium_size() up to large_size() are kept in pages of
+// slots of the same size and are never moved, smaller objects are
+// moved by gc.
+std::size_t medium_size();
+
+// Set the size, return old size.
+// if newsz < 1024, it is set to 1024.
+std::size_t set_medium_size(std::size_t newsz);
+
 std::ostream & report(std::ostream & os);
 
 inline
 void report()
 { report(std::cout); }
 
+//////////////////////////////////
+// allocation sampling
+
+// When enabled, roughly one allocation every rate bytes is sampled.
+// A sample records a backtrace and, once the object is constructed,
+// its dynamic type. Samples are followed through gc() so you can see
+// which types and code paths are responsible for memory that stays alive.
+// Sampling is off (rate 0) by default.
+enum { DEFAULT_SAMPLE_RATE = 512*1024 };
+
+// set the rate in bytes, 0 turns sampling off. Return old rate.
+std::size_t set_sample_rate(std::size_t rate = DEFAULT_SAMPLE_RATE);
+std::size_t sample_rate();
+
+// live and allocated samples per type.
+std::ostream & sample_report(std::ostream & os);
+
+// write samples in pprof's legacy heap profile format, i.e.
+// pprof --text prog file.
+std::ostream & heap_profile(std::ostream & os);
+
+//////////////////////////////////
+// phase trace
+
+// When enabled, the last n phases of gc(), gc_update_pointers(),
+// freeze, unfreeze and resizing the gc pool are kept: when each began,
+// how long it took and how many objects and bytes it copied or
+// deallocated. gc is one phase and walking its roots, sweeping,
+// finalizing and so on are phases inside it.
+// The trace is off (n 0) by default.
+enum { DEFAULT_PHASE_TRACE = 4096 };
+
+// keep the last n phases, 0 turns the trace off. Both empty the trace.
+// Return old n.
+std::size_t set_phase_trace(std::size_t n = DEFAULT_PHASE_TRACE);
+std::size_t phase_trace_size();
+
+// write the trace in Chrome's trace event format, load it in
+// chrome://tracing or ui.perfetto.dev. Another thread may write the
+// trace of a heap, in a heap::scope for it, while that heap is in gc
+// but not while set_phase_trace() is called.
+std::ostream & phase_trace(std::ostream & os);
+
+//////////////////////////////////
+// finalization
+
+// gc calls the destructor of every unreachable object. By default
+// (FINALIZE_IN_GC) that happens during gc so slow destructors make the
+// gc pause longer. With FINALIZE_AFTER_GC unreachable objects are
+// queued and destroyed when gc() is done, outside the timed pause, and
+// blocks of large objects are released then too. With FINALIZE_ON_DEMAND
+// they wait until you call run_finalizers().
+// A queued object is no longer in the heap, weak pointers to it are
+// already 0 and objects it points to may be destroyed before it. An
+// object in the gc pool or a medium object is destroyed at a new
+// address, just as if gc had moved it.
+enum { FINALIZE_IN_GC, FINALIZE_AFTER_GC, FINALIZE_ON_DEMAND };
+
+// set mode, return old mode. Switching to FINALIZE_IN_GC runs
+// all queued destructors.
+int set_finalize_mode(int mode);
+int finalize_mode();
+
+// run at most budget queued destructors, 0 runs all.
+// Return number of destructors run.
+std::size_t run_finalizers(std::size_t budget = 0);
+
+// number of objects waiting for their destructor.
+std::size_t pending_finalizers();
+
+//////////////////////////////////
+// copy order
+
+// gc copies live objects in the gc pool to a new place in the order it
+// finds them. COPY_DEPTH_FIRST (default) walks each object as soon as
+// it is copied, an object is followed by its first child, that child's
+// first child and so on, good for lists and for walking trees in
+// order. COPY_HIERARCHICAL copies breadth first until about a page is
+// filled and then does the same for each object not yet walked, so each
+// page holds a small subtree, good for trees that are searched from the
+// root. COPY_BREADTH_FIRST copies all objects at
+// distance 1 from a root, then 2 and so on and never recurses deeper
+// than one object, it needs room for a queue of all live objects.
+enum { COPY_DEPTH_FIRST, COPY_HIERARCHICAL, COPY_BREADTH_FIRST };
+
+// set order for the next gc, return old order.
+int set_copy_order(int order);
+int copy_order();
+
+//////////////////////////////////
+// heap snapshot
+
+// Write all live objects and the pointers between them to file fname.
+// Nothing is moved or reclaimed. The file is read by tools/gcsnap
+// which computes dominators and retained sizes.
+// Return number of objects written, throws gc_error if the file
+// can't be written.
+std::size_t heap_snapshot(const std::string & fname);
+
+//////////////////////////////////
+// heap image
+
+// save_image() writes every reachable object to file fname, packed one
+// after the other, and load_image() maps such a file back in another
+// run of the same program. The loaded objects are frozen, unfreeze one
+// to let gc move and reclaim it as usual. Each registered pointer, see
+// register_root_ptr() and pointer<T>, that was set when the image was
+// saved gets the loaded object if a registered pointer with the same
+// label exists when the image is loaded. Roots should have unique
+// labels, the first one found is saved.
+//
+// Every type in an image must be registered with image_type<T>() in
+// both runs and have a constructor T(const gc::image_t &) that
+// initializes no member, load_image() runs it on the loaded bytes to
+// set the vtable and then relocates the pointers with gc_walker. So
+// objects in an image can only hold plain data and pointers walked by
+// gc_walker, not std::string, registered pointers, weak pointers or
+// mapped_file. gc::array, gc::buffer and the containers in gccont.hxx
+// have such a constructor.
+//
+// gc::image_type<Config>();
+// gc::pointer<Config> cfg("config");
+// try {
+//   gc::load_image("config.img");
+// } catch (const gc::gc_error &) {
+//   cfg = build_config();
+//   gc::save_image("config.img");
+// }
+//
+// Both return the number of objects and throw gc_error on failure.
+std::size_t save_image(const std::string & fname);
+std::size_t load_image(const std::string & fname);
+
+typedef void (* image_ctor_)(void * p);
+void image_type_(const std::type_info & t, image_ctor_ ctor,
+		 const field_map * fm);
+
+template <typename T, typename = void>
+struct image_fmap_ {
+  static const field_map * get() { return 0; }
+};
+
+template <typename T>
+struct image_fmap_<T, std::void_t<typename T::gc_fields> > {
+  static const field_map * get()
+  { return field_map_of<T, typename T::gc_fields>::get(); }
+};
+
+template <typename T>
+inline
+void image_type()
+{
+  static_assert(std::is_base_of<gcobj, T>::value, "T must be a gcobj");
+  image_type_(typeid(T), [](void * p) { ::new (p) T(image); },
+	      image_fmap_<T>::get());
+}
+
+// one step on a path from a root to an object. txt is the text
+// given to gc_walk() for the pointer to obj, the first step is a root.
+struct retention_step {
+  std::string txt;
+  gcobj * obj;
+
+  retention_step(const std::string & t, gcobj * o) : txt(t), obj(o) { }
+};
+
+// Why is obj still alive? Return a shortest path from a root to obj,
+// empty if obj isn't reachable. Like heap_snapshot() nothing is moved.
+// If obj is only reachable through the value of an ephemeron whose key
+// is reachable, the path starts at that value with txt "ephemeron".
+std::vector<retention_step> retention_path(gcobj * obj);
+
 //////////////////////////////////
 // gc_error
 
@@ -0,0 +1,447 @@
+#ifndef __ALF_GCCONT_HXX__
+#define __ALF_GCCONT_HXX__
+
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "gc.hxx"
+
+// Containers that keep all their data in managed blocks, built on
+// gc::array. Their memory is counted by gc, moves with them and is
+// reclaimed without calling any destructor.
+//
+// Element, key and value types follow the rules of array: a pointer to a
+// class derived from gcobj or plain data without such pointers.
+//
+// Functions marked "may gc" allocate and may move every object in the
+// gc pool including the container itself, they keep track of their own
+// arguments but the caller must hold the container in a registered
+// pointer (gc::pointer) or in another managed object. Pointers to
+// elements are only good until the next allocation.
+
+namespace alf {
+
+namespace gc {
+
+// keeps a T alive and up to date while we allocate, a registered
+// pointer if T is a gcobj pointer, else just a copy.
+template <typename T, bool P = array<T>::gc_pointers>
+struct hold_ {
+  T v;
+
+  hold_(const T & x) : v(x) { }
+
+  T get() const { return v; }
+
+}; // end of struct hold_
+
+template <typename T>
+struct hold_<T, true> {
+  pointer<typename std::remove_pointer<T>::type> p;
+
+  hold_(T x) : p("gccont", x) { }
+
+  T get() { return p; }
+
+}; // end of struct hold_
+
+////////////////////////
+// string
+
+// immutable string, the characters follow the object in its block and
+// are always followed by a '\0'. gc never looks at the characters.
+//
+// gc::string * s = gc::string::make("hello");
+//
+// make() may gc, so don't make a string from the characters of another
+// managed object.
+class string : public nofinal<gcobj> {
+public:
+
+  static string * make(const char * s, std::size_t n)
+  {
+    void * p = allocate_array_(sizeof(string), n + 1, 1, ALLOC_NOFINAL,
+			       field_map_of<string, fields<> >::get());
+    return ::new (p) string(s, n);
+  }
+
+  static string * make(const char * s) { return make(s, std::strlen(s)); }
+
+  static string * make(std::string_view s)
+  { return make(s.data(), s.size()); }
+
+  // for load_image().
+  string(const image_t &) { }
+
+  virtual void gc_walker(const std::string &) { }
+
+  std::size_t size() const { return n_; }
+  bool empty() const { return n_ == 0; }
+
+  const char * data() const { return reinterpret_cast<const char *>(this + 1); }
+  const char * c_str() const { return data(); }
+
+  char operator [] (std::size_t k) const { return data()[k]; }
+
+  std::string_view view() const { return std::string_view(data(), n_); }
+  std::string str() const { return std::string(data(), n_); }
+
+  int compare(std::string_view s) const { return view().compare(s); }
+
+  std::size_t hash() const { return std::hash<std::string_view>()(view()); }
+
+private:
+
+  std::size_t n_;
+
+  string(const char * s, std::size_t n) : n_(n)
+  {
+    char * p = reinterpret_cast<char *>(this + 1);
+    std::memcpy(p, s, n);
+    p[n] = '\0';
+  }
+
+  // use make().
+  void * operator new(size_t sz) = delete;
+
+}; // end of class string
+
+inline
+bool operator == (const string & a, const string & b)
+{ return a.view() == b.view(); }
+
+inline
+bool operator != (const string & a, const string & b)
+{ return a.view() != b.view(); }
+
+inline
+bool operator < (const string & a, const string & b)
+{ return a.view() < b.view(); }
+
+inline
+std::ostream & operator << (std::ostream & os, const string & s)
+{ return os << s.view(); }
+
+////////////////////////
+// vector
+
+// growable vector of T, the elements are in an array<T>.
+//
+// gc::pointer<gc::vector<Node *> > v("v", new gc::vector<Node *>);
+// v->push_back(n);
+template <typename T>
+class vector : public nofinal<gcobj> {
+public:
+
+  typedef T value_type;
+  typedef T * iterator;
+  typedef const T * const_iterator;
+
+  vector() : buf_(0), n_(0) { }
+  vector(const image_t &) { }
+
+  virtual void gc_walker(const std::string & txt)
+  { gc_walk(txt + ".buf", buf_); }
+
+  std::size_t size() const { return n_; }
+  std::size_t capacity() const { return buf_ ? buf_->size() : 0; }
+  bool empty() const { return n_ == 0; }
+
+  T * data() { return buf_ ? buf_->data() : 0; }
+  const T * data() const { return buf_ ? buf_->data() : 0; }
+
+  T & operator [] (std::size_t k) { return data()[k]; }
+  const T & operator [] (std::size_t k) const { return data()[k]; }
+
+  T & back() { return data()[n_ - 1]; }
+  const T & back() const { return data()[n_ - 1]; }
+
+  iterator begin() { return data(); }
+  iterator end() { return data() + n_; }
+  const_iterator begin() const { return data(); }
+  const_iterator end() const { return data() + n_; }
+
+  // may gc.
+  void push_back(T x)
+  {
+    if (n_ < capacity()) {
+      data()[n_++] = x;
+      return;
+    }
+    hold_<T> hx(x);
+    pointer<vector> self("gc::vector", this);
+    grow_(self, n_ + 1);
+    self->data()[self->n_++] = hx.get();
+  }
+
+  void pop_back() { data()[--n_] = T(); }
+
+  // may gc.
+  void reserve(std::size_t n)
+  {
+    if (n <= capacity()) return;
+    pointer<vector> self("gc::vector", this);
+    grow_(self, n);
+  }
+
+  // new elements are 0, may gc.
+  void resize(std::size_t n)
+  {
+    vector * v = this;
+    if (n > capacity()) {
+      pointer<vector> self("gc::vector", this);
+      grow_(self, n);
+      v = self;
+    }
+    while (v->n_ > n) v->pop_back();
+    v->n_ = n;
+  }
+
+  // keeps the capacity.
+  void clear() { resize(0); }
+
+private:
+
+  array<T> * buf_;
+  std::size_t n_;
+
+  // at least n elements, at least double the size.
+  static void grow_(pointer<vector> & self, std::size_t n)
+  {
+    std::size_t cap = self->capacity()*2;
+    if (cap < n) cap = n;
+    if (cap < 4) cap = 4;
+    array<T> * b = array<T>::make(cap);
+    if (self->n_)
+      std::memcpy(b->data(), self->data(), self->n_*sizeof(T));
+    self->buf_ = b;
+  }
+
+}; // end of class vector
+
+////////////////////////
+// hash_map
+
+// hash and equality used by hash_map. Pointer keys other than string
+// pointers are not supported since the address of an object changes
+// when gc moves it.
+template <typename K>
+struct hash {
+  static_assert(! std::is_pointer<K>::value,
+		"hash_map key can't be a pointer except string *");
+
+  std::size_t operator () (const K & k) const { return std::hash<K>()(k); }
+
+}; // end of struct hash
+
+template <>
+struct hash<string *> {
+
+  std::size_t operator () (const string * s) const { return s->hash(); }
+  std::size_t operator () (std::string_view s) const
+  { return std::hash<std::string_view>()(s); }
+
+}; // end of struct hash
+
+template <typename K>
+struct equal_to {
+
+  bool operator () (const K & a, const K & b) const { return a == b; }
+
+}; // end of struct equal_to
+
+template <>
+struct equal_to<string *> {
+
+  bool operator () (const string * a, const string * b) const
+  { return a->view() == b->view(); }
+  bool operator () (const string * a, std::string_view b) const
+  { return a->view() == b; }
+
+}; // end of struct equal_to
+
+// open addressing hash map with linear probing. Keys, values and the
+// state of each slot are three arrays. Look up with any type Q that
+// H and E accept, a hash_map<string *, V> can be searched with a
+// std::string_view without making a string.
+template <typename K, typename V, typename H = hash<K>,
+	  typename E = equal_to<K> >
+class hash_map : public nofinal<gcobj> {
+public:
+
+  typedef K key_type;
+  typedef V mapped_type;
+
+  hash_map() : keys_(0), vals_(0), st_(0), n_(0), used_(0) { }
+  hash_map(const image_t &) { }
+
+  virtual void gc_walker(const std::string & txt)
+  {
+    gc_walk(txt + ".keys", keys_);
+    gc_walk(txt + ".vals", vals_);
+    gc_walk(txt + ".st", st_);
+  }
+
+  std::size_t size() const { return n_; }
+  bool empty() const { return n_ == 0; }
+  std::size_t capacity() const { return st_ ? st_->size() : 0; }
+
+  // value for key q or 0.
+  template <typename Q>
+  V * find(const Q & q)
+  {
+    std::size_t k = find_(q);
+    return k == NONE ? 0 : & (*vals_)[k];
+  }
+
+  template <typename Q>
+  const V * find(const Q & q) const
+  { return const_cast<hash_map *>(this)->find(q); }
+
+  template <typename Q>
+  bool contains(const Q & q) const { return find_(q) != NONE; }
+
+  // insert or replace, return true if k is new. May gc.
+  bool set(K k, V v)
+  {
+    std::size_t x = find_(k);
+    if (x != NONE) {
+      (*vals_)[x] = v;
+      return false;
+    }
+    hash_map * m = this;
+    if ((used_ + 1)*4 > capacity()*3) {
+      hold_<K> hk(k);
+      hold_<V> hv(v);
+      pointer<hash_map> self("gc::hash_map", this);
+      // grow unless most used slots are deleted ones.
+      std::size_t cap = capacity();
+      if (cap < 8) cap = 8;
+      if (n_*2 >= used_) cap *= 2;
+      rehash_(self, cap);
+      m = self;
+      k = hk.get();
+      v = hv.get();
+    }
+    m->put_(k, v);
+    return true;
+  }
+
+  // return true if q was there.
+  template <typename Q>
+  bool erase(const Q & q)
+  {
+    std::size_t k = find_(q);
+    if (k == NONE) return false;
+    (*st_)[k] = DELETED;
+    (*keys_)[k] = K();
+    (*vals_)[k] = V();
+    --n_;
+    return true;
+  }
+
+  // keeps the capacity.
+  void clear()
+  {
+    std::size_t k = 0, cap = capacity();
+    while (k < cap) {
+      (*st_)[k] = EMPTY;
+      (*keys_)[k] = K();
+      (*vals_)[k] = V();
+      ++k;
+    }
+    n_ = used_ = 0;
+  }
+
+  // call f(key, value) for each entry, f must not allocate.
+  template <typename F>
+  void for_each(F f)
+  {
+    std::size_t k = 0, cap = capacity();
+    while (k < cap) {
+      if ((*st_)[k] == FULL)
+	f((*keys_)[k], (*vals_)[k]);
+      ++k;
+    }
+  }
+
+private:
+
+  enum { EMPTY, FULL, DELETED };
+  static constexpr std::size_t NONE = ~std::size_t(0);
+
+  array<K> * keys_;
+  array<V> * vals_;
+  array<unsigned char> * st_;
+  std::size_t n_; // number of keys.
+  std::size_t used_; // FULL or DELETED slots.
+
+  // first slot to probe, capacity is a power of 2.
+  static std::size_t slot_(std::size_t h, std::size_t cap)
+  {
+    h ^= h >> 29;
+    h *= 0x9e3779b97f4a7c15ULL;
+    return (h ^ (h >> 32)) & (cap - 1);
+  }
+
+  template <typename Q>
+  std::size_t find_(const Q & q) const
+  {
+    std::size_t cap = capacity();
+    if (n_ == 0) return NONE;
+
+    std::size_t k = slot_(H()(q), cap);
+    for (;;) {
+      unsigned char s = (*st_)[k];
+      if (s == EMPTY) return NONE;
+      if (s == FULL && E()((*keys_)[k], q)) return k;
+      k = (k + 1) & (cap - 1);
+    }
+  }
+
+  // k is not in the map and there is room.
+  void put_(K k, V v)
+  {
+    std::size_t cap = capacity();
+    std::size_t x = slot_(H()(k), cap);
+    while ((*st_)[x] == FULL)
+      x = (x + 1) & (cap - 1);
+    if ((*st_)[x] == EMPTY) ++used_;
+    (*st_)[x] = FULL;
+    (*keys_)[x] = k;
+    (*vals_)[x] = v;
+    ++n_;
+  }
+
+  static void rehash_(pointer<hash_map> & self, std::size_t cap)
+  {
+    pointer<array<K> > keys("gc::hash_map", array<K>::make(cap));
+    pointer<array<V> > vals("gc::hash_map", array<V>::make(cap));
+    array<unsigned char> * st = array<unsigned char>::make(cap);
+    hash_map * m = self;
+    array<K> * ok = m->keys_;
+    array<V> * ov = m->vals_;
+    array<unsigned char> * os = m->st_;
+    std::size_t k = 0, ocap = m->capacity();
+
+    m->keys_ = keys;
+    m->vals_ = vals;
+    m->st_ = st;
+    m->n_ = m->used_ = 0;
+    while (k < ocap) {
+      if ((*os)[k] == FULL)
+	m->put_((*ok)[k], (*ov)[k]);
+      ++k;
+    }
+  }
+
+}; // end of class hash_map
+
+}; // end of namespace gc
+
+}; // end of namespace alf
+
+#endif
@@ -0,0 +1,157 @@
+
+#include <cstring>
+#include <new>
+
+#include "../gc.hxx"
+
+#include "head.hxx"
+#include "ptrpool.hxx"
+#include "wptrpool.hxx"
+#include "fptrpool.hxx"
+#include "finalizer.hxx"
+
+alf::gc::Finalizer::Finalizer(statistics & S, PtrPool & pp, WPtrPool & wp,
+				FPtrPool & fpp)
+  : S_(S), pp_(pp), wp_(wp), fpp_(fpp), mode_(FINALIZE_IN_GC), running_(false),
+    fill_(0)
+{ }
+
+alf::gc::Finalizer::~Finalizer()
+{
+  run(0);
+  // all copies are gone, what is left is empty.
+  if (fill_)
+    spare_.push_back(fill_);
+  for (chunk * c : spare_) {
+    delete [] c->p;
+    delete c;
+  }
+}
+
+int alf::gc::Finalizer::set_mode(int m)
+{
+  int old = mode_;
+
+  switch (m) {
+  case FINALIZE_IN_GC:
+  case FINALIZE_AFTER_GC:
+  case FINALIZE_ON_DEMAND:
+    break;
+
+  default:
+    throw gc_error("set_finalize_mode: invalid mode");
+  }
+  mode_ = m;
+  if (m == FINALIZE_IN_GC)
+    // nobody would run these otherwise.
+    run(0);
+  return old;
+}
+
+void alf::gc::Finalizer::defer(head * h, gcobj * obj)
+{
+  std::size_t usz = h->usz;
+  chunk * c;
+  void * mem = copy_mem_(usz, c);
+
+  std::memcpy(mem, obj, usz);
+  // root pointers registered inside the object go with it
+  // so the destructor can unregister them.
+  ssize_t delta = reinterpret_cast<char *>(mem) - reinterpret_cast<char *>(obj);
+  pp_.update_pp(h, 0, delta);
+  wp_.update_pp(h, 0, delta);
+  fpp_.update_pp(h, 0, delta);
+  Q_.emplace_back(reinterpret_cast<gcobj *>(mem), mem, c);
+}
+
+void alf::gc::Finalizer::defer_large(head * h, gcobj * obj)
+{
+  Q_.emplace_back(obj, h, nullptr);
+}
+
+void * alf::gc::Finalizer::copy_mem_(std::size_t usz, chunk * & c)
+{
+  std::size_t asz = (usz + ALIGN - 1)/ALIGN*ALIGN;
+
+  if (fill_ && fill_->used + asz > fill_->sz) {
+    // the last copy in it to be destroyed frees it.
+    if (fill_->live == 0)
+      free_chunk_(fill_);
+    fill_ = 0;
+  }
+  if (fill_ == 0)
+    fill_ = new_chunk_(asz);
+  c = fill_;
+  void * mem = c->p + c->used;
+  c->used += asz;
+  ++c->live;
+  return mem;
+}
+
+alf::gc::Finalizer::chunk * alf::gc::Finalizer::new_chunk_(std::size_t sz)
+{
+  if (sz <= CHUNK_SIZE && ! spare_.empty()) {
+    chunk * c = spare_.back();
+    spare_.pop_back();
+    return c;
+  }
+  if (sz < CHUNK_SIZE) sz = CHUNK_SIZE;
+  chunk * c = new chunk;
+  c->p = new char[sz];
+  c->sz = sz;
+  c->used = 0;
+  c->live = 0;
+  return c;
+}
+
+void alf::gc::Finalizer::free_chunk_(chunk * c)
+{
+  if (c->sz == CHUNK_SIZE && spare_.size() < CHUNK_KEEP) {
+    c->used = 0;
+    spare_.push_back(c);
+    return;
+  }
+  delete [] c->p;
+  delete c;
+}
+
+void alf::gc::Finalizer::release_(const entry & e)
+{
+  if (e.c == 0) {
+    // as Lpool::destroy_.
+    S_.shrink(reinterpret_cast<head *>(e.mem)->sz);
+    delete [] reinterpret_cast<char *>(e.mem);
+    return;
+  }
+  if (--e.c->live > 0)
+    return;
+  if (e.c == fill_)
+    // start over at the front.
+    e.c->used = 0;
+  else
+    free_chunk_(e.c);
+}
+
+std::size_t alf::gc::Finalizer::run(std::size_t budget)
+{
+  // a destructor may allocate and so trigger a gc that would
+  // call us again, leave those for the outer loop.
+  if (running_) return 0;
+
+  std::size_t n = 0;
+  // whatever leaves the loop, we are no longer running.
+  struct guard {
+    bool & running;
+    ~guard() { running = false; }
+  } g = { running_ };
+
+  running_ = true;
+  while (! Q_.empty() && (budget == 0 || n < budget)) {
+    entry e = Q_.front();
+    Q_.pop_front();
+    e.obj->~gcobj();
+    release_(e);
+    ++n;
+  }
+  return n;
+}
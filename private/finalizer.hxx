@@ -0,0 +1,111 @@
+#ifndef __GC_PRIV_FINALIZER_HXX__
+#define __GC_PRIV_FINALIZER_HXX__
+
+#include <cstdlib>
+
+#include <deque>
+#include <vector>
+
+#include "../gc.hxx"
+#include "head.hxx"
+#include "gcstat.hxx"
+
+namespace alf {
+
+namespace gc {
+
+class PtrPool;
+class WPtrPool;
+class FPtrPool;
+
+// Finalizer keeps unreachable objects whose destructor hasn't run yet.
+// In FINALIZE_IN_GC mode it isn't used at all and gc destroys objects
+// as before. Otherwise gc hands the dead objects to defer() and
+// defer_large() and the destructors run in run() after gc is done.
+//
+// An object in GCpool is copied out of the pool since the pool is
+// reused by the next gc, i.e. the destructor runs on a copy just as
+// any gc may move the object. The copies are put one after the other
+// in chunks kept by the Finalizer so gc doesn't call operator new for
+// each. A large object is left where it is and its block is released
+// after the destructor has run.
+class Finalizer {
+public:
+
+  Finalizer(statistics & S, PtrPool & pp, WPtrPool & wp, FPtrPool & fpp);
+  ~Finalizer();
+
+  int mode() const { return mode_; }
+
+  // set new mode, return old mode.
+  int set_mode(int m);
+
+  bool deferred() const { return mode_ != FINALIZE_IN_GC; }
+
+  // unreachable object obj at h in GCpool, called by GCpool::finalize_.
+  void defer(head * h, gcobj * obj);
+
+  // unreachable large object obj at h, called by Lpool::gc_cleanup.
+  void defer_large(head * h, gcobj * obj);
+
+  // called by gc() after the pause is over.
+  void after_gc() { if (mode_ == FINALIZE_AFTER_GC) run(0); }
+
+  // run at most budget destructors, 0 runs all. Return number run.
+  std::size_t run(std::size_t budget);
+
+  std::size_t pending() const { return Q_.size(); }
+
+private:
+
+  enum {
+    CHUNK_SIZE = 64*1024, // copies that fit share a chunk of this size.
+    CHUNK_KEEP = 4, // empty chunks kept for the next gc.
+    ALIGN = 16 // copies start at a multiple of this.
+  };
+
+  struct chunk {
+    char * p;
+    std::size_t sz;
+    std::size_t used; // bytes handed out from p.
+    std::size_t live; // copies in it whose destructor hasn't run.
+  }; // end of struct chunk
+
+  struct entry {
+    gcobj * obj;
+    void * mem; // memory to release when done.
+    chunk * c; // holds the copy, 0 if mem is an Lpool block.
+
+    entry(gcobj * o, void * m, chunk * x) : obj(o), mem(m), c(x) { }
+  }; // end of struct entry
+
+  statistics & S_;
+  PtrPool & pp_;
+  WPtrPool & wp_;
+  FPtrPool & fpp_;
+  int mode_;
+  bool running_; // run() is active, destructors may trigger gc.
+  std::deque<entry> Q_;
+  chunk * fill_; // where the next copy goes, or 0.
+  std::vector<chunk *> spare_; // empty chunks of CHUNK_SIZE.
+
+  // room for a copy of usz bytes, c is set to its chunk.
+  void * copy_mem_(std::size_t usz, chunk * & c);
+
+  // an empty chunk of at least sz bytes.
+  chunk * new_chunk_(std::size_t sz);
+
+  // keep the empty chunk c in spare_ or delete it.
+  void free_chunk_(chunk * c);
+
+  // the destructor of e has run, release its memory.
+  void release_(const entry & e);
+
+}; // end of class Finalizer
+
+}; // end of namespace gc
+
+}; // end of namespace alf
+
+
+#endif
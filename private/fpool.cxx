@@ -1,12 +1,17 @@
 
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include <cstdlib>
 
+#include <algorithm>
 #include <new>
 #include <string>
 #include <stdexcept>
 
 #include "gcpool.hxx"
 #include "fpool.hxx"
+#include "limiter.hxx"
 #include "gcstat.hxx"
 #include "../../format/format.hxx"
 
@@ -14,8 +19,8 @@
 // and moved back to gcpool when unfrozen.
 // Note that large objects are allocated in lpool and never moved.
 
-alf::gc::Fpool::Fpool(statistics & S, std::size_t sz)
-  : pool(sz), S_(S)
+alf::gc::Fpool::Fpool(statistics & S, Limiter & L, std::size_t sz)
+  : pool(sz), S_(S), lim_(L), released_(0), pools_released_(0)
 {
   minipool * a = new minipool(S, sz);
   F_.push_back(a);
@@ -30,7 +35,13 @@ alf::gc::Fpool::~Fpool()
   pool_iterator a = F_.begin();
   while (a != F_.end()) {
     minipool * p = *a;
+    char * m = p->p_;
+    std::size_t sz = p->sz_;
+    bool mapped =
+      std::find(mapped_.begin(), mapped_.end(), p) != mapped_.end();
     delete p; // destructor will remove objects in pool.
+    if (mapped)
+      ::munmap(m, sz);
     ++a;
   }
   // since all objects are gone, free list is no longer valid or needed.
@@ -38,7 +49,7 @@ alf::gc::Fpool::~Fpool()
 }
 
 // resizing Fpool means add another minipool to our list.
-// we never deallocate any minipool except when program exit.
+// release_() deletes it again once it is empty.
 alf::gc::Fpool & alf::gc::Fpool::enlarge(size_t inc)
 {
   minipool * p = new minipool(S_, inc);
@@ -46,6 +57,95 @@ alf::gc::Fpool & alf::gc::Fpool::enlarge(size_t inc)
   return *this;
 }
 
+alf::gc::Fpool & alf::gc::Fpool::adopt_(minipool * mp)
+{
+  F_.push_back(mp);
+  mapped_.push_back(mp);
+  return *this;
+}
+
+void alf::gc::Fpool::link_unfrozen_()
+{
+  for (head * h : unfrozen_)
+    link_free(h);
+  unfrozen_.clear();
+}
+
+void alf::gc::Fpool::release_()
+{
+  link_unfrozen_();
+  pool_iterator p = F_.begin();
+
+  while (p != F_.end()) {
+    minipool * mp = *p;
+
+    // memory we don't own, from load_image, is left alone.
+    if (! mp->del_ || mp->usz_ == 0) {
+      ++p;
+      continue;
+    }
+    // free blocks are merged so at most one is at the end.
+    tail * t = reinterpret_cast<tail *>(mp->p_ + mp->usz_) - 1;
+    head * h = t->cur_head();
+    if ((h->flags & head::FREE) != 0) {
+      unlink_free(h);
+      mp->usz_ -= h->sz;
+      advise_(reinterpret_cast<char *>(h), mp->p_ + mp->usz_ + h->sz);
+    }
+    if (mp->usz_ == 0 && p != F_.begin()) {
+      p = F_.erase(p);
+      delete mp;
+      ++pools_released_;
+      continue;
+    }
+    ++p;
+  }
+
+  // the Fremoved object and the tail of a free block stay.
+  head * h = free_;
+  while (h) {
+    Fremoved * fr = h->obj_Frm_safer();
+    if ((h->flags & head::RELEASED) == 0 && h->mp->del_) {
+      advise_(reinterpret_cast<char *>(fr + 1),
+	      reinterpret_cast<char *>(h->cur_tail()));
+      h->flags |= head::RELEASED;
+    }
+    h = fr->next_;
+  }
+}
+
+void alf::gc::Fpool::advise_(char * p, char * q)
+{
+  static const std::uintptr_t pg = ::sysconf(_SC_PAGESIZE);
+  std::uintptr_t a = (reinterpret_cast<std::uintptr_t>(p) + pg - 1) & -pg;
+  std::uintptr_t b = reinterpret_cast<std::uintptr_t>(q) & -pg;
+
+  // not worth a system call for less than 16 pages.
+  if (b < a + 16*pg) return;
+  if (::madvise(reinterpret_cast<void *>(a), b - a, MADV_DONTNEED) == 0)
+    released_ += b - a;
+}
+
+void alf::gc::Fpool::info_(frozen_pool_info & fi)
+{
+  fi.pools = F_.size();
+  fi.size = fi.unused = fi.free = fi.free_blocks = fi.largest_free = 0;
+  fi.released = released_;
+  fi.pools_released = pools_released_;
+
+  for (minipool * mp : F_) {
+    fi.size += mp->sz_;
+    fi.unused += mp->sz_ - mp->usz_;
+  }
+  head * h = free_;
+  while (h) {
+    fi.free += h->sz;
+    ++fi.free_blocks;
+    if (h->sz > fi.largest_free) fi.largest_free = h->sz;
+    h = h->obj_Frm_safer()->next_;
+  }
+}
+
 // called to delete frozen obj.
 bool alf::gc::Fpool::dealloc_(head * h, void * p)
 {
@@ -80,28 +180,23 @@ bool alf::gc::Fpool::dealloc_(head * h, void * p)
   return ret;
 }
 
-// called by GCpool::freeze.
-// h is existing GCpool hdr.
-// p is pointer to GCpool obj.
-// p2 receives the ptr to Fpool obj.
-// return Fpool hdr for p2.
+// find a block of sz bytes for an object of usz bytes, from the free
+// list or else from the end of a minipool, enlarge if needed.
+// Return the head, newobj receives the object.
 alf::gc::head *
-alf::gc::Fpool::freeze_(PtrPool & pp, WPtrPool & wp, FPtrPool & fpp,
-			head * h, gcobj * p, gcobj * & p2)
+alf::gc::Fpool::block_(std::size_t usz, std::size_t sz, gcobj * & newobj)
 {
   static gc_allocation_error M("Fatal error, "
 			       "cannot allocate object to freeze");
 
-  // Find a pool with enough space, i.e. get a block with room for obj.
-  std::size_t usz = h->usz;
-  std::size_t sz = h->sz;
   // start by traversing free list.
   head * freep = free_;
   head * newh = 0;
   void * newp = 0;
-  gcobj * newobj = 0;
   minipool * mp = 0;
 
+  newobj = 0;
+
   while (freep) {
     if (freep->sz >= sz) {
       // block is large enough.
@@ -137,6 +232,9 @@ alf::gc::Fpool::freeze_(PtrPool & pp, WPtrPool & wp, FPtrPool & fpp,
       // still nothing, try to enlarge the pool.
       std::size_t isz = F_.front()->size();
       if (isz < usz) isz = (usz + usz + 64*1024*1024 - 1) & -64*1024*1024;
+      // no emergency gc, the object being frozen would move.
+      if (! lim_.room(isz))
+	lim_.fail(isz);
       enlarge(isz);
       mp = F_.back();
       newh = mp->alloc_(usz, newp);
@@ -147,17 +245,41 @@ alf::gc::Fpool::freeze_(PtrPool & pp, WPtrPool & wp, FPtrPool & fpp,
   }
 
   // Now we have got a chunk of memory large enough to hold the object.
+  // A block from the free list still has the Fremoved sizes, init it
+  // for the object.
+  if (newp == 0) {
+    newh->b_init(mp, head::FROZEN, newh->sz, usz);
+    newobj = newh->obj();
+  }
+  newh -> mp = mp;
+  return newh;
+}
+
+// called by GCpool::freeze.
+// h is existing GCpool hdr.
+// p is pointer to GCpool obj.
+// p2 receives the ptr to Fpool obj.
+// return Fpool hdr for p2.
+alf::gc::head *
+alf::gc::Fpool::freeze_(PtrPool & pp, WPtrPool & wp, FPtrPool & fpp,
+			head * h, gcobj * p, gcobj * & p2)
+{
+  gcobj * newobj = 0;
+  head * newh = block_(h->usz, h->sz, newobj);
+  std::size_t usz = h->usz;
+
   // Let's move it there.
-  std::memcpy(newobj, p2, usz);
+  std::memcpy(newobj, p, usz);
   // tell GCpool block that we have moved.
   new (p) moved(newh, newobj);
+  h->mp->obj_gone(h);
   h->p = newobj;
+  newh -> flags = head::FROZEN | (h->flags & head::NOFINAL);
+  newh -> fmap = h->fmap;
   h->flags = head::MOVED | head::GCFROZEN;
   h->fcnt = 0;
   newh -> p = newobj;
-  newh -> flags = head::FROZEN;
   newh -> fcnt = 1;
-  newh -> mp = mp;
   p2 = newobj;
   ssize_t delta = reinterpret_cast<char *>(newh) - reinterpret_cast<char *>(h);
   pp.update_pp(h, newh, delta);
@@ -167,6 +289,24 @@ alf::gc::Fpool::freeze_(PtrPool & pp, WPtrPool & wp, FPtrPool & fpp,
   return newh;
 }
 
+// new object of usz bytes, FROZEN from the start.
+alf::gc::head *
+alf::gc::Fpool::pinned_alloc_(std::size_t usz, unsigned int attr, void * & p)
+{
+  gcobj * obj = 0;
+  head * h = block_(usz, sizeof(head) + sizeof(tail) + head::asz(usz), obj);
+
+  // a block from the free list isn't cleared.
+  std::memset(static_cast<void *>(obj), 0, usz);
+  h->flags = head::FROZEN;
+  if (attr & ALLOC_NOFINAL)
+    h->flags |= head::NOFINAL;
+  h->p = obj;
+  h->fcnt = 1;
+  p = obj;
+  return h;
+}
+
 // h is Fpool block containing objet p.
 // p2 receives the moved object in GCpool.
 // do_gc is normally true. Exception is if you do multiple freeze() and
@@ -185,9 +325,12 @@ alf::gc::Fpool::unfreeze_(head * h, gcobj * p, head * h2, gcobj * p2)
   h2->usz = h->usz;
   h2->p = h->p = p2;
   new(p) Fremoved();
+  h2->flags = head::GCOBJ | (h->flags & head::NOFINAL);
+  h2->fmap = h->fmap;
   h -> flags = head::REMOVED | head::UNFROZEN;
-  link_free(h); // place block in free list.
-  h2->flags = head::GCOBJ;
+  // pointers reach p2 through h until they are updated, the block goes
+  // to the free list after that.
+  unfrozen_.push_back(h);
   h2->fcnt = 0;
 }
 
@@ -202,17 +345,6 @@ void alf::gc::Fpool::gc_walk()
   }
 }
 
-void alf::gc::Fpool::gcbit_off()
-{
-  // Walk through all objects in Fpool and turn off head::GCBIT.
-  pool_iterator p = F_.begin();
-  while (p != F_.end()) {
-    minipool * mp = *p;
-    ++p;
-    mp->gcbit_off();
-  }
-}
-
 // link object into free list.
 // will also attempt to merge it with prev and/or next.
 void alf::gc::Fpool::link_free(head * h)
@@ -292,7 +424,7 @@ void alf::gc::Fpool::unlink_free(head * h)
   }
   if (hprv) {
     prv = hprv->obj_Frm_safer();
-    nxt->next_ = hnxt;
+    prv->next_ = hnxt;
   } else {
     free_ = hnxt;
   }
@@ -412,6 +544,8 @@ void alf::gc::Fpool::merge__(head * h, head * nxt)
   // unlink next obj if it is in free list.
   if (nxt->flags & head::FREE) unlink_free(nxt);
   tail * t = nxt->cur_tail();
+  // the pages of nxt may still be in use.
+  h->flags &= ~head::RELEASED;
   h->sz += nxt->sz;
   t->D_.sz = h->sz;
   nxt->flags = head::REMOVED | head::FMERGED;
@@ -5,6 +5,7 @@
 
 #include <list>
 #include <string>
+#include <vector>
 
 #include "../gc.hxx"
 #include "moved.hxx"
@@ -27,6 +28,7 @@ namespace gc {
 class PtrPool;
 class WPtrPool;
 class FPtrPool;
+class Limiter;
 
 // Fpool is the frozen pool, objects are moved to there when frozen
 // and moved back to gcpool when unfrozen.
@@ -34,13 +36,30 @@ class FPtrPool;
 class Fpool : public pool {
 public:
 
-  Fpool(statistics & S, std::size_t sz);
+  Fpool(statistics & S, Limiter & L, std::size_t sz);
   ~Fpool();
 
   // resizing Fpool means add another minipool to our list.
-  // we never deallocate any minipool except when program exit.
+  // release_() deletes it again once it is empty.
   Fpool & enlarge(std::size_t inc);
 
+  // add a minipool full of frozen objects, from load_image. Its memory
+  // is an mmap, the Fpool unmaps it when the minipool is deleted.
+  Fpool & adopt_(minipool * mp);
+
+  // called at the end of gc when no pointer refers to a removed
+  // block any more. A free block at the end of a minipool goes back to
+  // its unused part, minipools left empty are deleted except the first
+  // and the pages inside large free blocks are given back with madvise.
+  void release_();
+
+  // blocks left by unfreeze_ go to the free list, called once the
+  // pointers to them have been updated.
+  void link_unfrozen_();
+
+  // fill in the fields of fi.
+  void info_(frozen_pool_info & fi);
+
   bool dealloc_(head * h, void * p);
 
   // called by GCpool::freeze.
@@ -51,6 +70,10 @@ public:
   freeze_(PtrPool & pp, WPtrPool & wp, FPtrPool & fpp,
 	  head * h, gcobj * p, gcobj * & p2);
 
+  // allocate a new frozen object with fcnt 1, no copy and no pointers
+  // to update. p receives the object.
+  head * pinned_alloc_(std::size_t usz, unsigned int attr, void * & p);
+
   // already allocated space for obj in h2, move it to there.
   // h is block in Fpool. h2 is block in GCpool.
   // p is pointer to obj in Fpool. p2 is pointer to obj in GCpool.
@@ -58,7 +81,6 @@ public:
   unfreeze_(head * h, gcobj * p, head * h2, gcobj * p2);
 
   void gc_walk();
-  void gcbit_off(); // clear GCBIT on objs.
 
   // functions to manage free list.
   void link_free(head * h); // link object into free list.
@@ -112,11 +134,18 @@ private:
   typedef std::list<minipool * > pool_list_type;
   typedef pool_list_type::iterator pool_iterator;
 
+  // block for freeze_ and pinned_alloc_.
+  head * block_(std::size_t usz, std::size_t sz, gcobj * & newobj);
+
+  // give back the whole pages between p and q.
+  void advise_(char * p, char * q);
+
   // h and nxt are two consecutive blocks to be merged.
   void merge_(head * h, head * nxt); // with some checks.
   void merge__(head * h, head * nxt); // without checks.
 
   statistics & S_;
+  Limiter & lim_;
 
   // our list of minipools.
   std::list<minipool *> F_;
@@ -125,6 +154,16 @@ private:
   // sorted on addresses and consecutive blocks are merged.
   head * free_; // free list for Fpool
 
+  // unfrozen blocks, pointers may still go through their head to the
+  // object in GCpool so they are neither merged nor reused yet.
+  std::vector<head *> unfrozen_;
+
+  // adopted minipools, their memory is unmapped after they are deleted.
+  std::vector<minipool *> mapped_;
+
+  std::size_t released_; // bytes given back by release_().
+  std::size_t pools_released_; // minipools deleted by release_().
+
 }; // end of class Fpool.
 
 }; // end of namespace gc
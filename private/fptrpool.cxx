@@ -16,7 +16,13 @@ alf::gc::FPtrPool & alf::gc::FPtrPool::enlarge()
   // so that we do not call constructors for entries we haven't made.
   entry * p = reinterpret_cast<entry *>(new char[newm*sizeof(entry)]);
   std::memset(p + n_, 0, (newm - n_)*sizeof(entry));
-  std::memcpy(p, T_, n_*sizeof(entry));
+  // entry has a std::string which may point into itself, so move
+  // them over rather than memcpy.
+  std::size_t k = 0;
+  while (k < n_) {
+    new(p + k) entry(std::move(T_[k]));
+    T_[k++].~entry();
+  }
   delete [] reinterpret_cast<char *>(T_);
   T_ = p;
   m_ = newm;
@@ -62,6 +62,16 @@ public:
 
   void gc_walk();
 
+  // gc_walk the registrations for which skip(h) is false, h is the
+  // head of the block the object is in, 0 if none.
+  template <typename Skip>
+  void gc_walk_except(Skip skip)
+  {
+    for (std::size_t k = 0; k < n_; ++k)
+      if (! skip(T_[k].h))
+	T_[k].f(T_[k].txt, T_[k].obj);
+  }
+
   void update_pp(head * h1, head * h2, ssize_t delta);
 
 private:
@@ -76,7 +86,7 @@ private:
 
     entry(const std::string & t, head * h, void * o,
 	  void f_(const std::string &, void *))
-      : txt(t), obj(o), f(f_)
+      : txt(t), h(h), obj(o), f(f_)
     { }
 
     entry(const entry & e) : txt(e.txt), h(e.h), obj(e.obj), f(e.f) { }
@@ -22,11 +22,22 @@
 #include "pool.hxx"
 #include "gcpool.hxx"
 #include "fpool.hxx"
+#include "mpool.hxx"
 #include "lpool.hxx"
 #include "ptrpool.hxx"
 #include "fptrpool.hxx"
 #include "wptrpool.hxx"
 #include "gcstat.hxx"
+#include "sampler.hxx"
+#include "tracer.hxx"
+#include "snapshot.hxx"
+#include "pathfinder.hxx"
+#include "finalizer.hxx"
+#include "limiter.hxx"
+#include "scanner.hxx"
+#include "image.hxx"
+#include "phaselog.hxx"
+#include "heap.hxx"
 
 namespace alf {
 namespace gc {
@@ -45,11 +56,21 @@ bool deallocate_(void * ptr);
 #include "pool.cxx"
 #include "gcpool.cxx"
 #include "fpool.cxx"
+#include "mpool.cxx"
 #include "lpool.cxx"
 #include "ptrpool.cxx"
 #include "fptrpool.cxx"
 #include "wptrpool.cxx"
 #include "gcstat.cxx"
+#include "sampler.cxx"
+#include "tracer.cxx"
+#include "snapshot.cxx"
+#include "pathfinder.cxx"
+#include "finalizer.cxx"
+#include "limiter.cxx"
+#include "scanner.cxx"
+#include "image.cxx"
+#include "phaselog.cxx"
 #include "gcerror.cxx"
 #include "dangling_pointer.cxx"
 #include "gc_allocation_error.cxx"
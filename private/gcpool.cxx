@@ -1,4 +1,9 @@
 
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
 
 #include <new>
@@ -9,12 +14,20 @@
 #include "fpool.hxx"
 #include "lpool.hxx"
 #include "ptrpool.hxx"
-#include "gcstat.hxx"
+#include "sampler.hxx"
+#include "tracer.hxx"
+#include "finalizer.hxx"
+#include "limiter.hxx"
+#include "phaselog.hxx"
+#include "scanner.hxx"
 #include "gcstat.hxx"
 #include "../../format/format.hxx"
 
-alf::gc::GCpool::GCpool(statistics & S, std::size_t sz)
-  : pool(sz), S_(S), A_(S), B_(S)
+alf::gc::GCpool::GCpool(statistics & S, Limiter & L, PhaseLog & P,
+			 Scanner & sc, std::size_t sz)
+  : pool(sz), S_(S), lim_(L), ph_(P), sc_(sc), A_(S), B_(S),
+    rel_mode_(RELEASE_NONE), rel_warm_(0), rel_full_(0), arena_sz_(0),
+    promoted_sz_(0), chunks_sz_(0)
 {
   active_ = 0;
   p_ = 0;
@@ -25,17 +38,26 @@ alf::gc::GCpool::GCpool(statistics & S, std::size_t sz)
 alf::gc::GCpool::~GCpool()
 {
   active_->cleanup();
+  // minipool's destructor destroys what is left in a chunk.
+  for (arena * a : arenas_) {
+    for (minipool * mp : a->mps)
+      delete mp;
+    delete a;
+  }
+  for (minipool * mp : promoted_)
+    delete mp;
+  for (minipool * mp : chunks_)
+    delete mp;
   delete [] p_;
 }
 
-// resizing the pool. Will trigger a gc.
-alf::gc::GCpool & alf::gc::GCpool::resize(std::size_t newsz)
+std::size_t alf::gc::GCpool::new_size_(std::size_t newsz) const
 {
   // newsz must be at least as large so that each minipool can
   // hold twice as much data as currently in use in active pool.
 
   std::size_t pool_usz = active_ ? active_->usz_ : 0;
-  std::size_t pool_usz2 = pool_usz + pool_usz;
+  std::size_t pool_usz2 = pool_usz + pool_usz + arena_sz_;
 
   if (newsz < pool_usz2)
     newsz = pool_usz2;
@@ -45,12 +67,24 @@ alf::gc::GCpool & alf::gc::GCpool::resize(std::size_t newsz)
     newsz = 32*1024*1024;
 
   // round up to nearest 32Mb
-  newsz = (newsz + (32*1024*1024LL - 1)) & -32*1024*1024LL;
+  return (newsz + (32*1024*1024LL - 1)) & -32*1024*1024LL;
+}
+
+// resizing the pool. Will trigger a gc.
+alf::gc::GCpool & alf::gc::GCpool::resize(std::size_t newsz)
+{
+  PhaseLog::phase ph(ph_, "resize");
+
+  newsz = new_size_(newsz);
 
   char * oldp = p_;
   // size for two minipools + space before and after.
   std::size_t newbigsz = newsz + newsz + 3*1024;
 
+  // the old pool is still there until gc has moved everything.
+  if (active_ && ! lim_.room(newbigsz))
+    lim_.fail(newbigsz);
+
   std::size_t aoff = 1024;
   std::size_t aend = aoff + newsz;
   std::size_t boff = aend + 1024;
@@ -58,6 +92,7 @@ alf::gc::GCpool & alf::gc::GCpool::resize(std::size_t newsz)
   std::size_t tsz = bend + 1024;
 
   char * buff = new char[tsz]; // 1k space between pools.
+  S_.grow(tsz);
   std::memset(buff, 0, tsz);
   head::fill(buff, 0xdeadbeef, 1024);
   head::fill(buff + aend, 0xdeadbeef, 1024);
@@ -88,24 +123,41 @@ alf::gc::GCpool & alf::gc::GCpool::resize(std::size_t newsz)
     usz_freeze_ = usz_unfreeze_ = sz_freeze_ = sz_unfreeze_ = 0;
     n_freeze_ = n_unfreeze_ = 0;
   }
+  if (p_) S_.shrink(p_sz);
   delete [] p_;
   p_ = buff;
   sz_ = newsz;
   p_sz = tsz;
+  // the memset above touched all of both halves.
+  rel_full_ = 2;
   return *this;
 }
 
 alf::gc::head *
 alf::gc::GCpool::alloc_(std::size_t usz,
 			void * & p, // ptr to allocated space
-			bool & did_gc) // did we do gc::gc()?
+			bool & did_gc, // did we do gc::gc()?
+			unsigned int attr /* = 0 */ )
 {
-  head * h = alloc__(usz, p, did_gc);
+  head * h;
+
+  if (arenas_.empty())
+    h = alloc__(usz, p, did_gc);
+  else {
+    did_gc = false;
+    h = arena_alloc_(usz, p);
+  }
   if (h == 0)
     throw fatal_error("alloc__ returned 0 pointer");
 
   h->flags = head::GCOBJ;
   h->fcnt = 0;
+  if (attr & ALLOC_NOFINAL)
+    h->flags |= head::NOFINAL;
+  else if (arenas_.empty())
+    final_.push_back(h);
+  else
+    arenas_.back()->final.push_back(h);
   // got an object. Update variables.
   usz_ = active_->usz_;
   usz_alloc_ += h->usz;
@@ -139,20 +191,34 @@ alf::gc::GCpool::alloc__(std::size_t usz, void * & p, bool & did_gc)
   static gc_allocation_error M("memory allocation failure");
 
   did_gc = false;
-  head * h = active_->alloc_(usz, p);
-  if (h) return h;
+  head * h;
+  if (room_(usz) && (h = active_->alloc_(usz, p)) != 0)
+    return h;
+  make_room_(usz, did_gc);
+  if ((h = active_->alloc_(usz, p)) == 0)
+    throw M;
+  return h;
+}
+
+void alf::gc::GCpool::make_room_(std::size_t usz, bool & did_gc)
+{
   // alloc failed, do a gc and try again.
   gc::gc();
   did_gc = true;
-  if ((h = active_->alloc_(usz, p)) != 0)
-    return h;
+  if (room_(usz))
+    return;
   // alloc failed again, we need to resize.
   std::size_t inc = sz_ + sz_;
-  if (inc < usz) inc = usz;
+  if (inc < usz + arena_sz_) inc = usz + arena_sz_;
+  std::size_t grow = 2*new_size_(inc) + 3*1024;
+  if (! lim_.room(grow)) {
+    // the callbacks may have dropped something, one more gc before
+    // we give up.
+    if (lim_.emergency() && room_(usz))
+      return;
+    lim_.fail(grow);
+  }
   resize(inc);
-  if ((h = active_->alloc_(usz, p)) == 0)
-    throw M;
-  return h;
 }
 
 bool alf::gc::GCpool::dealloc__(head * h, void * p)
@@ -160,6 +226,7 @@ bool alf::gc::GCpool::dealloc__(head * h, void * p)
   // object in block h pointed to by p is to be removed.
   if (p) {
     new(p) removed;
+    h->mp->obj_gone(h);
     h->flags = head::REMOVED | head::GCRM;
     h->p = 0;
     return true;
@@ -173,52 +240,226 @@ bool alf::gc::GCpool::dealloc__(head * h, void * p)
 // empty and other pool contain old pool objs.
 //
 // We are supposed to do the following:
-// step 1, clear GCBIT on all objects in other pool. This bit is assumed
-// to be 0 so we skip this step.
+// step 1, clear the marks of all objects. Lpool::start_walk_() starts a
+// new mark epoch and marks of earlier epochs don't count, so nothing
+// is cleared one by one, see minipool::marks_.
 //
 // step 2. Walk through all live objects using the root pointers in
 // ptr_pool. I.e. call ptr_pool.gc_walk(). This will move all live objects
 // in GCpool (h->flags & POOLMASK) == GCOBJ to other_ pool. This step
-// will set the GCBIT for all live objects. We also call Fpool.gc_walk()
+// will mark all live objects. We also call Fpool.gc_walk()
 // as those objects are always 'live' and is therefore regarded similar to
 // root pointers.
 //
-// step 3. Walk through other_ pool and clean up any objects not moved.
-// These are no longer reachable through pointers. I.e. this is the
-// garbage collection step of the garbage collector. This step will also
-// clear the GCBIT for all live objects, so that we can ignore step 1
-// on next gc() as well.
+// step 3. Destroy the objects in final_ that were not moved, these
+// are no longer reachable through pointers. I.e. this is the
+// garbage collection step of the garbage collector. The rest of other_
+// is dropped without looking at it.
 //
-// Note that GCBIT are never set for objects on active_ pool, only on
+// Note that marks are never set for objects on active_ pool, only on
 // other_ pool and Fpool and Lpool. I.e. When we set the bit we also
 // move the object to active_ pool and next runs will reach the moved
 // object and never go into the actual object which is only processed
 // first time when it is moved. For frozen objects or large objects we
-// reach the same object each time and so as we do cleanup of this pool
-// we also need to walk through Fpool to clean up GCBIT
-// for those objects as well and also walk through Lpool and clean up
-// any unreachable objects and turn off the GCBIT for that pool as well.
+// reach the same object each time, their marks are simply left behind
+// for the next epoch to ignore. We walk through Lpool and clean up any
+// unreachable objects. The marks are kept in bitmaps beside the
+// objects, see minipool.hxx, so none of this writes to objects that
+// don't move.
 // Note that we do not garbage collect on Fpool - that's the point of
 // Fpool.
 
 // do gc on this pool, move live objs to dest.
 void alf::gc::GCpool::do_gc_(PtrPool & pp, FPtrPool & fpp,
-			     Lpool & lp, Fpool & fp, WPtrPool & wp)
+			     Lpool & lp, Fpool & fp, WPtrPool & wp,
+			     Sampler & sp, Finalizer & fz)
 {
   // other_ is assumed to be empty.
   // swap active_ and other_
   minipool * mp = active_;
   active_ = other_;
   other_ = mp;
-  pp.gc_walk();
-  fpp.gc_walk();
-  fp.gc_walk();
-  lp.gc_walk();
-  mp->gc_cleanup();
-  fp.gcbit_off();
-  lp.gc_cleanup();
-  wp.gc_update_wptrs();
-  lp.gc_cleanup2();
+
+  // each step is a phase for set_phase_trace(), objects copied
+  // count for the walks.
+  PhaseLog::phase all(ph_, "gc", active_);
+  {
+    // unswept medium pages are swept, then nothing is marked.
+    PhaseLog::phase p(ph_, "sweep medium");
+    lp.start_walk_();
+  }
+  walk_roots_(pp, fpp, lp, fp);
+  {
+    PhaseLog::phase p(ph_, "ephemerons", active_);
+    wp.gc_walk_ephemerons(false);
+  }
+  {
+    // all live objects are marked, let sampler see who survived
+    // before we destroy the rest.
+    PhaseLog::phase p(ph_, "sampler");
+    sp.gc_sweep(*this);
+  }
+  {
+    // only objects that need it are looked at, the rest of the old
+    // pool is dropped as a whole.
+    PhaseLog::phase p(ph_, "finalize");
+    finalize_(fz);
+  }
+  {
+    PhaseLog::phase p(ph_, "large cleanup");
+    lp.gc_cleanup(fz);
+  }
+  {
+    // GCOBJ blocks left in mp are garbage.
+    PhaseLog::phase p(ph_, "weak pointers");
+    wp.gc_update_wptrs(mp);
+  }
+  std::size_t used = mp->usz_;
+  {
+    PhaseLog::phase p(ph_, "discard");
+    mp->discard();
+    drop_promoted_(wp);
+  }
+  {
+    PhaseLog::phase p(ph_, "large cleanup2");
+    lp.gc_cleanup2();
+  }
+  // pointers to removed frozen objects are gone now.
+  fp.release_();
+  if (rel_mode_ != RELEASE_NONE) {
+    PhaseLog::phase p(ph_, "release");
+    release_(mp, used);
+  }
+}
+
+// walk the roots for do_gc_ and do_gc_update_pointers, one phase for
+// each kind. A breadth first copy walks what they reach at the end.
+void alf::gc::GCpool::walk_roots_(PtrPool & pp, FPtrPool & fpp,
+				  Lpool & lp, Fpool & fp)
+{
+  struct guard {
+    Scanner & sc;
+    bool done;
+    ~guard() { if (! done) sc.abort_roots(); }
+  } g = { sc_, false };
+
+  sc_.begin_roots();
+  {
+    PhaseLog::phase p(ph_, "roots", active_);
+    pp.gc_walk();
+  }
+  {
+    PhaseLog::phase p(ph_, "function roots", active_);
+    fpp.gc_walk();
+  }
+  {
+    PhaseLog::phase p(ph_, "frozen", active_);
+    fp.gc_walk();
+  }
+  {
+    PhaseLog::phase p(ph_, "large", active_);
+    lp.gc_walk();
+  }
+  {
+    PhaseLog::phase p(ph_, "arenas", active_);
+    arena_gc_walk_();
+  }
+  g.done = true;
+  {
+    PhaseLog::phase p(ph_, "queue", active_);
+    sc_.end_roots();
+  }
+}
+
+int alf::gc::GCpool::set_release(int mode, std::size_t warm)
+{
+  int old = rel_mode_;
+
+  switch (mode) {
+  case RELEASE_NONE:
+  case RELEASE_DONTNEED:
+  case RELEASE_FREE:
+    break;
+
+  default:
+    throw gc_error("set_semispace_release: invalid mode");
+  }
+  if (old == RELEASE_NONE && mode != RELEASE_NONE)
+    // pages were kept so far, anything may be resident.
+    rel_full_ = 2;
+  rel_mode_ = mode;
+  rel_warm_ = warm;
+  return old;
+}
+
+// resident set size in bytes, 0 if we can't tell.
+static std::size_t rss_()
+{
+  static const std::size_t pg = ::sysconf(_SC_PAGESIZE);
+  std::FILE * f = std::fopen("/proc/self/statm", "r");
+  unsigned long vsz = 0, res = 0;
+
+  if (f == 0) return 0;
+  if (std::fscanf(f, "%lu %lu", & vsz, & res) != 2)
+    res = 0;
+  std::fclose(f);
+  return res*pg;
+}
+
+void alf::gc::GCpool::release_(minipool * mp, std::size_t used)
+{
+  static const std::uintptr_t pg = ::sysconf(_SC_PAGESIZE);
+
+  if (rel_full_) {
+    --rel_full_;
+    used = mp->sz_;
+  }
+  if (used <= rel_warm_) return;
+
+  // whole pages only, the warm zone is rounded up.
+  std::uintptr_t a = reinterpret_cast<std::uintptr_t>(mp->p_) + rel_warm_;
+  std::uintptr_t b = reinterpret_cast<std::uintptr_t>(mp->p_) + used;
+  a = (a + pg - 1) & -pg;
+  b = (b + pg - 1) & -pg;
+  std::uintptr_t e = reinterpret_cast<std::uintptr_t>(mp->p_) + mp->sz_;
+  if (b > e) b = e & -pg;
+  if (b <= a) return;
+
+  int advice = MADV_DONTNEED;
+#ifdef MADV_FREE
+  if (rel_mode_ == RELEASE_FREE)
+    advice = MADV_FREE;
+#endif
+  std::size_t before = rss_();
+  if (::madvise(reinterpret_cast<void *>(a), b - a, advice) == 0)
+    S_.release(b - a, before, rss_());
+}
+
+void alf::gc::GCpool::finalize_(Finalizer & fz)
+{
+  final2_.clear();
+  for (head * h : final_) {
+    switch (h->gctype()) {
+    case head::GCOBJ:
+      // not reached by gc, destroy it.
+      if (fz.deferred())
+	fz.defer(h, h->obj());
+      else
+	h->obj()->~gcobj();
+      break;
+
+    case head::GCMOVED:
+      // survived, follow it.
+      final2_.push_back(head::get_head(h->p));
+      break;
+
+    default:
+      // GCRM is already destroyed by user, GCFROZEN is now in Fpool
+      // and goes back on the list if unfrozen.
+      break;
+    }
+  }
+  final_.swap(final2_);
 }
 
 // do gc_walk and update pointers.
@@ -226,17 +467,52 @@ void alf::gc::GCpool::do_gc_update_pointers(PtrPool & pp, FPtrPool & fpp,
 					    Lpool & lp,
 					    Fpool & fp, WPtrPool & wp)
 {
-  minipool * mp = active_;
+  PhaseLog::phase all(ph_, "update pointers");
+  {
+    PhaseLog::phase p(ph_, "sweep medium");
+    lp.start_walk_();
+  }
+  walk_roots_(pp, fpp, lp, fp);
+  {
+    // nothing is reclaimed, just update the values.
+    PhaseLog::phase p(ph_, "ephemerons");
+    wp.gc_walk_ephemerons(true);
+  }
+  // the marks are left as they are, the next walk doesn't see them.
+  // update weak pointers too.
+  {
+    PhaseLog::phase p(ph_, "weak pointers");
+    wp.gc_update_wptrs();
+  }
+  // no pointer goes through an unfrozen block any more.
+  fp.link_unfrozen_();
+}
+
+// walk all roots with t as active tracer. Like do_gc_update_pointers
+// but gc_walk_ delegates to t so nothing is moved.
+void alf::gc::GCpool::do_trace(PtrPool & pp, FPtrPool & fpp, Lpool & lp,
+			       Fpool & fp, WPtrPool & wp, tracer & t)
+{
+  // make sure we leave the heap as we found it even if
+  // some gc_walker throws.
+  struct guard {
+    ~guard() { tracer::active = 0; }
+  } g;
+
+  lp.start_walk_();
+  tracer::active = & t;
   pp.gc_walk();
   fpp.gc_walk();
   fp.gc_walk();
   lp.gc_walk();
-  // turn off gcbit on all pools.
-  mp->gcbit_off();
-  fp.gcbit_off();
-  lp.gcbit_off();
-  // update weak pointers too.
-  wp.gc_update_wptrs();
+  arena_gc_walk_();
+  // a value walked may reach the key of another ephemeron only once
+  // t has walked what it queued.
+  t.drain();
+  do
+    wp.gc_walk_ephemerons(false);
+  while (t.drain());
+  t.finish();
 }
 
 // unfreeze an object - move it from fpool to gcpool.
@@ -270,7 +546,12 @@ alf::gc::GCpool::unfreeze_(Fpool & fp,
   // if (did_gc) do_gc = false;
 
   // unfreeze obj at h and move it to h2.
-  fp.unfreeze_(h, ptr, h2, reinterpret_cast<gcobj *>(p));
+  // the caller gets the new place, with do_ptrs false nothing else
+  // tells it.
+  p2 = fptr = reinterpret_cast<gcobj *>(p);
+  fp.unfreeze_(h, ptr, h2, p2);
+  if ((h2->flags & head::NOFINAL) == 0)
+    final_.push_back(h2);
   ssize_t delta = reinterpret_cast<char *>(h2) - reinterpret_cast<char *>(h);
   pp.update_pp(h, h2, delta);
   wp.update_pp(h, h2, delta);
@@ -300,7 +581,18 @@ alf::gc::GCpool::move(PtrPool & pp, WPtrPool & wp, FPtrPool & fpp,
     return reinterpret_cast<gcobj *>(p);
 
   if (h->mp != other_)
-    throw fatal_error("Object neither in active nor other pool.");
+    switch (arena_chunk_(h->mp)) {
+    case 1:
+      // in an open arena, it stays there until the arena is closed.
+      return reinterpret_cast<gcobj *>(p);
+
+    case 2:
+      // promoted arena, move it as if in other_.
+      break;
+
+    default:
+      throw fatal_error("Object neither in active nor other pool.");
+    }
 
   h2 = active_->alloc_(h->usz, p2);
   if (h2 == 0)
@@ -310,8 +602,14 @@ alf::gc::GCpool::move(PtrPool & pp, WPtrPool & wp, FPtrPool & fpp,
   // remove the object in p, do not call destructor, the object
   // is still alive in obj2.
   new(p) moved(h2, o2 = reinterpret_cast<gcobj *>(p2));
+  h2->flags |= h->flags & head::NOFINAL;
+  h2->fmap = h->fmap;
+  h->mp->obj_gone(h);
   // since the object is not in Fpool we know it's not frozen.
+  // the mark stays in the bitmap of h->mp, later visits find the
+  // new place through h->p.
   h->flags = head::MOVED | head::GCMOVED;
+  h->p = o2;
   ssize_t delta = reinterpret_cast<char *>(h2) - reinterpret_cast<char *>(h);
   pp.update_pp(h, h2, delta);
   wp.update_pp(h, h2, delta);
@@ -324,7 +622,7 @@ alf::gc::GCpool::move(PtrPool & pp, WPtrPool & wp, FPtrPool & fpp,
 alf::gc::minipool * alf::gc::GCpool::block_in_pool(const void * p)
 {
   if (p < p_ || p > p_ + p_sz)
-    return 0;
+    return arena_block_(p, reinterpret_cast<const char *>(p) + 1);
 
   if (active_ && active_->block_in_pool(p))
     return active_;
@@ -341,7 +639,7 @@ alf::gc::minipool *
 alf::gc::GCpool::block_in_pool(const void * p, const void * q)
 {
   if (q < p_ || p_ + p_sz < p)
-    return 0;
+    return arena_block_(p, q);
 
   if (active_ && active_->block_in_pool(p, q))
     return active_;
@@ -351,3 +649,293 @@ alf::gc::GCpool::block_in_pool(const void * p, const void * q)
 
   return minipool::BAD_MINIPOOL;
 }
+
+//////////////////////////////////
+// arenas
+
+alf::gc::arena * alf::gc::GCpool::open_arena(std::size_t chunk)
+{
+  arena * a = new arena;
+
+  a->chunk = chunk;
+  arenas_.push_back(a);
+  ++S_.n_arena;
+  return a;
+}
+
+alf::gc::head * alf::gc::GCpool::arena_alloc_(std::size_t usz, void * & p)
+{
+  arena * a = arenas_.back();
+  std::size_t bsz = block_size_(usz);
+  head * h = 0;
+  bool did_gc;
+
+  // keep room in active_ should the arena be promoted.
+  if (! room_(usz))
+    make_room_(usz, did_gc);
+  if (! a->mps.empty())
+    h = a->mps.back()->alloc_(usz, p);
+  if (h == 0) {
+    // small arenas don't hold a whole chunk each.
+    std::size_t sz = ARENA_FIRST;
+    if (! a->mps.empty())
+      sz = 2*a->mps.back()->sz_;
+    if (sz > a->chunk) sz = a->chunk;
+    if (sz < bsz) sz = bsz;
+    // the chunks of promoted arenas are only freed by gc.
+    if (promoted_sz_ > active_->sz_)
+      gc::gc();
+    a->mps.push_back(new_chunk_(sz));
+    map_chunk_(a->mps.back(), a);
+    h = a->mps.back()->alloc_(usz, p);
+  }
+  arena_sz_ += h->sz;
+  return h;
+}
+
+alf::gc::minipool * alf::gc::GCpool::new_chunk_(std::size_t sz)
+{
+  std::size_t k = chunks_.size();
+
+  while (k-- > 0)
+    if (chunks_[k]->sz_ >= sz) {
+      minipool * mp = chunks_[k];
+      chunks_[k] = chunks_.back();
+      chunks_.pop_back();
+      chunks_sz_ -= mp->sz_;
+      return mp;
+    }
+  lim_.reserve(sz);
+  return new minipool(S_, sz);
+}
+
+std::vector<alf::gc::GCpool::chunk_ref>::const_iterator
+alf::gc::GCpool::chunk_after_(const void * p) const
+{
+  return std::upper_bound(chunk_map_.begin(), chunk_map_.end(), p,
+			  [](const void * q, const chunk_ref & c)
+			  { return q < static_cast<const void *>(c.mp->p_); });
+}
+
+void alf::gc::GCpool::map_chunk_(minipool * mp, arena * a)
+{
+  chunk_ref c = { mp, a };
+
+  chunk_map_.insert(chunk_after_(mp->p_), c);
+}
+
+void alf::gc::GCpool::unmap_chunk_(minipool * mp)
+{
+  auto x = chunk_after_(mp->p_);
+
+  if (x != chunk_map_.begin() && (--x)->mp == mp)
+    chunk_map_.erase(x);
+}
+
+void alf::gc::GCpool::promote_chunk_(minipool * mp)
+{
+  auto x = chunk_after_(mp->p_);
+
+  if (x != chunk_map_.begin() && (--x)->mp == mp)
+    chunk_map_[x - chunk_map_.begin()].owner = 0;
+}
+
+void alf::gc::GCpool::free_chunk_(minipool * mp)
+{
+  unmap_chunk_(mp);
+  if (chunks_sz_ + mp->sz_ > ARENA_KEEP) {
+    delete mp;
+    return;
+  }
+  chunks_.push_back(mp);
+  chunks_sz_ += mp->sz_;
+}
+
+// marks what is reachable from the roots without going into the
+// arena, found is set once a pointer into the arena turns up.
+struct alf::gc::GCpool::arena_check : public alf::gc::tracer {
+
+  const GCpool & gp;
+  const arena * a;
+  std::vector<alf::gc::gcobj *> todo;
+  bool found;
+
+  arena_check(const GCpool & g, const arena * x)
+    : gp(g), a(x), found(false)
+  { }
+
+  // the chunk p is in is found in chunk_map_ as for arena_block_().
+  bool in(const void * p) const
+  {
+    auto x = gp.chunk_after_(p);
+
+    if (x == gp.chunk_map_.begin())
+      return false;
+    --x;
+    return x->owner == a && x->mp->block_in_pool(p);
+  }
+
+  alf::gc::gcobj * walk(const std::string &, alf::gc::gcobj * ptr)
+  {
+    alf::gc::gcobj * p = ptr;
+
+    if (found || p == 0)
+      return ptr;
+    if (in(p)) {
+      found = true;
+      return ptr;
+    }
+    alf::gc::head * h = live_head(p);
+    if (h && in(h))
+      found = true;
+    else if (h && ! h->set_visited())
+      todo.push_back(p);
+    return ptr;
+  }
+
+  bool drain()
+  {
+    static const std::string txt("arena check");
+    bool ret = false;
+
+    while (! found && ! todo.empty()) {
+      alf::gc::gcobj * p = todo.back();
+      todo.pop_back();
+      p->gc_walker(txt);
+      ret = true;
+    }
+    return ret;
+  }
+
+}; // end of struct arena_check
+
+bool alf::gc::GCpool::arena_escaped_(arena * a, PtrPool & pp,
+				     FPtrPool & fpp, Lpool & lp, Fpool & fp,
+				     WPtrPool & wp)
+{
+  std::size_t chunks = 0;
+  for (minipool * mp : a->mps)
+    chunks += mp->sz_;
+
+  // everything allocated and not yet collected outside the arena, the
+  // garbage among it too, more than the trace walks.
+  std::size_t all = S_.sz_cur_a();
+  std::size_t outside = all > arena_sz_ ? all - arena_sz_ : 0;
+  if (outside > ARENA_SMALL && ARENA_CHECK*chunks < active_->sz_)
+    return true;
+
+  struct guard {
+    ~guard() { tracer::active = 0; }
+  } g;
+  arena_check t(*this, a);
+  auto skip = [& t](head * h) { return h && t.in(h); };
+
+  // the roots as for gc but pointers and registered objects inside the
+  // arena go with it. Objects of enclosing arenas are roots.
+  lp.start_walk_();
+  tracer::active = & t;
+  pp.gc_walk_except(skip);
+  fpp.gc_walk_except(skip);
+  fp.gc_walk();
+  lp.gc_walk();
+  arena_gc_walk_();
+  t.drain();
+  // values of ephemerons are walked whether their key is reached or
+  // not, an arena held only that way is promoted anyway.
+  wp.gc_walk_ephemerons(true);
+  t.drain();
+  return t.found;
+}
+
+bool alf::gc::GCpool::close_arena(arena * a, PtrPool & pp, FPtrPool & fpp,
+				  Lpool & lp, Fpool & fp, WPtrPool & wp,
+				  Sampler & sp, Finalizer & fz)
+{
+  if (arenas_.empty() || arenas_.back() != a)
+    throw fatal_error("close_arena: not the innermost arena");
+  arenas_.pop_back();
+  if (arena_escaped_(a, pp, fpp, lp, fp, wp)) {
+    // leave the objects where they are, the next gc moves those
+    // that are reachable to active_.
+    ++S_.n_arena_p;
+    final_.insert(final_.end(), a->final.begin(), a->final.end());
+    for (minipool * mp : a->mps) {
+      promoted_sz_ += mp->sz_;
+      promote_chunk_(mp);
+    }
+    promoted_.insert(promoted_.end(), a->mps.begin(), a->mps.end());
+    delete a;
+    return false;
+  }
+
+  ++S_.n_arena_d;
+  for (minipool * mp : a->mps)
+    sp.dropped(mp);
+  for (head * h : a->final)
+    if (h->gctype() == head::GCOBJ) {
+      // the rest are deleted by user or frozen.
+      if (fz.deferred())
+	fz.defer(h, h->obj());
+      else
+	h->obj()->~gcobj();
+    }
+  for (minipool * mp : a->mps) {
+    wp.gc_update_wptrs(mp);
+    arena_sz_ -= mp->usz_;
+    S_.sz_arena_d += mp->usz_;
+    mp->discard();
+    free_chunk_(mp);
+  }
+  delete a;
+  return true;
+}
+
+int alf::gc::GCpool::arena_chunk_(const minipool * mp) const
+{
+  auto x = chunk_after_(mp->p_);
+
+  if (x == chunk_map_.begin() || (--x)->mp != mp)
+    return 0;
+  return x->owner ? 1 : 2;
+}
+
+alf::gc::minipool *
+alf::gc::GCpool::arena_block_(const void * p, const void * q) const
+{
+  if (chunk_map_.empty())
+    return 0;
+
+  auto x = chunk_after_(p);
+  // p..q may begin before a chunk and reach into it.
+  if (x != chunk_map_.end() && q > static_cast<const void *>(x->mp->p_))
+    return minipool::BAD_MINIPOOL;
+  if (x == chunk_map_.begin())
+    return 0;
+  switch ((--x)->mp->block_in_pool_(p, q)) {
+  case head::PARTIAL:
+    return minipool::BAD_MINIPOOL;
+  case head::FULL:
+    return x->mp;
+  }
+  return 0;
+}
+
+void alf::gc::GCpool::arena_gc_walk_()
+{
+  for (arena * a : arenas_)
+    for (minipool * mp : a->mps)
+      mp->arena_gc_walk();
+}
+
+void alf::gc::GCpool::drop_promoted_(WPtrPool & wp)
+{
+  // what is left in them is garbage and finalized with final_.
+  for (minipool * mp : promoted_) {
+    wp.gc_update_wptrs(mp);
+    arena_sz_ -= mp->usz_;
+    mp->discard();
+    free_chunk_(mp);
+  }
+  promoted_.clear();
+  promoted_sz_ = 0;
+}
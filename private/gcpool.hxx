@@ -4,6 +4,7 @@
 #include <cstdlib>
 
 #include <string>
+#include <vector>
 
 #include "../gc.hxx"
 #include "moved.hxx"
@@ -27,12 +28,26 @@ namespace gc {
 class PtrPool;
 class WPtrPool;
 class FPtrPool;
+class Sampler;
+class Finalizer;
+class Limiter;
+class PhaseLog;
+class Scanner;
+class tracer;
+
+// an open arena, see arena_scope.
+struct arena {
+  std::size_t chunk; // largest size of new chunks.
+  std::vector<minipool *> mps; // chunks, we allocate from the last.
+  std::vector<head *> final; // as final_ for objects in mps.
+}; // end of struct arena
 
 // GCpool.
 class GCpool : public pool {
 public:
 
-  GCpool(statistics & S, size_t sz);
+  GCpool(statistics & S, Limiter & L, PhaseLog & P, Scanner & sc,
+	 size_t sz);
   ~GCpool();
 
   // resizing the pool. Will trigger a gc.
@@ -40,7 +55,9 @@ public:
 
   // allocates/deallocates and then updates variables.
   // also returns if we did or did not do gc during alloc_.
-  head * alloc_(std::size_t usz, void * & p, bool & did_gc);
+  // attr is ALLOC_NOFINAL or 0.
+  head * alloc_(std::size_t usz, void * & p, bool & did_gc,
+		unsigned int attr = 0);
   // return true if we actually removed an obj.
   bool dealloc_(head * h, void * p);
 
@@ -52,7 +69,11 @@ public:
   // do gc on this pool.
   // swap active_ and other_ and move live objs in other_ to active_.
   void do_gc_(PtrPool & pp, FPtrPool & fpp, Lpool & lp,
-	      Fpool & fp, WPtrPool & wp);
+	      Fpool & fp, WPtrPool & wp, Sampler & sp, Finalizer & fz);
+
+  // walk all live objects with tracer t, nothing is moved.
+  void do_trace(PtrPool & pp, FPtrPool & fpp, Lpool & lp,
+		Fpool & fp, WPtrPool & wp, tracer & t);
 
   // update pointers
   void do_gc_update_pointers(PtrPool & pp, FPtrPool & fpp, Lpool & lp,
@@ -99,9 +120,43 @@ public:
   minipool * block_in_pool(const void * p, std::size_t sz)
   { return block_in_pool(p, reinterpret_cast<const char *>(p) + sz); }
 
+  // the pool we allocate from (and move to during gc).
+  minipool * active() const { return active_; }
+
+  // how other_ is given back after gc, see set_semispace_release().
+  int set_release(int mode, std::size_t warm);
+  int release_mode() const { return rel_mode_; }
+  std::size_t release_warm() const { return rel_warm_; }
+
+  // arenas, see arena_scope. Objects are allocated from chunks of
+  // at least chunk bytes of the innermost open arena.
+  arena * open_arena(std::size_t chunk);
+
+  // close a, which must be the innermost arena. Return true if it was
+  // discarded, false if something outside pointed into it and it was
+  // promoted.
+  bool close_arena(arena * a, PtrPool & pp, FPtrPool & fpp, Lpool & lp,
+		   Fpool & fp, WPtrPool & wp, Sampler & sp, Finalizer & fz);
+
 private:
 
+  enum {
+    // the first chunk of an arena, later ones double up to chunk.
+    ARENA_FIRST = 16*1024,
+    // bytes of unused chunks kept for later arenas.
+    ARENA_KEEP = 8*1024*1024,
+    // the trace of close_arena() costs about what a gc costs, promoting
+    // costs the share of the next gc that the chunks of the arena take
+    // of active_. The trace is done if it costs at most ARENA_CHECK
+    // times that, or if the heap outside is at most ARENA_SMALL bytes.
+    ARENA_CHECK = 4,
+    ARENA_SMALL = 256*1024
+  };
+
   statistics & S_;
+  Limiter & lim_;
+  PhaseLog & ph_;
+  Scanner & sc_;
 
   // size of area pointed to by p is twize that of A_.sz_ and B_.sz_.
   // A_ and B_ always have the same size except during a resize.
@@ -122,6 +177,104 @@ private:
   int n_freeze_;
   int n_unfreeze_;
 
+  // heads of objects in active_ that need their destructor called
+  // when unreachable. Entries may since have been moved to Fpool or
+  // removed by user, gc drops those.
+  std::vector<head *> final_;
+  std::vector<head *> final2_; // spare so gc doesn't allocate.
+
+  int rel_mode_; // RELEASE_NONE, RELEASE_DONTNEED or RELEASE_FREE.
+  std::size_t rel_warm_; // bytes at the start of other_ that are kept.
+  // releases left that cover all of other_ and not just what the
+  // last gc copied out of. Both halves may have been touched
+  // before release was turned on or when the pool was resized.
+  int rel_full_;
+
+  // give back the pages of mp after the first rel_warm_ bytes, used is
+  // how much of it was in use before gc.
+  void release_(minipool * mp, std::size_t used);
+
+  std::vector<arena *> arenas_; // open arenas, innermost last.
+  // chunks of promoted arenas, the next gc moves what is reachable
+  // to active_ and deletes them.
+  std::vector<minipool *> promoted_;
+  // bytes used in the chunks of open and promoted arenas. active_
+  // keeps room for them so gc can always move them there.
+  std::size_t arena_sz_;
+  // size of the chunks in promoted_, the next chunk after it
+  // exceeds the size of active_ is allocated after a gc.
+  std::size_t promoted_sz_;
+  std::vector<minipool *> chunks_; // empty chunks for later arenas.
+  std::size_t chunks_sz_; // their size.
+
+  struct chunk_ref {
+    minipool * mp;
+    arena * owner; // 0 once promoted.
+  }; // end of struct chunk_ref
+
+  // chunks of open and promoted arenas, sorted on address.
+  std::vector<chunk_ref> chunk_map_;
+
+  // size of each half when resized to at least newsz.
+  std::size_t new_size_(std::size_t newsz) const;
+
+  // size of the block for an object of usz bytes.
+  static std::size_t block_size_(std::size_t usz)
+  { return sizeof(head) + sizeof(tail) + head::asz(usz); }
+
+  // is there room in active_ for usz bytes and the arenas.
+  bool room_(std::size_t usz) const
+  { return active_->usz_ + arena_sz_ + block_size_(usz) <= active_->sz_; }
+
+  // gc and if needed resize so that room_(usz) is true.
+  void make_room_(std::size_t usz, bool & did_gc);
+
+  head * arena_alloc_(std::size_t usz, void * & p);
+
+  // an empty chunk of at least sz bytes, from chunks_ if there is one.
+  minipool * new_chunk_(std::size_t sz);
+
+  // keep the discarded chunk mp in chunks_ or delete it.
+  void free_chunk_(minipool * mp);
+
+  // first entry of chunk_map_ for a chunk starting after p.
+  std::vector<chunk_ref>::const_iterator chunk_after_(const void * p) const;
+
+  // add mp of arena a to or drop it from chunk_map_, or mark it
+  // promoted.
+  void map_chunk_(minipool * mp, arena * a);
+  void unmap_chunk_(minipool * mp);
+  void promote_chunk_(minipool * mp);
+
+  // the tracer of arena_escaped_().
+  struct arena_check;
+
+  // true if something outside the innermost arena a points into it,
+  // also if that is too costly to find out for an arena that small.
+  bool arena_escaped_(arena * a, PtrPool & pp, FPtrPool & fpp, Lpool & lp,
+		      Fpool & fp, WPtrPool & wp);
+
+  // 1 if mp is a chunk of an open arena, 2 if of a promoted arena,
+  // 0 if neither.
+  int arena_chunk_(const minipool * mp) const;
+
+  // the chunk p..q is in, BAD_MINIPOOL if only partly in one.
+  minipool * arena_block_(const void * p, const void * q) const;
+
+  // objects in open arenas are live until the arena is closed,
+  // gc walks them as roots and leaves them where they are.
+  void arena_gc_walk_();
+
+  // gc_walk all roots, frozen and large objects and open arenas.
+  void walk_roots_(PtrPool & pp, FPtrPool & fpp, Lpool & lp, Fpool & fp);
+
+  // free the chunks of promoted arenas after gc.
+  void drop_promoted_(WPtrPool & wp);
+
+  // call or defer destructors of dead objects in final_ and
+  // point final_ at the moved survivors.
+  void finalize_(Finalizer & fz);
+
 }; // end of class GCpool
 
 }; // end of namespace gc
@@ -1,6 +1,12 @@
 
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
+#include <cerrno>
+#include <cstring>
 #include <ctime>
 
 #include <string>
@@ -17,22 +23,114 @@
 
 #include "gcpool.hxx"
 #include "fpool.hxx"
+#include "mpool.hxx"
 #include "lpool.hxx"
 #include "ptrpool.hxx"
 #include "fptrpool.hxx"
 #include "wptrpool.hxx"
+#include "sampler.hxx"
+#include "tracer.hxx"
+#include "snapshot.hxx"
+#include "pathfinder.hxx"
+#include "finalizer.hxx"
+#include "limiter.hxx"
+#include "scanner.hxx"
+#include "image.hxx"
+#include "phaselog.hxx"
+#include "heap.hxx"
 
 #include "../../format/format.hxx"
 
-alf::gc::statistics S;
-alf::gc::GCpool gc_pool(S, 128*1024*1024);
-alf::gc::Fpool f_pool(S, 32*1024*1024);
-alf::gc::Lpool large_pool(S);
-alf::gc::PtrPool ptr_pool;
-alf::gc::FPtrPool fptr_pool;
-alf::gc::WPtrPool wptr_pool;
+// the default heap, current in every thread until a heap::scope
+// makes another heap current.
+alf::gc::heap_impl default_impl(128*1024*1024, 32*1024*1024);
+thread_local alf::gc::heap_impl * cur_heap = & default_impl;
 
-std::size_t large_sz = 128*1024; // 128K is large by default.
+//////////////////////////////////
+// heap
+
+alf::gc::heap::heap(std::size_t pool_size /* = 128*1024*1024 */,
+		    std::size_t frozen_size /* = 32*1024*1024 */ )
+  : impl_(new heap_impl(pool_size, frozen_size)), own_(true)
+{
+  impl_->owner = this;
+}
+
+alf::gc::heap::heap(heap_impl * impl)
+  : impl_(impl), own_(false)
+{
+  impl_->owner = this;
+}
+
+alf::gc::heap::~heap()
+{
+  if (! own_) return;
+
+  // objects left in the heap are destroyed with the heap current
+  // since their destructors may unregister pointers.
+  heap_impl * old = cur_heap == impl_ ? & default_impl : cur_heap;
+  cur_heap = impl_;
+  delete impl_;
+  cur_heap = old;
+}
+
+// static
+alf::gc::heap & alf::gc::heap::initial()
+{
+  static heap h(& default_impl);
+  return h;
+}
+
+// static
+alf::gc::heap & alf::gc::heap::current()
+{
+  return cur_heap->owner ? *cur_heap->owner : initial();
+}
+
+alf::gc::heap::scope::scope(heap & h)
+  : old_(cur_heap)
+{
+  cur_heap = h.impl_;
+}
+
+alf::gc::heap::scope::~scope()
+{
+  cur_heap = old_;
+}
+
+//////////////////////////////////
+// arena_scope
+
+alf::gc::arena_scope::arena_scope(std::size_t chunk_size /* = 1024*1024 */ )
+  : heap_(cur_heap)
+{
+  arena_ = heap_->gc_pool.open_arena(chunk_size);
+}
+
+alf::gc::arena_scope::~arena_scope()
+{
+  // destructors of the objects unregister pointers in their heap.
+  heap_impl & H = *heap_;
+  heap_impl * old = cur_heap;
+
+  cur_heap = heap_;
+  H.gc_pool.close_arena(arena_, H.ptr_pool, H.fptr_pool, H.large_pool,
+			H.f_pool, H.wptr_pool, H.sampler, H.finalizer);
+  // as after gc, deferred destructors run now.
+  H.finalizer.after_gc();
+  cur_heap = old;
+}
+
+alf::gc::arena_info alf::gc::arena_stats()
+{
+  heap_impl & H = *cur_heap;
+  arena_info ai;
+  ai.opened = H.S.n_arena;
+  ai.discarded = H.S.n_arena_d;
+  ai.promoted = H.S.n_arena_p;
+  ai.size_discarded = H.S.sz_arena_d;
+  return ai;
+}
 
 ///////////////////////////////////////////
 //
@@ -46,19 +144,20 @@ std::size_t large_sz = 128*1024; // 128K is large by default.
 //static
 alf::gc::head * alf::gc::head::data_ok(const void * p)
 {
+  heap_impl & H = *cur_heap;
   if (p == 0) // 0 pointers are always ok and result in a 0 ptr return.
     return 0;
 
-  minipool * mp = gc_pool.block_in_pool(p);
+  minipool * mp = H.gc_pool.block_in_pool(p);
   head * h = 0;
 
   if (mp == minipool::BAD_MINIPOOL)
     return head::BAD_BLOCK;
 
-  if (mp != 0 || (mp = f_pool.block_in_pool(p)) != 0)
+  if (mp != 0 || (mp = H.f_pool.block_in_pool(p)) != 0)
     h = mp->get_block_head(p);
   else
-    h = large_pool.get_block_head(p);
+    h = H.large_pool.get_block_head(p);
 
   // if there is a block but it is not allocated to an object
   // we get a special head value return here - check for that:
@@ -91,32 +190,34 @@ alf::gc::head::data_ok(const void * p, const void * q)
 bool
 alf::gc::head::nogc_data_ok(const void * p)
 {
+  heap_impl & H = *cur_heap;
   if (p == 0) // 0 pointers are always ok and result in a 0 ptr return.
     return true;
 
-  if (gc_pool.block_in_pool(p) != 0)
+  if (H.gc_pool.block_in_pool(p) != 0)
     return false;
 
-  if (f_pool.block_in_pool(p) != 0)
+  if (H.f_pool.block_in_pool(p) != 0)
     return false;
 
-  return large_pool.get_block_head(p) == 0;
+  return H.large_pool.get_block_head(p) == 0;
 }
 
 //static
 bool
 alf::gc::head::nogc_data_ok(const void * p, const void * q)
 {
+  heap_impl & H = *cur_heap;
   if (p == 0) // 0 pointers are always ok and result in a 0 ptr return.
     return true;
 
-  if (gc_pool.block_in_pool(p,q) != 0)
+  if (H.gc_pool.block_in_pool(p,q) != 0)
     return false;
 
-  if (f_pool.block_in_pool(p,q) != 0)
+  if (H.f_pool.block_in_pool(p,q) != 0)
     return false;
 
-  return large_pool.get_block_head(p,q) == 0;
+  return H.large_pool.get_block_head(p,q) == 0;
 
 }
 
@@ -215,6 +316,8 @@ alf::gc::gc_nogc_data_ok_nz_(const void * p, std::size_t sz)
 alf::gc::gcobj *
 alf::gc::gcobj::S_freeze_(gcobj * ptr, bool do_ptrs /* = true */)
 {
+  heap_impl & H = *cur_heap;
+  PhaseLog::phase ph(H.phases, "freeze");
   gcobj * ret = ptr;
 
   if (ptr) {
@@ -226,7 +329,8 @@ alf::gc::gcobj::S_freeze_(gcobj * ptr, bool do_ptrs /* = true */)
     switch (h ? h->gctype() : -1) {
     case head::GCOBJ:
       // first freeze - move to Fpool.
-      h2 = f_pool.freeze_(ptr_pool, wptr_pool, fptr_pool, h, ptr, ret);
+      h2 = H.f_pool.freeze_(H.ptr_pool, H.wptr_pool, H.fptr_pool, h, ptr, ret);
+      H.sampler.moved(h, h2);
       break;
 
     case head::FROZEN:
@@ -237,11 +341,16 @@ alf::gc::gcobj::S_freeze_(gcobj * ptr, bool do_ptrs /* = true */)
       ++h->fcnt;
       break;
 
+    case head::MOBJ:
+      // medium object, same but its page counts it too.
+      Mpool::freeze_(h);
+      break;
+
     default:
 
       throw fatal_error("Cannot freeze obj");
     }
-    S.freeze(h2->sz, h2->usz);
+    H.S.freeze(h2->sz, h2->usz);
   }
   if (do_ptrs)
     gc::gc_update_pointers();
@@ -253,6 +362,8 @@ alf::gc::gcobj::S_freeze_(gcobj * ptr, bool do_ptrs /* = true */)
 alf::gc::gcobj *
 alf::gc::gcobj::S_unfreeze_(gcobj * ptr, bool do_ptrs /* = true */ )
 {
+  heap_impl & H = *cur_heap;
+  PhaseLog::phase ph(H.phases, "unfreeze");
   gcobj * ret = ptr;
   head * h2 = 0;
 
@@ -265,8 +376,9 @@ alf::gc::gcobj::S_unfreeze_(gcobj * ptr, bool do_ptrs /* = true */ )
     case head::FROZEN:
       if (--h->fcnt == 0)
 	// counter == 0, unfreeze it.
-	h2 = gc_pool.unfreeze_(f_pool, ptr_pool, wptr_pool, fptr_pool,
+	h2 = H.gc_pool.unfreeze_(H.f_pool, H.ptr_pool, H.wptr_pool, H.fptr_pool,
 			       h, ptr, ret);
+      H.sampler.moved(h, h2);
       break;
 
     case head::LOBJ:
@@ -274,6 +386,10 @@ alf::gc::gcobj::S_unfreeze_(gcobj * ptr, bool do_ptrs /* = true */ )
 	--h->fcnt;
       break;
 
+    case head::MOBJ:
+      Mpool::unfreeze_(h);
+      break;
+
     case head::GCOBJ:
       // trying to unfreeze an object that's not frozen.
       didit = false;
@@ -296,7 +412,7 @@ alf::gc::gcobj::S_unfreeze_(gcobj * ptr, bool do_ptrs /* = true */ )
     }
 
     if (didit)
-      S.unfreeze(h2->sz, h2->usz);
+      H.S.unfreeze(h2->sz, h2->usz);
   }
   if (do_ptrs) {
     gc::gc_update_pointers();
@@ -308,6 +424,19 @@ alf::gc::gcobj::S_unfreeze_(gcobj * ptr, bool do_ptrs /* = true */ )
   return ret;
 }
 
+////////////////////////////////////////////////
+// marks of large objects, see head::visited().
+
+bool alf::gc::head::lmarked_() const
+{
+  return cur_heap->large_pool.marked(this);
+}
+
+bool alf::gc::head::lmark_() const
+{
+  return cur_heap->large_pool.mark(this);
+}
+
 ////////////////////////////////////////////////
 // gc_walk_
 //
@@ -315,24 +444,37 @@ alf::gc::gcobj::S_unfreeze_(gcobj * ptr, bool do_ptrs /* = true */ )
 alf::gc::gcobj *
 alf::gc::gc_walk_(const std::string & txt, gcobj * ptr)
 {
+  heap_impl & H = *cur_heap;
   if (ptr == 0) return 0;
 
+  // diagnostic trace - nothing is moved.
+  if (tracer::active)
+    return tracer::active->walk(txt, ptr);
+
   head * h = head::get_head_safe(ptr);
-  head * h2;
-  gcobj * ret = h->p;
+  gcobj * ret = ptr;
 
   if (h) {
 
-    if (h->set_visited())
+    ret = h->p;
+    if (h->set_visited()) {
       // already visited this obj, just return possible new ptr.
+      // A frozen object may since have been unfrozen (and vice versa)
+      // with do_ptrs false, follow to where it is now.
+      switch (h->gctype()) {
+      case head::GCFROZEN:
+      case head::UNFROZEN:
+	return gc_walk_(txt, ret);
+      }
       return ret;
-      
+    }
+
     // we are visiting now.
     switch (h->gctype()) {
 
     case head::GCOBJ:
       // regular object - move it.
-      ret = gc_pool.move(ptr_pool, wptr_pool, fptr_pool, h, ptr);
+      ret = H.gc_pool.move(H.ptr_pool, H.wptr_pool, H.fptr_pool, h, ptr);
       break;
 
     case head::GCMOVED:
@@ -343,6 +485,7 @@ alf::gc::gc_walk_(const std::string & txt, gcobj * ptr)
     case head::FREMOVED:
     case head::FMERGED:
     case head::LREMOVED:
+    case head::MFREE:
       // object has been removed by user - dangling pointer.
       // object is removed, throw dangling_pointer error.
       throw dangling_pointer(std::string("object at ") +
@@ -350,24 +493,95 @@ alf::gc::gc_walk_(const std::string & txt, gcobj * ptr)
     case head::GCFROZEN:
       // object has been frozen, it is now in f_pool.
       // and should stay there. We will walk it and report new addr.
+    case head::UNFROZEN:
+      // object has moved back to GC pool, it may have to move
+      // again and may have been frozen again. report new addr.
+      return gc_walk_(txt, ret);
+
     case head::FROZEN:
       // object is in f_pool, we will walk it and keep it where it is.
-    case head::UNFROZEN:
-      // object has moved back to GC pool, report new addr.
     case head::LOBJ:
       // object is in large_pool. walk it and keep it where it is.
 
       break;
 
+    case head::MOBJ:
+      // medium object, walk it in place and let its page count it.
+      Mpool::marked_(h);
+      break;
+
     default:
 
       throw fatal_error("gc corrupted");
     }
+
+    if (H.scanner.order() != COPY_DEPTH_FIRST) {
+      // the scanner walks ret later.
+      if (H.scanner.busy())
+	H.scanner.push(txt, ret, h);
+      else
+	H.scanner.scan(txt, ret, h);
+      return ret;
+    }
+
+    // ret may have moved, the field map is the same. a derived class
+    // of the same size as T has its own gc_walker.
+    if (h->fmap && typeid(*ret) == *h->fmap->type) {
+      walk_fields_(txt, ret, *h->fmap);
+      return ret;
+    }
   }
   ret->gc_walker(txt);
   return ret;
 }
 
+void alf::gc::walk_fields_(const std::string & txt, gcobj * obj,
+			   const field_map & fm)
+{
+  char * base = reinterpret_cast<char *>(obj);
+  std::size_t k;
+
+  // start loading the heads of all referents before we walk the
+  // first, gc_walk_ looks at the head of each.
+  for (k = 0; k < fm.n; ++k) {
+    gcobj * p = *reinterpret_cast<gcobj **>(base + fm.off[k]);
+    if (p)
+      __builtin_prefetch(reinterpret_cast<head *>(p) - 1, 1);
+  }
+  for (k = 0; k < fm.n; ++k) {
+    gcobj ** pp = reinterpret_cast<gcobj **>(base + fm.off[k]);
+    if (*pp)
+      gc_walk(txt, *pp);
+  }
+}
+
+void alf::gc::walk_array_(const std::string & txt, gcobj ** p, std::size_t n)
+{
+  gcobj ** e = p + n;
+
+  // pointer arrays are often sparse, skip 4 nulls at a time.
+  while (e - p >= 4) {
+    if ((reinterpret_cast<std::uintptr_t>(p[0]) |
+	 reinterpret_cast<std::uintptr_t>(p[1]) |
+	 reinterpret_cast<std::uintptr_t>(p[2]) |
+	 reinterpret_cast<std::uintptr_t>(p[3])) != 0) {
+      int k;
+      for (k = 0; k < 4; ++k)
+	if (p[k])
+	  __builtin_prefetch(reinterpret_cast<head *>(p[k]) - 1, 1);
+      for (k = 0; k < 4; ++k)
+	if (p[k])
+	  gc_walk(txt, p[k]);
+    }
+    p += 4;
+  }
+  while (p < e) {
+    if (*p)
+      gc_walk(txt, *p);
+    ++p;
+  }
+}
+
 //////////////////////////////////
 // allocate
 
@@ -377,15 +591,54 @@ alf::gc::gc_walk_(const std::string & txt, gcobj * ptr)
 // new T...; where T is a managed class (has gcobj as superclass somewhere).
 void * alf::gc::allocate(size_t sz)
 {
+  return allocate(sz, 0);
+}
+
+void * alf::gc::allocate(size_t sz, unsigned int attr)
+{
+  return allocate(sz, attr, 0);
+}
+
+void * alf::gc::allocate_array_(std::size_t hsz, std::size_t n,
+			       std::size_t esz, unsigned int attr,
+			       const field_map * fm)
+{
+  if (esz != 0 && n > (SIZE_MAX - hsz)/esz)
+    throw gc_allocation_error("array too large");
+  return allocate(hsz + n*esz, attr, fm);
+}
+
+void * alf::gc::allocate(size_t sz, unsigned int attr, const field_map * fm)
+{
+  heap_impl & H = *cur_heap;
   head * h;
   void * p;
   bool did_gc = false;
-
-  if (sz >= large_sz)
-    h = large_pool.alloc_(sz, p);
+  int cls = -1;
+
+  if (sz >= H.medium_sz && sz < H.large_sz && (attr & ALLOC_LARGE) == 0)
+    cls = Mpool::size_class(sz);
+
+  if (cls >= 0)
+    h = H.large_pool.M_.alloc_(cls, sz, attr, p);
+  else if (sz >= H.large_sz || sz >= H.medium_sz || (attr & ALLOC_LARGE) != 0) {
+    // huge, too large for any size class of Mpool or it must be
+    // a block of its own.
+    h = H.large_pool.alloc_(sz, p);
+    if (attr & ALLOC_NOFINAL)
+      h->flags |= head::NOFINAL;
+    if (attr & ALLOC_PINNED)
+      // large objects don't move, just count it.
+      h->fcnt = 1;
+  } else if (attr & ALLOC_PINNED)
+    h = H.f_pool.pinned_alloc_(sz, attr, p);
   else
-    h = gc_pool.alloc_(sz, p, did_gc);
-  S.alloc(h->sz, sz);
+    h = H.gc_pool.alloc_(sz, p, did_gc, attr);
+  h->fmap = fm;
+  H.S.alloc(h->sz, sz);
+  if (attr & ALLOC_PINNED)
+    H.S.freeze(h->sz, sz);
+  H.sampler.alloc(h, sz);
   return p;
 }
 
@@ -394,6 +647,7 @@ void * alf::gc::allocate(size_t sz)
 
 bool alf::gc::deallocate_(void * ptr)
 {
+  heap_impl & H = *cur_heap;
   bool rm = false;
   if (ptr) {
 
@@ -401,15 +655,18 @@ bool alf::gc::deallocate_(void * ptr)
     std::size_t usz = h->usz;
     std::size_t sz = h->sz;
 
+    H.sampler.dealloc(h);
+
     switch (h->gctype()) {
 
     case head::GCOBJ:
-      rm = gc_pool.dealloc_(h, ptr);
+      rm = H.gc_pool.dealloc_(h, ptr);
       break;
 
     case head::GCRM:
     case head::FREMOVED:
     case head::FMERGED:
+    case head::MFREE:
       // object is already removed - do nothing.
       return false;
 
@@ -420,17 +677,24 @@ bool alf::gc::deallocate_(void * ptr)
       return gc::deallocate_(h->p);
 
     case head::FROZEN:
-      rm = f_pool.dealloc_(h, ptr);
+      rm = H.f_pool.dealloc_(h, ptr);
       break;
 
     case head::LOBJ:
-      rm = large_pool.dealloc_(h, ptr);
+      rm = H.large_pool.dealloc_(h, ptr);
+      break;
+
+    case head::MOBJ:
+      // gc found it unreachable, it is already counted as gone.
+      if (Mpool::dead_(h))
+	return false;
+      rm = H.large_pool.M_.dealloc_(h, ptr);
       break;
 
     default:
       throw fatal_error("gctype corrupt - got " + h->gcflags_str());
     }
-    S.dealloc(sz, usz);
+    H.S.dealloc(sz, usz);
     // If we actually removed an object - update any pointers
     // will also update weak pointers.
     if (rm)
@@ -450,19 +714,49 @@ void alf::gc::deallocate(void * ptr)
 //////////////////////////////////
 // root ptr functions
 
+alf::gc::heap_impl * alf::gc::current_heap_()
+{
+  return cur_heap;
+}
+
 // register a top level pointer.
 // any pointer registered this way will be a root pointer for gc walk.
 void alf::gc::register_root_ptr_(const std::string & txt, gcobj ** pp)
 {
-  ptr_pool.ptr_register(txt, pp, gc_pool, f_pool, large_pool);
+  register_root_ptr_(cur_heap, txt, pp);
 }
 
 void alf::gc::unregister_root_ptr_(gcobj ** pp)
 {
-  ptr_pool.ptr_unregister(pp);
+  cur_heap->ptr_pool.ptr_unregister(pp);
+}
+
+void alf::gc::unregister_all_root_ptrs(gcobj ** pp)
+{
+  cur_heap->ptr_pool.ptr_unregister_all(pp);
+}
+
+void alf::gc::unregister_all_root_ptrs()
+{
+  cur_heap->ptr_pool.ptr_unregister_all();
+}
+
+void alf::gc::register_root_ptr_(heap_impl * hp, const std::string & txt,
+				 gcobj ** pp)
+{
+  heap_impl & H = *hp;
+  H.ptr_pool.ptr_register(txt, pp, H.gc_pool, H.f_pool, H.large_pool);
+}
+
+void alf::gc::unregister_root_ptr_(heap_impl * hp, gcobj ** pp)
+{
+  hp->ptr_pool.ptr_unregister(pp);
 }
 
-void alf::gc::unregister_all_root_ptrs();
+void alf::gc::unregister_all_root_ptrs_(heap_impl * hp, gcobj ** pp)
+{
+  hp->ptr_pool.ptr_unregister_all(pp);
+}
 
 //////////////////////////////////
 // data<..> functions
@@ -470,22 +764,39 @@ void alf::gc::unregister_all_root_ptrs();
 void alf::gc::register_obj_(const std::string & txt, void * d,
 			    void f(const std::string &, void *))
 {
-  fptr_pool.fun_register(gc_pool, f_pool, large_pool, txt, d, f);
+  register_obj_(cur_heap, txt, d, f);
 }
 
 void alf::gc::unregister_obj_(void * d)
 {
-  fptr_pool.fun_unregister(d);
+  cur_heap->fptr_pool.fun_unregister(d);
 }
 
 void alf::gc::unregister_all_objs_(void * d)
 {
-  fptr_pool.fun_unregister_all(d);
+  cur_heap->fptr_pool.fun_unregister_all(d);
 }
 
 void alf::gc::unregister_all_objs_()
 {
-  fptr_pool.fun_unregister_all();
+  cur_heap->fptr_pool.fun_unregister_all();
+}
+
+void alf::gc::register_obj_(heap_impl * hp, const std::string & txt,
+			    void * d, void f(const std::string &, void *))
+{
+  heap_impl & H = *hp;
+  H.fptr_pool.fun_register(H.gc_pool, H.f_pool, H.large_pool, txt, d, f);
+}
+
+void alf::gc::unregister_obj_(heap_impl * hp, void * d)
+{
+  hp->fptr_pool.fun_unregister(d);
+}
+
+void alf::gc::unregister_all_objs_(heap_impl * hp, void * d)
+{
+  hp->fptr_pool.fun_unregister_all(d);
 }
 
 //////////////////////////////////
@@ -493,22 +804,151 @@ void alf::gc::unregister_all_objs_()
 
 void alf::gc::register_weak_pointer_(gcobj * & p)
 {
-  wptr_pool.wptr_register(gc_pool, f_pool, large_pool, p);
+  register_weak_pointer_(cur_heap, p);
+}
+
+void alf::gc::register_weak_pointer_(gcobj * & p,
+				     reference_queue & q, void * tag)
+{
+  register_weak_pointer_(cur_heap, p, q, tag);
+}
+
+void alf::gc::set_weak_pointer_queue_(gcobj * & p,
+				      reference_queue & q, void * tag)
+{
+  set_weak_pointer_queue_(cur_heap, p, q, tag);
 }
 
 void alf::gc::unregister_weak_pointer_(gcobj * & p)
 {
-  wptr_pool.wptr_unregister(p);
+  cur_heap->wptr_pool.wptr_unregister(p);
 }
 
 void alf::gc::unregister_all_weak_pointers_(gcobj * & p)
 {
-  wptr_pool.wptr_unregister_all(p);
+  cur_heap->wptr_pool.wptr_unregister_all(p);
 }
 
 void alf::gc::unregister_all_weak_pointers()
 {
-  wptr_pool.wptr_unregister_all();
+  cur_heap->wptr_pool.wptr_unregister_all();
+}
+
+void alf::gc::register_weak_pointer_(heap_impl * hp, gcobj * & p)
+{
+  heap_impl & H = *hp;
+  H.wptr_pool.wptr_register(H.gc_pool, H.f_pool, H.large_pool, p);
+}
+
+void alf::gc::register_weak_pointer_(heap_impl * hp, gcobj * & p,
+				     reference_queue & q, void * tag)
+{
+  heap_impl & H = *hp;
+  H.wptr_pool.wptr_register(H.gc_pool, H.f_pool, H.large_pool, p,
+			    & q, tag);
+}
+
+void alf::gc::set_weak_pointer_queue_(heap_impl * hp, gcobj * & p,
+				      reference_queue & q, void * tag)
+{
+  heap_impl & H = *hp;
+  H.wptr_pool.set_queue(H.gc_pool, H.f_pool, H.large_pool, p, & q, tag);
+}
+
+void alf::gc::unregister_weak_pointer_(heap_impl * hp, gcobj * & p)
+{
+  hp->wptr_pool.wptr_unregister(p);
+}
+
+void alf::gc::unregister_all_weak_pointers_(heap_impl * hp, gcobj * & p)
+{
+  hp->wptr_pool.wptr_unregister_all(p);
+}
+
+alf::gc::reference_queue::~reference_queue()
+{
+  heap_->wptr_pool.queue_unregister(this);
+}
+
+alf::gc::weak_table_::weak_table_()
+  : slots_(0), values_(0), nslots_(0), heap_(cur_heap)
+{
+  heap_->wptr_pool.table_register(this);
+}
+
+// virtual
+alf::gc::weak_table_::~weak_table_()
+{
+  heap_->wptr_pool.table_unregister(this);
+}
+
+//////////////////////////////////
+// mapped_file
+
+// static
+alf::gc::mapped_file *
+alf::gc::mapped_file::open(const std::string & path, int mode,
+			   std::size_t off, std::size_t len)
+{
+  if (mode != READ_ONLY && mode != PRIVATE)
+    throw gc_error("mapped_file: invalid mode");
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw gc_error("mapped_file: " + path + ": " + std::strerror(errno));
+
+  struct stat st;
+  if (::fstat(fd, & st) < 0) {
+    int e = errno;
+    ::close(fd);
+    throw gc_error("mapped_file: " + path + ": " + std::strerror(e));
+  }
+  std::size_t fsz = st.st_size;
+  if (off > fsz || len > fsz - off) {
+    ::close(fd);
+    throw gc_error("mapped_file: " + path + ": region outside file");
+  }
+  if (len == 0) len = fsz - off;
+
+  // mmap wants a page aligned offset.
+  std::size_t pg = ::sysconf(_SC_PAGESIZE);
+  std::size_t skip = off % pg;
+  std::size_t mlen = skip + len;
+  void * base = 0;
+  if (len) {
+    base = ::mmap(0, mlen, mode == PRIVATE ? PROT_READ | PROT_WRITE : PROT_READ,
+		  mode == PRIVATE ? MAP_PRIVATE : MAP_SHARED, fd, off - skip);
+    if (base == MAP_FAILED) {
+      int e = errno;
+      ::close(fd);
+      throw gc_error("mapped_file: " + path + ": " + std::strerror(e));
+    }
+  } else
+    mlen = 0;
+  // the mapping keeps the file.
+  ::close(fd);
+
+  void * p;
+  try {
+    p = allocate(sizeof(mapped_file), ALLOC_LARGE,
+		 field_map_of<mapped_file, fields<> >::get());
+  } catch (...) {
+    if (base) ::munmap(base, mlen);
+    throw;
+  }
+  cur_heap->S.map(mlen);
+  char * d = base ? reinterpret_cast<char *>(base) + skip : 0;
+  return ::new (p) mapped_file(d, len, base, mlen, mode);
+}
+
+// virtual
+alf::gc::mapped_file::~mapped_file()
+{
+  if (base_) ::munmap(base_, mlen_);
+  cur_heap->S.unmap(mlen_);
+  base_ = 0;
+  p_ = 0;
+  n_ = mlen_ = 0;
 }
 
 //////////////////////////////////
@@ -517,170 +957,462 @@ void alf::gc::unregister_all_weak_pointers()
 // some functions provided for statistics.
 int alf::gc::num_allocs() // number of allcoations (new).
 {
-  return S.n_a;
+  return cur_heap->S.n_a;
 }
 
 int alf::gc::num_deallocs() // number of deallocations (delete).
 {
-  return S.n_d;
+  return cur_heap->S.n_d;
 }
 
 int alf::gc::num_cur_allocs() // number of currently allocated objects.
 {
-  return S.n_cur_a();
+  return cur_heap->S.n_cur_a();
 }
 
 std::size_t alf::gc::usize_allocated() // total size of allocations.
 {
-  return S.usz_a;
+  return cur_heap->S.usz_a;
 }
 
 std::size_t alf::gc::usize_deallocated() // total size of deallocations.
 {
-  return S.usz_d;
+  return cur_heap->S.usz_d;
 }
 
 // total size of currently allocated objects.
 std::size_t alf::gc::usize_cur_allocated()
 {
-  return S.usz_cur_a();
+  return cur_heap->S.usz_cur_a();
 }
 
 // total size including overhead and pointer pool.
 std::size_t alf::gc::size_allocated()
 {
-  return S.sz_a;
+  return cur_heap->S.sz_a;
 }
 
 std::size_t alf::gc::size_deallocated() // total size of deallocations.
 {
-  return S.sz_d;
+  return cur_heap->S.sz_d;
 }
 
 // total size of currently allocated objects.
 std::size_t alf::gc::size_cur_allocated()
 {
-  return S.sz_cur_a();
+  return cur_heap->S.sz_cur_a();
 }
 
 int alf::gc::num_frozen()
 {
-  return S.n_freeze;
+  return cur_heap->S.n_freeze;
 }
 
 int alf::gc::num_unfrozen()
 {
-  return S.n_unfreeze;
+  return cur_heap->S.n_unfreeze;
 }
 
 int alf::gc::num_cur_frozen()
 {
-  return S.n_cur_f();
+  return cur_heap->S.n_cur_f();
 }
 
 std::size_t alf::gc::usize_frozen()
 {
-  return S.usz_f;
+  return cur_heap->S.usz_f;
 }
 
 std::size_t alf::gc::usize_unfrozen()
 {
-  return S.usz_u;
+  return cur_heap->S.usz_u;
 }
 
 std::size_t alf::gc::usize_cur_frozen()
 {
-  return S.usz_cur_f();
+  return cur_heap->S.usz_cur_f();
 }
 
 std::size_t alf::gc::size_frozen()
 {
-  return S.sz_f;
+  return cur_heap->S.sz_f;
 }
 
 std::size_t alf::gc::size_unfrozen()
 {
-  return S.sz_u;
+  return cur_heap->S.sz_u;
 }
 
 std::size_t alf::gc::size_cur_frozen()
 {
-  return S.sz_u;
+  return cur_heap->S.sz_u;
+}
+
+alf::gc::frozen_pool_info alf::gc::frozen_pool_stats()
+{
+  frozen_pool_info fi;
+  cur_heap->f_pool.info_(fi);
+  return fi;
+}
+
+int alf::gc::set_semispace_release(int mode, std::size_t warm /* = 0 */ )
+{
+  return cur_heap->gc_pool.set_release(mode, warm);
+}
+
+int alf::gc::semispace_release()
+{
+  return cur_heap->gc_pool.release_mode();
+}
+
+alf::gc::semispace_info alf::gc::semispace_stats()
+{
+  heap_impl & H = *cur_heap;
+  semispace_info si;
+  si.size = H.gc_pool.size();
+  si.warm = H.gc_pool.release_warm();
+  si.releases = H.S.n_rel;
+  si.released = H.S.sz_rel;
+  si.rss_before = H.S.rss_b;
+  si.rss_after = H.S.rss_a;
+  return si;
+}
+
+std::size_t alf::gc::set_heap_limit(std::size_t limit)
+{
+  return cur_heap->limiter.set_limit(limit);
+}
+
+std::size_t alf::gc::heap_limit()
+{
+  return cur_heap->limiter.limit();
+}
+
+void alf::gc::add_heap_callback(unsigned int pct, heap_callback fn,
+				void * data /* = 0 */ )
+{
+  cur_heap->limiter.add(pct, fn, data);
+}
+
+void alf::gc::remove_heap_callback(heap_callback fn, void * data /* = 0 */ )
+{
+  cur_heap->limiter.remove(fn, data);
+}
+
+alf::gc::heap_info alf::gc::heap_stats()
+{
+  heap_impl & H = *cur_heap;
+  heap_info hi;
+  hi.size = H.S.heap;
+  hi.peak = H.S.heap_max;
+  hi.limit = H.S.heap_lim;
+  hi.headroom = H.S.heap < H.S.heap_lim ? H.S.heap_lim - H.S.heap : 0;
+  hi.callbacks = H.S.n_hcb;
+  hi.emergency_gcs = H.S.n_emerg;
+  hi.refused = H.S.n_lfail;
+  return hi;
+}
+
+int alf::gc::num_mapped()
+{
+  return cur_heap->S.n_map;
+}
+
+int alf::gc::num_unmapped()
+{
+  return cur_heap->S.n_unmap;
+}
+
+int alf::gc::num_cur_mapped()
+{
+  return cur_heap->S.n_cur_m();
+}
+
+std::size_t alf::gc::size_mapped()
+{
+  return cur_heap->S.sz_m;
+}
+
+std::size_t alf::gc::size_unmapped()
+{
+  return cur_heap->S.sz_um;
+}
+
+std::size_t alf::gc::size_cur_mapped()
+{
+  return cur_heap->S.sz_cur_m();
 }
 
 // return total time in seconds spent on gc.
 // pointer will receive time spent including nano seconds. 
 time_t alf::gc::time_gc(struct timeval * ptv /* = 0 */ )
 {
-  return S.time_gc(ptv);
+  return cur_heap->S.time_gc(ptv);
 }
 
 int alf::gc::num_gc() // number of times gc() is called.
 {
-  return S.n_gc;
+  return cur_heap->S.n_gc;
 }
 
 void alf::gc::reset_num_gc() // reset num_gc() and time_gc().
 {
-  S.reset_num_gc();
+  cur_heap->S.reset_num_gc();
+}
+
+int alf::gc::num_gc_pauses(int bucket)
+{
+  if (bucket < 0 || bucket >= statistics::PAUSE_BUCKETS) return 0;
+  return cur_heap->S.pause[bucket];
+}
+
+time_t alf::gc::max_gc_pause(struct timeval * ptv /* = 0 */ )
+{
+  heap_impl & H = *cur_heap;
+  if (ptv) *ptv = H.S.max_pause;
+  return H.S.max_pause.tv_sec;
 }
 
 bool alf::gc::in_gc()
 {
-  return S.in_gc;
+  return cur_heap->S.in_gc;
 }
 
 void alf::gc::gc() // explicit call to gc.
 {
+  heap_impl & H = *cur_heap;
   struct timeval start;
   struct timeval stop;
   struct timeval diff;
 
-  if (! S.in_gc) {
-    S.in_gc = true;
+  if (! H.S.in_gc) {
+    H.S.in_gc = true;
     gettimeofday(& start, 0);
-    gc_pool.do_gc_(ptr_pool, fptr_pool, large_pool, f_pool, wptr_pool);
+    H.gc_pool.do_gc_(H.ptr_pool, H.fptr_pool, H.large_pool, H.f_pool,
+		     H.wptr_pool, H.sampler, H.finalizer);
     gettimeofday(& stop, 0);
     timersub(& stop, & start, & diff);
-    S.gc_add_timing(diff);
-    S.in_gc = false;
+    H.S.gc_add_timing(diff);
+    H.S.in_gc = false;
+    H.finalizer.after_gc();
   }
 }
 
 void alf::gc::gc_update_pointers()
 {
-  gc_pool.do_gc_update_pointers(ptr_pool, fptr_pool, large_pool,
-				f_pool, wptr_pool);
+  heap_impl & H = *cur_heap;
+  H.gc_pool.do_gc_update_pointers(H.ptr_pool, H.fptr_pool, H.large_pool,
+				H.f_pool, H.wptr_pool);
 }
 
 std::size_t alf::gc::pool_size() // size of current gc pool.
 {
-  return gc_pool.size();
+  return cur_heap->gc_pool.size();
 }
 
 // resize current gc pool. This will trigger a gc().
 void alf::gc::resize(std::size_t newsz)
 {
-  gc_pool.resize(newsz);
+  cur_heap->gc_pool.resize(newsz);
 }
 
 // Set/get the size threshold for putting objects in large pool.
 std::size_t alf::gc::large_size()
 {
-  return large_sz;
+  return cur_heap->large_sz;
 }
 
 // Set the size, return old size.
 // if newsz < 4096, it is set to 4096.
 std::size_t alf::gc::set_large_size(std::size_t newsz)
 {
+  heap_impl & H = *cur_heap;
   if (newsz < 4096) newsz = 4096; // large_size is at least 4k.
-  std::size_t osz = large_sz;
-  large_sz = newsz;
+  std::size_t osz = H.large_sz;
+  H.large_sz = newsz;
+  return osz;
+}
+
+// Set/get the size threshold for putting objects in medium pool.
+std::size_t alf::gc::medium_size()
+{
+  return cur_heap->medium_sz;
+}
+
+// Set the size, return old size.
+// if newsz < 1024, it is set to 1024.
+std::size_t alf::gc::set_medium_size(std::size_t newsz)
+{
+  heap_impl & H = *cur_heap;
+  if (newsz < 1024) newsz = 1024; // medium_size is at least 1k.
+  std::size_t osz = H.medium_sz;
+  H.medium_sz = newsz;
   return osz;
 }
 
 std::ostream & alf::gc::report(std::ostream & os)
 {
-  return S.report(os);
+  return cur_heap->S.report(os);
+}
+
+//////////////////////////////////
+// allocation sampling
+
+std::size_t alf::gc::set_sample_rate(std::size_t rate)
+{
+  return cur_heap->sampler.set_rate(rate);
+}
+
+std::size_t alf::gc::sample_rate()
+{
+  return cur_heap->sampler.rate();
+}
+
+std::ostream & alf::gc::sample_report(std::ostream & os)
+{
+  return cur_heap->sampler.report(os);
+}
+
+std::ostream & alf::gc::heap_profile(std::ostream & os)
+{
+  return cur_heap->sampler.heap_profile(os);
+}
+
+//////////////////////////////////
+// phase trace
+
+std::size_t alf::gc::set_phase_trace(std::size_t n)
+{
+  return cur_heap->phases.set_capacity(n);
+}
+
+std::size_t alf::gc::phase_trace_size()
+{
+  return cur_heap->phases.capacity();
+}
+
+std::ostream & alf::gc::phase_trace(std::ostream & os)
+{
+  return cur_heap->phases.chrome_trace(os);
+}
+
+//////////////////////////////////
+// finalization
+
+int alf::gc::set_finalize_mode(int mode)
+{
+  return cur_heap->finalizer.set_mode(mode);
+}
+
+int alf::gc::finalize_mode()
+{
+  return cur_heap->finalizer.mode();
+}
+
+std::size_t alf::gc::run_finalizers(std::size_t budget /* = 0 */ )
+{
+  return cur_heap->finalizer.run(budget);
+}
+
+std::size_t alf::gc::pending_finalizers()
+{
+  return cur_heap->finalizer.pending();
+}
+
+//////////////////////////////////
+// copy order
+
+int alf::gc::set_copy_order(int order)
+{
+  return cur_heap->scanner.set_order(order);
+}
+
+int alf::gc::copy_order()
+{
+  return cur_heap->scanner.order();
+}
+
+//////////////////////////////////
+// tracing
+
+// walk the heap with tracer t.
+static void trace_(alf::gc::tracer & t)
+{
+  alf::gc::heap_impl & H = *cur_heap;
+  // a trace is not a gc but we don't want one to start under us.
+  struct guard {
+    bool & in_gc;
+    bool was_in_gc;
+    ~guard() { in_gc = was_in_gc; }
+  } g = { H.S.in_gc, H.S.in_gc };
+
+  H.S.in_gc = true;
+  H.gc_pool.do_trace(H.ptr_pool, H.fptr_pool, H.large_pool, H.f_pool,
+		     H.wptr_pool, t);
+}
+
+std::size_t alf::gc::heap_snapshot(const std::string & fname)
+{
+  std::FILE * f = std::fopen(fname.c_str(), "wb");
+
+  if (f == 0)
+    throw gc_error("heap_snapshot: cannot open " + fname);
+
+  snapshot snap(f);
+  trace_(snap);
+  if (std::fclose(f) != 0)
+    throw gc_error("heap_snapshot: error writing " + fname);
+  return snap.nodes();
+}
+
+std::size_t alf::gc::save_image(const std::string & fname)
+{
+  image_writer w;
+  trace_(w);
+
+  std::FILE * f = std::fopen(fname.c_str(), "wb");
+  if (f == 0)
+    throw gc_error("save_image: cannot open " + fname);
+  try {
+    w.write(f, fname);
+  } catch (...) {
+    std::fclose(f);
+    throw;
+  }
+  if (std::fclose(f) != 0)
+    throw gc_error("save_image: error writing " + fname);
+  return w.objects();
+}
+
+std::size_t alf::gc::load_image(const std::string & fname)
+{
+  heap_impl & H = *cur_heap;
+  image_reader r(fname);
+  minipool * mp = r.release(H.S);
+
+  if (mp)
+    H.f_pool.adopt_(mp);
+  for (auto & x : r.roots())
+    H.ptr_pool.set_root_(x.first,
+			 reinterpret_cast<gcobj *>(r.base() + x.second));
+  return r.objects();
+}
+
+void alf::gc::image_type_(const std::type_info & t, image_ctor_ ctor,
+			  const field_map * fm)
+{
+  image_types::add(t, ctor, fm);
+}
+
+std::vector<alf::gc::retention_step>
+alf::gc::retention_path(gcobj * obj)
+{
+  std::vector<retention_step> v;
+
+  if (obj) {
+    pathfinder pf(obj);
+    trace_(pf);
+    pf.path(v);
+  }
+  return v;
 }
@@ -38,6 +38,16 @@ void alf::gc::statistics::gc_add_timing(const struct timeval & t)
 {
   timeradd(& t, & timing, & timing);
   ++n_gc;
+
+  unsigned long long us = t.tv_sec*1000000ULL + t.tv_usec;
+  int k = 0;
+  while (us && k < PAUSE_BUCKETS - 1) {
+    us >>= 1;
+    ++k;
+  }
+  ++pause[k];
+  if (timercmp(& t, & max_pause, >))
+    max_pause = t;
 }
 
 // reset num_gc() and time_gc().
@@ -45,6 +55,9 @@ void alf::gc::statistics::reset_num_gc()
 {
   timing.tv_usec = 0;
   timing.tv_sec = 0;
+  max_pause.tv_usec = 0;
+  max_pause.tv_sec = 0;
+  std::memset(pause, 0, sizeof(pause));
   n_gc = 0;
 }
 
@@ -77,7 +90,7 @@ std::ostream & alf::gc::statistics::report(std::ostream & os) const
     n += sprintf( buf + n, "%d days ", days);
   bool longtime = false;
   if (hrs != 0 || min != 0 || days != 0 || tt != 0) {
-    n += sprintf( buf + n, "%02d:%02d:%02", hrs, min, sec);
+    n += sprintf( buf + n, "%02d:%02d:%02d", hrs, min, sec);
     longtime = true;
   } else
     n = sprintf(buf, "%d", sec);
@@ -87,6 +100,9 @@ std::ostream & alf::gc::statistics::report(std::ostream & os) const
   if (! longtime)
     n += sprintf(buf + n, " secs");
   os << buf << ")" << std::endl;
+  if (n_gc)
+    os << "longest gc " << max_pause.tv_sec*1000000LL + max_pause.tv_usec
+       << " us" << std::endl;
 
   std::size_t usz_x = usz_a - usz_d;
   std::size_t sz_x = sz_a - sz_d;
@@ -115,5 +131,32 @@ std::ostream & alf::gc::statistics::report(std::ostream & os) const
        << sz_y << " cur frozen" << std::endl;
   }
 
+  if (n_map) {
+    os << "mapped: " << n_map << " mapped - " << n_unmap << " unmapped = "
+       << n_cur_m() << " cur mapped" << std::endl;
+    os << "file space " << sz_m << " mapped - " << sz_um << " unmapped = "
+       << sz_cur_m() << " cur mapped" << std::endl;
+  }
+
+  os << "heap " << heap << " bytes, peak " << heap_max << std::endl;
+  if (heap_lim) {
+    os << "heap limit " << heap_lim << ", headroom "
+       << (heap < heap_lim ? heap_lim - heap : 0) << std::endl;
+    os << "pressure: " << n_hcb << " callbacks, " << n_emerg
+       << " emergency gc, " << n_lfail << " refused" << std::endl;
+  }
+
+  if (n_rel) {
+    os << "released: " << n_rel << " times, " << sz_rel
+       << " bytes of inactive gc pool" << std::endl;
+    os << "rss " << rss_b << " before - " << rss_a
+       << " after last release" << std::endl;
+  }
+
+  if (n_arena)
+    os << "arenas: " << n_arena << " opened, " << n_arena_d
+       << " discarded (" << sz_arena_d << " bytes), " << n_arena_p
+       << " promoted" << std::endl;
+
   return os;
 }
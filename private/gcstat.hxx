@@ -14,7 +14,13 @@ namespace gc {
 
 struct statistics {
 
+  // pause[0] counts gc taking less than 1 us, pause[k] those
+  // taking at least 2^(k-1) us but less than 2^k us.
+  enum { PAUSE_BUCKETS = 32 };
+
   struct timeval timing;
+  struct timeval max_pause;
+  int pause[PAUSE_BUCKETS];
   std::size_t usz_a;
   std::size_t usz_d;
   std::size_t usz_f;
@@ -23,12 +29,31 @@ struct statistics {
   std::size_t sz_d;
   std::size_t sz_f;
   std::size_t sz_u;
+  std::size_t sz_m;
+  std::size_t sz_um;
+  std::size_t sz_rel; // inactive gc pool given back after gc.
+  std::size_t rss_b; // rss just before the last release.
+  std::size_t rss_a; // and just after.
+  std::size_t heap; // memory held by the pools.
+  std::size_t heap_max; // most heap ever was.
+  std::size_t heap_lim; // set_heap_limit(), 0 if none.
   int n_freeze;
   int n_unfreeze;
+  int n_map;
+  int n_unmap;
+  int n_rel;
+  int n_hcb; // heap callbacks called.
+  int n_emerg; // emergency gcs.
+  int n_lfail; // growths refused by heap_lim.
+  int n_arena; // arenas opened.
+  int n_arena_d; // arenas discarded when closed.
+  int n_arena_p; // arenas promoted when closed.
+  std::size_t sz_arena_d; // bytes of discarded arenas.
   int n_a;
   int n_d;
   int n_gc;
   bool in_gc;
+  std::size_t epoch; // mark epoch, a new one for each walk.
 
   statistics()
   { std::memset(this, 0, sizeof(*this)); }
@@ -43,6 +68,9 @@ struct statistics {
   std::size_t sz_cur_f() const { return sz_f - sz_u; }
   int n_cur_f() const { return n_freeze - n_unfreeze; }
 
+  std::size_t sz_cur_m() const { return sz_m - sz_um; }
+  int n_cur_m() const { return n_map - n_unmap; }
+
   void alloc(std::size_t sz, std::size_t usz)
   {
     ++n_a;
@@ -57,6 +85,14 @@ struct statistics {
     sz_d += sz;
   }
 
+  // n objects at once.
+  void dealloc(int n, std::size_t sz, std::size_t usz)
+  {
+    n_d += n;
+    usz_d += usz;
+    sz_d += sz;
+  }
+
   void freeze(std::size_t sz, std::size_t usz)
   {
     ++n_freeze;
@@ -71,6 +107,38 @@ struct statistics {
     sz_u += sz;
   }
 
+  // file regions mapped by mapped_file.
+  void map(std::size_t sz)
+  {
+    ++n_map;
+    sz_m += sz;
+  }
+
+  void unmap(std::size_t sz)
+  {
+    ++n_unmap;
+    sz_um += sz;
+  }
+
+  // sz bytes of the inactive gc pool given back, rss before and after.
+  void release(std::size_t sz, std::size_t before, std::size_t after)
+  {
+    ++n_rel;
+    sz_rel += sz;
+    rss_b = before;
+    rss_a = after;
+  }
+
+  // a pool got or gave back sz bytes of memory.
+  void grow(std::size_t sz)
+  {
+    heap += sz;
+    if (heap > heap_max) heap_max = heap;
+  }
+
+  void shrink(std::size_t sz)
+  { heap -= sz; }
+
   void gc_add_timing(const struct timeval & t);
 
   std::ostream & report(std::ostream & os) const;
@@ -7,11 +7,12 @@
 #include "head.hxx"
 
 // static
-const char * alf::gc::head::S_gctypes[LREMOVED + 2] = {
+const char * alf::gc::head::S_gctypes[MFREE + 2] = {
   "none",
   "GCOBJ", "GCMOVED", "GCRM", "GCFROZEN",
   "FROZEN", "UNFROZEN", "FREMOVED", "FMERGED",
   "LOBJ", "LREMOVED",
+  "MOBJ", "MFREE",
   0 };
 
 // static
@@ -19,7 +20,7 @@ const char * alf::gc::head::gctype_str(int t)
 {
   static char b[30];
   t &= POOLMASK;
-  if (t < GCOBJ || t > LREMOVED) {
+  if (t < GCOBJ || t > MFREE) {
     sprintf(b, "%d", t);
     return b;
   }
@@ -41,13 +42,8 @@ std::string alf::gc::head::gcflags_str(int f)
   char buf[200];
   char * p = buf;
 
-  if (f & GCBIT)
-    p = stpcpy(p, "GCBIT");
-  if (f & MOVED) {
-    if (p != buf)
-      *p++ = '|';
+  if (f & MOVED)
     p = stpcpy(p, "MOVED");
-  }
   if (f & REMOVED) {
     if (p != buf)
       *p++ = '|';
@@ -58,6 +54,16 @@ std::string alf::gc::head::gcflags_str(int f)
       *p++ = '|';
     p = stpcpy(p, "FREE");
   }
+  if (f & NOFINAL) {
+    if (p != buf)
+      *p++ = '|';
+    p = stpcpy(p, "NOFINAL");
+  }
+  if (f & RELEASED) {
+    if (p != buf)
+      *p++ = '|';
+    p = stpcpy(p, "RELEASED");
+  }
   f &= POOLMASK;
   if (p != buf)
     *p++ = '|';
@@ -98,7 +104,7 @@ bool alf::gc::head::check(minipool * real_mp) const
   int m = f & POOLMASK;
   head * h;
 
-  if (m > LREMOVED) return false;
+  if (m > MFREE) return false;
   if (usz > sz) return false;
   if (sz & (sizeof(std::size_t) - 1)) return false;
   if (mp != real_mp) return false;
@@ -123,13 +129,17 @@ bool alf::gc::head::check(minipool * real_mp) const
   case GCRM:
     if (fcnt) return false;
     if (p) return false;
+    break;
 
   case GCFROZEN:
     if (fcnt) return false; // this object is moved.
     if (p == 0 || p == obj()) return false;
     if ((h = get_head_safe(p)) == 0) return false;
     // same comment as for GCMOVED regarding h->mp.
-    if (! h->check(h->mp, FROZEN)) return false;
+    // the frozen object may have been unfrozen again before
+    // pointers were updated.
+    if (! h->check(h->mp, FROZEN) && ! h->check(h->mp, UNFROZEN))
+      return false;
     break;
 
   case FROZEN:
@@ -140,8 +150,12 @@ bool alf::gc::head::check(minipool * real_mp) const
   case UNFROZEN:
     // this object is moved back to GC pool.
     if (p == 0 || p == obj()) return false;
-    h = get_head_safe(p);
-    if (! h->check(h->mp, GCOBJ)) return false;
+    if ((h = get_head_safe(p)) == 0) return false;
+    // it may have moved again in this gc or been frozen again before
+    // pointers were updated.
+    if (! h->check(h->mp, GCOBJ) && ! h->check(h->mp, GCMOVED)
+	&& ! h->check(h->mp, GCFROZEN))
+      return false;
     break;
 
   case FREMOVED:
@@ -159,6 +173,16 @@ bool alf::gc::head::check(minipool * real_mp) const
     if (mp) return false;
     if (p) return false;
     break;
+
+  case MOBJ:
+    if (mp == 0) return false;
+    if (p != obj()) return false;
+    break;
+
+  case MFREE:
+    if (mp == 0) return false;
+    if (p) return false;
+    break;
   }
 
   tail * t = cur_tail();
@@ -268,6 +292,7 @@ void alf::gc::head::h_init(minipool * mpool,
   usz = u_sz;
   vp = reinterpret_cast<void *>(this + 1);
   mp = mpool;
+  fmap = 0;
   //fill(deadbeef, 0xdeadbeef, sizeof(deadbeef));
   fill(deadbeef, 0x0a0a0a0a, sizeof(deadbeef));
 }
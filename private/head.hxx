@@ -54,11 +54,15 @@ struct head_base {
   };
 
   // pointer to minipool for GCpool objects and
-  // Fminipool for Fpool objects.
+  // Fminipool for Fpool objects and mpage for Mpool objects.
   // this is 0 for Lpool objs.
 
   minipool * mp; // pointer to minipool which this block belongs to.
 
+  // pointer fields of the object if allocated by mapped<>, else 0
+  // and gc calls gc_walker. Follows the object when it moves.
+  const field_map * fmap;
+
   // This is the modified user requested size of gcobj.
   // user may request any size but we make sure that asz is always
   // a multiple of 8 and that is the size allocated for the obj.
@@ -150,14 +154,19 @@ struct head : head_base__ {
     // object and will be deleted shortly after.
     LREMOVED  = 10, // L pool obj removed.
 
+    // Regular object in a page of Mpool.
+    MOBJ      = 11, // regular obj in M pool
+
+    // Free slot in a page of Mpool. The first word of the object area
+    // links it to the next free slot of the page.
+    MFREE     = 12, // M pool slot is free.
+
     // mask to get the various gctypes above.
     POOLMASK  = 0x0f,
 
-    // This bit is usually 0, except when in the middle of gc_walk.
-    // We set it upon first visit by gc_walk and then if set
-    // we know we have done this object already and will merely update
-    // the pointer that got us here.
-    GCBIT = 0x80, // set this flag to detect circular pointers.
+    // 0x80 is unused. gc marks are kept in a bitmap of the minipool
+    // (in Lpool for large objects) so gc_walk doesn't write to the
+    // heads, see visited() below.
 
     // This bit is set if the object has moved.
     MOVED = 0x40,
@@ -167,6 +176,14 @@ struct head : head_base__ {
 
     // This bit is set if the object has been inserted into free list (Fpool).
     FREE = 0x10, // object is in free list (Fpool).
+
+    // This bit is set if gc need not call the destructor when the
+    // object is unreachable. It follows the object when it moves.
+    NOFINAL = 0x100,
+
+    // This bit is set on a free Fpool block whose pages have been
+    // given back to the system, see Fpool::release_().
+    RELEASED = 0x200,
   };
 
   // return values form varios in_.... functions:
@@ -181,7 +198,7 @@ struct head : head_base__ {
   head * BAD_BLOCK = reinterpret_cast<head *>(0x123);
 
   // GCOBJ start at 1 and we want an extra 0 at end so +2.
-  static const char * S_gctypes[LREMOVED + 2];
+  static const char * S_gctypes[MFREE + 2];
 
   enum { HEADSZ = head_base__::HEADSZ__ };
   enum { MINBLKSZ = head_base::asz(sizeof(Fremoved)) };
@@ -197,16 +214,24 @@ struct head : head_base__ {
   bool check(minipool * real_mp, int gctype) const;
 
   int gctype() const { return flags & POOLMASK; }
-  bool visited() const { return (flags & GCBIT) != 0; }
 
-  bool set_visited()
-  { bool v = (flags & GCBIT) != 0; flags |= GCBIT; return v; } 
+  // gc mark, set upon first visit by gc_walk so later visits only
+  // update the pointer that got us there. Large objects have no
+  // minipool, their marks are in the Lpool of the current heap.
+  // Marks are never cleared one by one, each walk starts a new epoch
+  // in which no object is marked, see Lpool::start_walk_().
+  bool visited() const
+  { return mp ? mp->marked(this) : lmarked_(); }
 
-  bool unvisit()
-  { bool v = (flags & GCBIT) != 0; flags &= ~GCBIT; return v; }
+  // set the mark, return the old one.
+  bool set_visited()
+  { return mp ? mp->mark(this) : lmark_(); }
 
   bool not_visited() const
-  { return (flags & GCBIT) == 0; }
+  { return ! visited(); }
+
+  bool lmarked_() const;
+  bool lmark_() const;
 
   bool has_moved() const { return (flags & MOVED) != 0; }
   bool is_removed() const { return (flags & REMOVED) != 0; }
@@ -0,0 +1,63 @@
+#ifndef __GC_PRIV_HEAP_HXX__
+#define __GC_PRIV_HEAP_HXX__
+
+#include <cstdlib>
+
+#include "../gc.hxx"
+#include "gcstat.hxx"
+#include "limiter.hxx"
+#include "phaselog.hxx"
+#include "gcpool.hxx"
+#include "fpool.hxx"
+#include "lpool.hxx"
+#include "ptrpool.hxx"
+#include "fptrpool.hxx"
+#include "wptrpool.hxx"
+#include "sampler.hxx"
+#include "finalizer.hxx"
+#include "scanner.hxx"
+
+namespace alf {
+
+namespace gc {
+
+// heap_impl is what a gc::heap owns: the pools, the registries, the
+// statistics and the settings. Members are constructed in this order
+// and destroyed in reverse, just as when they were globals.
+struct heap_impl {
+
+  statistics S;
+  Limiter limiter;
+  PhaseLog phases;
+  Scanner scanner;
+  GCpool gc_pool;
+  Fpool f_pool;
+  Lpool large_pool;
+  PtrPool ptr_pool;
+  FPtrPool fptr_pool;
+  WPtrPool wptr_pool;
+  Sampler sampler;
+  Finalizer finalizer;
+
+  std::size_t large_sz; // large_size().
+  std::size_t medium_sz; // medium_size().
+
+  heap * owner; // the gc::heap for this one.
+
+  heap_impl(std::size_t gsz, std::size_t fsz)
+    : limiter(S), phases(S), gc_pool(S, limiter, phases, scanner, gsz),
+      f_pool(S, limiter, fsz), large_pool(S, limiter),
+      finalizer(S, ptr_pool, wptr_pool, fptr_pool),
+      large_sz(128*1024), // 128K is large by default.
+      medium_sz(8*1024), // 8K up to large_sz is medium.
+      owner(0)
+  { }
+
+}; // end of struct heap_impl
+
+}; // end of namespace gc
+
+}; // end of namespace alf
+
+
+#endif
@@ -0,0 +1,331 @@
+
+#include <sys/mman.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "../gc.hxx"
+
+#include "head.hxx"
+#include "tail.hxx"
+#include "minipool.hxx"
+#include "tracer.hxx"
+#include "image.hxx"
+
+const char alf::gc::image_header::MAGIC[8] =
+  { 'G', 'C', 'I', 'M', 'A', 'G', 'E', '\0' };
+
+////////////////////////
+// image_types
+
+// static
+std::unordered_map<std::string, alf::gc::image_types::entry> &
+alf::gc::image_types::map_()
+{
+  // types are often registered by static initializers.
+  static std::unordered_map<std::string, entry> M;
+  return M;
+}
+
+// static
+void alf::gc::image_types::add(const std::type_info & t, image_ctor_ ctor,
+			       const field_map * fm)
+{
+  entry e = { ctor, fm };
+  map_()[t.name()] = e;
+}
+
+// static
+const alf::gc::image_types::entry *
+alf::gc::image_types::find(const std::string & name)
+{
+  auto p = map_().find(name);
+  return p == map_().end() ? 0 : & p->second;
+}
+
+////////////////////////
+// image_writer
+
+alf::gc::image_writer::image_writer()
+  : in_obj_(false), in_root_(false)
+{ }
+
+alf::gc::image_writer::~image_writer()
+{ }
+
+std::uint32_t alf::gc::image_writer::type_id_(gcobj * obj)
+{
+  const std::type_info * t = & typeid(*obj);
+  auto p = types_.find(t);
+  if (p != types_.end())
+    return p->second;
+
+  if (image_types::find(t->name()) == 0)
+    throw gc_error(std::string("save_image: type ") + t->name() +
+		   " is not registered with image_type()");
+  std::uint32_t id = tnames_.size();
+  types_.emplace(t, id);
+  tnames_.push_back(t->name());
+  return id;
+}
+
+alf::gc::gcobj *
+alf::gc::image_writer::walk(const std::string & txt, gcobj * ptr)
+{
+  head * h = live_head(ptr);
+
+  if (h == 0) return ptr;
+
+  if (! in_obj_ && ! in_root_)
+    roots_.emplace_back(txt, ptr);
+
+  if (h->set_visited())
+    return ptr;
+
+  otype_.push_back(type_id_(ptr));
+  objs_.push_back(ptr);
+
+  bool save = in_obj_;
+  in_obj_ = true;
+  ptr->gc_walker(txt);
+  in_obj_ = save;
+  return ptr;
+}
+
+void alf::gc::image_writer::root(const std::string & txt, gcobj * ptr)
+{
+  in_root_ = true;
+  walk(txt, ptr);
+  in_root_ = false;
+}
+
+void alf::gc::image_writer::write(std::FILE * f, const std::string & fname)
+{
+  std::unordered_map<gcobj *, std::uint64_t> off;
+  std::uint64_t size = 0;
+  std::size_t k;
+
+  // objects go in the order we found them.
+  for (k = 0; k < objs_.size(); ++k) {
+    head * h = head::get_head(objs_[k]);
+    off.emplace(objs_[k], size + sizeof(head));
+    size += image_header::block_size(h->usz);
+  }
+
+  // first root with a label wins.
+  std::vector<std::pair<std::string, std::uint64_t> > roots;
+  {
+    std::unordered_map<std::string, bool> seen;
+    for (auto & r : roots_)
+      if (seen.emplace(r.first, true).second)
+	roots.emplace_back(r.first, off[r.second]);
+  }
+
+  image_header hd;
+  std::memset(& hd, 0, sizeof(hd));
+  std::memcpy(hd.magic, image_header::MAGIC, sizeof(hd.magic));
+  hd.version = VERSION;
+  hd.psz = sizeof(void *);
+  hd.ntypes = tnames_.size();
+  hd.nroots = roots.size();
+  hd.nobjs = objs_.size();
+  hd.size = size;
+
+  std::string tab;
+  for (const char * n : tnames_) {
+    std::uint32_t len = std::strlen(n);
+    tab.append(reinterpret_cast<const char *>(& len), sizeof(len));
+    tab.append(n, len);
+  }
+  for (auto & r : roots) {
+    std::uint32_t len = r.first.size();
+    tab.append(reinterpret_cast<const char *>(& len), sizeof(len));
+    tab.append(r.first);
+    tab.append(reinterpret_cast<const char *>(& r.second), sizeof(r.second));
+  }
+  hd.off = (sizeof(hd) + tab.size() + (ALIGN - 1)) & -std::uint64_t(ALIGN);
+  tab.resize(hd.off - sizeof(hd), '\0');
+
+  bool ok = std::fwrite(& hd, sizeof(hd), 1, f) == 1 &&
+    std::fwrite(tab.data(), 1, tab.size(), f) == tab.size();
+
+  // each block is built in buf, the copy of the object gets its
+  // pointers turned into offsets by its own gc_walker.
+  std::vector<char> buf;
+  image_reloc reloc(off);
+  image_reloc::guard g(& reloc);
+
+  for (k = 0; ok && k < objs_.size(); ++k) {
+    gcobj * obj = objs_[k];
+    head * h = head::get_head(obj);
+    std::size_t bsz = image_header::block_size(h->usz);
+
+    if (buf.size() < bsz)
+      buf.resize(bsz);
+    head * nh = reinterpret_cast<head *>(buf.data());
+    nh->b_init(0, head::FROZEN | (h->flags & head::NOFINAL), bsz, h->usz);
+    nh->fcnt = 1;
+    // the bytes as they are, gc_walker below turns pointers into offsets.
+    std::memcpy(reinterpret_cast<char *>(nh->obj()),
+		reinterpret_cast<const char *>(obj), h->usz);
+    nh->obj()->gc_walker("image");
+    nh->vp = reinterpret_cast<void *>(off[obj]);
+    // the loader puts the vtable back.
+    *reinterpret_cast<std::uintptr_t *>(nh + 1) = otype_[k];
+    ok = std::fwrite(nh, 1, bsz, f) == bsz;
+  }
+  if (! ok)
+    throw gc_error("save_image: error writing " + fname);
+}
+
+////////////////////////
+// image_reloc
+
+alf::gc::image_reloc::~image_reloc()
+{ }
+
+alf::gc::gcobj *
+alf::gc::image_reloc::walk(const std::string &, gcobj * ptr)
+{
+  if (off_) {
+    // every object reachable from a saved one is saved.
+    live_head(ptr);
+    auto p = off_->find(ptr);
+    return p == off_->end() ? 0 : reinterpret_cast<gcobj *>(p->second);
+  }
+
+  std::uintptr_t x = reinterpret_cast<std::uintptr_t>(ptr);
+  if (x < sizeof(head) || x >= size_) {
+    bad_ = true;
+    return 0;
+  }
+  return reinterpret_cast<gcobj *>(base_ + x);
+}
+
+////////////////////////
+// image_reader
+
+alf::gc::image_reader::image_reader(const std::string & fname)
+  : fname_(fname), nobjs_(0), base_(0), size_(0), owner_(false)
+{
+  std::FILE * f = std::fopen(fname.c_str(), "rb");
+  if (f == 0)
+    throw gc_error("load_image: cannot open " + fname);
+
+  // read everything but the blocks.
+  struct closer {
+    std::FILE * f;
+    ~closer() { std::fclose(f); }
+  } c = { f };
+
+  image_header hd;
+  if (std::fread(& hd, sizeof(hd), 1, f) != 1 ||
+      std::memcmp(hd.magic, image_header::MAGIC, sizeof(hd.magic)) != 0)
+    fail_("not an image");
+  if (hd.version != image_writer::VERSION || hd.psz != sizeof(void *))
+    fail_("unsupported version");
+
+  std::uint64_t k;
+  std::uint32_t len;
+  std::string s;
+  for (k = 0; k < hd.ntypes; ++k) {
+    if (std::fread(& len, sizeof(len), 1, f) != 1)
+      fail_("truncated");
+    s.assign(len, '\0');
+    if (len && std::fread(& s[0], 1, len, f) != len)
+      fail_("truncated");
+    const image_types::entry * e = image_types::find(s);
+    if (e == 0)
+      fail_("type " + s + " is not registered with image_type()");
+    types_.push_back(e);
+  }
+  for (k = 0; k < hd.nroots; ++k) {
+    std::uint64_t obj;
+    if (std::fread(& len, sizeof(len), 1, f) != 1)
+      fail_("truncated");
+    s.assign(len, '\0');
+    if ((len && std::fread(& s[0], 1, len, f) != len) ||
+	std::fread(& obj, sizeof(obj), 1, f) != 1)
+      fail_("truncated");
+    if (obj < sizeof(head) || obj >= hd.size)
+      fail_("corrupt root " + s);
+    roots_.emplace_back(s, obj);
+  }
+  nobjs_ = hd.nobjs;
+
+  // the blocks are private to us, changes never reach the file.
+  if (hd.size) {
+    void * p = ::mmap(0, hd.size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		      fileno(f), hd.off);
+    if (p == MAP_FAILED)
+      fail_(std::strerror(errno));
+    base_ = reinterpret_cast<char *>(p);
+    size_ = hd.size;
+    owner_ = true;
+  }
+}
+
+alf::gc::image_reader::~image_reader()
+{
+  if (owner_) ::munmap(base_, size_);
+}
+
+void alf::gc::image_reader::fail_(const std::string & why)
+{
+  throw gc_error("load_image: " + fname_ + ": " + why);
+}
+
+alf::gc::minipool * alf::gc::image_reader::release(statistics & S)
+{
+  if (base_ == 0) return 0;
+
+  minipool * mp = new minipool(S, base_, size_);
+  std::size_t pos = 0, n = 0;
+  image_reloc reloc(base_, size_);
+
+  try {
+    image_reloc::guard g(& reloc);
+
+    while (pos < size_) {
+      head * h = reinterpret_cast<head *>(base_ + pos);
+      if (size_ - pos < sizeof(head) + sizeof(tail) ||
+	  h->magic != head::MAGIC || h->gctype() != head::FROZEN ||
+	  h->sz < image_header::block_size(0) || h->sz > size_ - pos ||
+	  h->sz != image_header::block_size(h->usz) ||
+	  reinterpret_cast<std::uintptr_t>(h->vp) != pos + sizeof(head))
+	fail_("corrupt block");
+      std::uintptr_t t = *reinterpret_cast<std::uintptr_t *>(h + 1);
+      if (t >= types_.size())
+	fail_("corrupt block");
+
+      gcobj * obj = h->obj();
+      h->vp = obj;
+      h->mp = mp;
+      h->fmap = types_[t]->fmap;
+      types_[t]->ctor(obj);
+      obj->gc_walker("image");
+      if (reloc.bad())
+	fail_("corrupt pointer");
+      pos += h->sz;
+      ++n;
+    }
+    if (n != nobjs_)
+      fail_("corrupt block");
+  } catch (...) {
+    delete mp;
+    throw;
+  }
+
+  // all of it is in use.
+  mp->usz_ = size_;
+  pos = 0;
+  while (pos < size_) {
+    head * h = reinterpret_cast<head *>(base_ + pos);
+    S.alloc(h->sz, h->usz);
+    S.freeze(h->sz, h->usz);
+    pos += h->sz;
+  }
+  owner_ = false;
+  return mp;
+}
@@ -0,0 +1,187 @@
+#ifndef __GC_PRIV_IMAGE_HXX__
+#define __GC_PRIV_IMAGE_HXX__
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../gc.hxx"
+#include "head.hxx"
+#include "minipool.hxx"
+#include "tracer.hxx"
+#include "gcstat.hxx"
+
+namespace alf {
+
+namespace gc {
+
+// types that may be in an image, see image_type() in gc.hxx.
+class image_types {
+public:
+
+  struct entry {
+    image_ctor_ ctor; // sets the vtable of a loaded object.
+    const field_map * fmap;
+  };
+
+  static void add(const std::type_info & t, image_ctor_ ctor,
+		  const field_map * fm);
+
+  // 0 if name isn't registered.
+  static const entry * find(const std::string & name);
+
+private:
+
+  static std::unordered_map<std::string, entry> & map_();
+
+}; // end of class image_types
+
+// An image holds every reachable object as a block just as in Fpool,
+// head, object and tail, one after the other. A pointer in the image
+// is the offset of the object from the start of the blocks and the
+// vtable pointer of each object is replaced by its type number.
+//
+// File format, all integers in native byte order:
+//
+//   header: "GCIMAGE\0" u32 version u32 sizeof(void *)
+//           u64 types u64 roots u64 objects u64 offset u64 size
+//   types:  u32 len name                   - mangled type name.
+//   roots:  u32 len label u64 obj          - root pointer to obj.
+//   blocks: size bytes at offset, offset is a multiple of ALIGN.
+struct image_header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t psz;
+  std::uint64_t ntypes;
+  std::uint64_t nroots;
+  std::uint64_t nobjs;
+  std::uint64_t off;
+  std::uint64_t size;
+
+  static const char MAGIC[8];
+
+  // size of the block for an object of usz bytes.
+  static std::size_t block_size(std::size_t usz)
+  { return sizeof(head) + head::asz(usz) + sizeof(tail); }
+
+}; // end of struct image_header
+
+// image_writer is a tracer that collects the reachable objects and
+// writes them when the trace is done.
+class image_writer : public tracer {
+public:
+
+  enum { VERSION = 1, ALIGN = 65536 };
+
+  image_writer();
+  virtual ~image_writer();
+
+  virtual gcobj * walk(const std::string & txt, gcobj * ptr);
+
+  // frozen objects are not roots in the image.
+  virtual void root(const std::string & txt, gcobj * ptr);
+
+  // write the image, throw gc_error if we can't.
+  void write(std::FILE * f, const std::string & fname);
+
+  std::size_t objects() const { return objs_.size(); }
+
+private:
+
+  std::vector<gcobj *> objs_;
+  std::vector<std::uint32_t> otype_;
+  std::vector<std::pair<std::string, gcobj *> > roots_;
+  std::unordered_map<const std::type_info *, std::uint32_t> types_;
+  std::vector<const char *> tnames_;
+  bool in_obj_; // walking the pointers of an object, not a root.
+  bool in_root_; // walking a frozen object.
+
+  std::uint32_t type_id_(gcobj * obj);
+
+}; // end of class image_writer
+
+// image_reloc maps each pointer gc_walker hands it, from the heap to
+// offsets in an image when saving or from offsets to the mapped image
+// when loading.
+class image_reloc : public tracer {
+public:
+
+  // save.
+  image_reloc(const std::unordered_map<gcobj *, std::uint64_t> & off)
+    : off_(& off), base_(0), size_(0), bad_(false)
+  { }
+
+  // load.
+  image_reloc(char * base, std::size_t size)
+    : off_(0), base_(base), size_(size), bad_(false)
+  { }
+
+  virtual ~image_reloc();
+
+  virtual gcobj * walk(const std::string & txt, gcobj * ptr);
+
+  // makes r the active tracer while in scope.
+  struct guard {
+    guard(image_reloc * r) { tracer::active = r; }
+    ~guard() { tracer::active = 0; }
+  }; // end of struct guard
+
+  // a pointer outside the image was found while loading.
+  bool bad() const { return bad_; }
+
+private:
+
+  const std::unordered_map<gcobj *, std::uint64_t> * off_;
+  char * base_;
+  std::size_t size_;
+  bool bad_;
+
+}; // end of class image_reloc
+
+// image_reader maps an image and turns its blocks into frozen objects.
+class image_reader {
+public:
+
+  // open fname, read the tables and map the blocks, throw gc_error
+  // if the file isn't an image for this program.
+  image_reader(const std::string & fname);
+
+  // unmaps the blocks unless release() was called.
+  ~image_reader();
+
+  // set up heads, vtables and pointers. Return a minipool holding the
+  // blocks, the reader no longer owns them.
+  minipool * release(statistics & S);
+
+  const std::vector<std::pair<std::string, std::uint64_t> > & roots() const
+  { return roots_; }
+
+  char * base() const { return base_; }
+  std::size_t objects() const { return nobjs_; }
+
+private:
+
+  std::string fname_;
+  std::vector<const image_types::entry *> types_;
+  std::vector<std::pair<std::string, std::uint64_t> > roots_;
+  std::size_t nobjs_;
+  char * base_;
+  std::size_t size_;
+  bool owner_; // unmap base_ when done.
+
+  void fail_(const std::string & why);
+
+}; // end of class image_reader
+
+}; // end of namespace gc
+
+}; // end of namespace alf
+
+
+#endif
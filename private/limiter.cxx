@@ -0,0 +1,87 @@
+
+#include <string>
+
+#include "../gc.hxx"
+
+#include "limiter.hxx"
+
+std::size_t alf::gc::Limiter::set_limit(std::size_t lim)
+{
+  std::size_t old = S_.heap_lim;
+
+  S_.heap_lim = lim;
+  // thresholds moved, let each callback fire again.
+  for (entry & e : E_)
+    e.fired = false;
+  return old;
+}
+
+void alf::gc::Limiter::add(unsigned int pct, heap_callback fn, void * data)
+{
+  if (fn == 0 || pct == 0 || pct > 100)
+    throw gc_error("add_heap_callback: invalid threshold or callback");
+  entry e = { pct, fn, data, false };
+  E_.push_back(e);
+}
+
+void alf::gc::Limiter::remove(heap_callback fn, void * data)
+{
+  std::size_t k = 0, j = 0;
+
+  for (; k < E_.size(); ++k)
+    if (E_[k].fn != fn || E_[k].data != data)
+      E_[j++] = E_[k];
+  E_.resize(j);
+}
+
+bool alf::gc::Limiter::room(std::size_t inc)
+{
+  std::size_t lim = S_.heap_lim;
+
+  if (lim == 0) return true;
+
+  if (! S_.in_gc) {
+    std::size_t after = S_.heap + inc;
+    std::size_t k = 0;
+
+    // a callback may add or remove callbacks, don't hold on to e.
+    for (; k < E_.size(); ++k) {
+      entry & e = E_[k];
+      if (after < lim/100*e.pct) {
+	e.fired = false;
+	continue;
+      }
+      if (e.fired) continue;
+      e.fired = true;
+      heap_callback fn = e.fn;
+      void * data = e.data;
+      ++S_.n_hcb;
+      fn(S_.heap, lim, data);
+    }
+  }
+  // callbacks may have deleted large objects.
+  return S_.heap + inc <= lim;
+}
+
+bool alf::gc::Limiter::emergency()
+{
+  if (S_.in_gc) return false;
+  ++S_.n_emerg;
+  gc::gc();
+  return true;
+}
+
+void alf::gc::Limiter::reserve(std::size_t inc)
+{
+  if (room(inc)) return;
+  if (emergency() && room(inc)) return;
+  fail(inc);
+}
+
+void alf::gc::Limiter::fail(std::size_t inc)
+{
+  ++S_.n_lfail;
+  throw gc_allocation_error("heap limit of " + std::to_string(S_.heap_lim) +
+			    " bytes reached, " + std::to_string(S_.heap) +
+			    " in use and " + std::to_string(inc) + " more needed");
+}
@@ -0,0 +1,65 @@
+#ifndef __GC_PRIV_LIMITER_HXX__
+#define __GC_PRIV_LIMITER_HXX__
+
+#include <cstdlib>
+
+#include <vector>
+
+#include "../gc.hxx"
+#include "gcstat.hxx"
+
+namespace alf {
+
+namespace gc {
+
+// Limiter keeps the heap within set_heap_limit(). The pools count what
+// they hold in statistics (heap) and ask room() before they grow. The
+// limit itself is kept in statistics too so report() can show it.
+class Limiter {
+public:
+
+  Limiter(statistics & S) : S_(S) { }
+
+  std::size_t limit() const { return S_.heap_lim; }
+
+  // set new limit, 0 is none. Return old limit.
+  std::size_t set_limit(std::size_t lim);
+
+  void add(unsigned int pct, heap_callback fn, void * data);
+  void remove(heap_callback fn, void * data);
+
+  // may the heap grow by inc bytes? Callbacks whose threshold the heap
+  // would reach are called first, except in gc.
+  bool room(std::size_t inc);
+
+  // one emergency gc, false if we are in gc and can't do one.
+  bool emergency();
+
+  // room() or else room() after one emergency gc, throw
+  // gc_allocation_error if there still isn't room. Only called
+  // where a gc may run.
+  void reserve(std::size_t inc);
+
+  // count the failure and throw gc_allocation_error.
+  [[noreturn]] void fail(std::size_t inc);
+
+private:
+
+  struct entry {
+    unsigned int pct;
+    heap_callback fn;
+    void * data;
+    bool fired; // called since the heap was last below pct.
+  }; // end of struct entry
+
+  statistics & S_;
+  std::vector<entry> E_;
+
+}; // end of class Limiter
+
+}; // end of namespace gc
+
+}; // end of namespace alf
+
+
+#endif
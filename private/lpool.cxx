@@ -6,6 +6,9 @@
 #include "head.hxx"
 #include "pool.hxx"
 #include "lpool.hxx"
+#include "tracer.hxx"
+#include "finalizer.hxx"
+#include "limiter.hxx"
 
 // Lpool is a pool used to manage objects that are too large
 // to be stored and moved around in GCpool.
@@ -33,7 +36,9 @@ alf::gc::head * alf::gc::Lpool::alloc_(size_t usz, void * & ptr)
 {
   std::size_t asz =  head::asz(usz);
   std::size_t sz = asz + (sizeof(head) + sizeof(tail));
+  lim_.reserve(sz);
   char * p = new char[sz];
+  S_.grow(sz);
   head * h = reinterpret_cast<head *>(p);
   char * op = p + sizeof(head);
   char * oe = op + usz;
@@ -76,6 +81,8 @@ void alf::gc::Lpool::gc_walk()
 {
   std::size_t k = 0;
 
+  M_.gc_walk();
+
   while (k < n_) {
 
     gcobj * obj = L_[k++];
@@ -90,8 +97,12 @@ void alf::gc::Lpool::gc_walk()
       
       // have we seen this obj?
       if (h->fcnt == 0) continue; // not frozen, skip it.
-      if (h->flags & head::GCBIT) continue; // already seen it, skip it.
-      h->flags |= head::GCBIT; // mark it as seen.
+      if (tracer::active) {
+	// diagnostic trace, let tracer do the marking.
+	tracer::active->root("Frozen obj", obj);
+	continue;
+      }
+      if (mark(h)) continue; // already seen it, skip it.
       obj->gc_walker("Frozen obj");
 
       /* FALLTHRU */
@@ -104,28 +115,13 @@ void alf::gc::Lpool::gc_walk()
   }
 }
 
-// walk through Lpool and walk any frozen objs.
-void alf::gc::Lpool::gcbit_off()
-{
-  std::size_t k = 0;
-
-  while (k < n_) {
-
-    gcobj * obj = L_[k++];
-    head * h = head::get_head(obj);
-
-    if (h == 0)
-      throw fatal_error("Lpool has corrupt HEAD");
-
-    h->flags &= ~head::GCBIT;
-  }
-}
-
 // garbage collect Lpool objs.
-void alf::gc::Lpool::gc_cleanup()
+void alf::gc::Lpool::gc_cleanup(Finalizer & fz)
 {
   std::size_t k = n_;
 
+  M_.gc_cleanup(fz);
+
   while (k) {
 
     gcobj * obj = L_[--k];
@@ -138,13 +134,24 @@ void alf::gc::Lpool::gc_cleanup()
       throw fatal_error("Lpool corrupt, obj flags is " + h->gcflags_str());
 
     // have we seen this obj?
-    if (h->fcnt || (h->flags & head::GCBIT) != 0) {
-      // turn off GCBIT.
-      h->flags &= ~head::GCBIT;
+    if (h->fcnt || marked(h))
+      continue;
+
+    if (fz.deferred() && (h->flags & head::NOFINAL) == 0) {
+      // finalizer destroys the obj and releases the block,
+      // forget it here so gc_cleanup2 doesn't see it.
+      h->flags = head::REMOVED | head::LREMOVED;
+      h->p = 0;
+      S_.dealloc(h->sz, h->usz);
+      if (k < --n_)
+	L_[k] = L_[n_];
+      L_[n_] = 0;
+      fz.defer_large(h, obj);
       continue;
     }
 
-    obj->~gcobj(); // destroy the obj.
+    if ((h->flags & head::NOFINAL) == 0)
+      obj->~gcobj(); // destroy the obj.
     // do not actually delete it yet
     // we just mark it as removed for now so that wptr_pool
     // can access it.
@@ -163,6 +170,8 @@ void alf::gc::Lpool::gc_cleanup2()
 {
   std::size_t k = n_;
 
+  M_.gc_cleanup2();
+
   while (k) {
 
     gcobj * obj = L_[--k];
@@ -198,6 +207,7 @@ void alf::gc::Lpool::gc_cleanup2()
 // remove all Lpool objs.
 void alf::gc::Lpool::cleanup()
 {
+  M_.cleanup();
   while (n_) {
 
     gcobj * obj = L_[--n_];
@@ -216,8 +226,11 @@ void alf::gc::Lpool::cleanup()
       obj->~gcobj();
       destroy_(h);
       S_.dealloc(bsz, usz);
+      continue;
 
     case head::LREMOVED:
+      // destructor already called by gc_cleanup.
+      destroy_(h);
       continue;
 
     default:
@@ -238,12 +251,15 @@ ssize_t alf::gc::Lpool::find(void * p) const
 
 void alf::gc::Lpool::destroy_(head * h)
 {
-  if (h->gctype() != head::LOBJ)
+  // gc_cleanup() marks dead objects LREMOVED before we get here.
+  int m = h->gctype();
+  if (m != head::LOBJ && m != head::LREMOVED)
     throw fatal_error("Expected LOBJ here - not " + h->gcflags_str());
 
   // destructor for gcobj is assumed to have been called already.
-  if (! h->check(0, head::LOBJ))
+  if (! h->check(0, m))
     throw fatal_error("Lpool corrupted.");
+  S_.shrink(h->sz);
   delete [] reinterpret_cast<char *>(h);
 }
 
@@ -251,6 +267,10 @@ alf::gc::head *
 alf::gc::Lpool::get_block_head(const void * p)
 {
   std::size_t k = n_;
+  head * mh = M_.get_block_head(p);
+
+  if (mh)
+    return mh;
 
   while (k) {
 
@@ -280,6 +300,10 @@ alf::gc::head *
 alf::gc::Lpool::get_block_head(const void * p, const void * q)
 {
   std::size_t k = n_;
+  head * mh = M_.get_block_head(p, q);
+
+  if (mh)
+    return mh;
 
   while (k) {
 
@@ -5,6 +5,7 @@
 
 #include <list>
 #include <string>
+#include <unordered_set>
 
 #include "../gc.hxx"
 #include "moved.hxx"
@@ -15,12 +16,16 @@
 #include "minipool.hxx"
 #include "pool.hxx"
 #include "gcpool.hxx"
+#include "mpool.hxx"
 #include "gcstat.hxx"
 
 namespace alf {
 
 namespace gc {
 
+class Finalizer;
+class Limiter;
+
 // Lpool is a pool used to manage objects that are too large
 // to be stored and moved around in GCpool.
 // These objects are never moved once allocated.
@@ -30,15 +35,28 @@ namespace gc {
 // they are not kept in a memory area managed by the pool.
 // instead the pool only keep track of where these objects are and identify
 // them properly.
+// Medium objects are in M_, see mpool.hxx, the gc functions below
+// handle those as well.
 class Lpool : public pool {
 public:
 
   statistics & S_;
+  Limiter & lim_;
   gcobj ** L_;
   std::size_t n_;
   std::size_t m_;
-
-  Lpool(statistics & S) : pool(0), S_(S), L_(0), n_(0), m_(0) { }
+  Mpool M_;
+
+  // gc marks of large objects, see head::visited(). There are few of
+  // them so a set will do. Like minipool::marks_ only valid in
+  // marks_epoch_.
+  std::unordered_set<const head *> marks_;
+  std::size_t marks_epoch_;
+
+  Lpool(statistics & S, Limiter & L)
+    : pool(0), S_(S), lim_(L), L_(0), n_(0), m_(0), M_(S, L),
+      marks_epoch_(0)
+  { }
   ~Lpool() { cleanup(); delete [] L_; }
 
   Lpool & enlarge();
@@ -46,9 +64,30 @@ public:
   head * alloc_(size_t usz, void * & ptr);
   bool dealloc_(head * h, void * p);
 
+  // called before each walk that marks objects. Medium pages left
+  // unswept by the last gc need its marks, they are swept first.
+  // Then a new epoch makes every object in the heap unmarked.
+  void start_walk_()
+  {
+    M_.sweep_all_();
+    M_.start_walk_();
+    ++S_.epoch;
+  }
+
+  bool marked(const head * h) const
+  { return marks_epoch_ == S_.epoch && marks_.count(h) != 0; }
+
+  bool mark(const head * h)
+  {
+    if (marks_epoch_ != S_.epoch) {
+      marks_.clear();
+      marks_epoch_ = S_.epoch;
+    }
+    return ! marks_.insert(h).second;
+  }
+
   void gc_walk(); // walk through all frozen large objs.
-  void gc_cleanup(); // garbage collect Lpool objs.
-  void gcbit_off();
+  void gc_cleanup(Finalizer & fz); // garbage collect Lpool objs.
 
   // since gc_cleanup doesn't actually delete the objects
   // we do that here.
@@ -5,16 +5,22 @@
 
 #include "minipool.hxx"
 #include "head.hxx"
+#include "tracer.hxx"
 
 alf::gc::minipool & alf::gc::minipool::resize(size_t newsz)
 {
   if (usz_ == 0) {
     // if called from Fpool make sure all objs are removed from free list
     // before we call resize().
-    if (del_) delete [] p_;
+    if (del_) {
+      delete [] p_;
+      S_.shrink(sz_);
+    }
+    drop_marks_();
     p_ = new char[newsz];
     sz_ = newsz;
     del_ = true;
+    S_.grow(newsz);
   }
   return *this;
 }
@@ -47,9 +53,19 @@ alf::gc::head * alf::gc::minipool::alloc_(size_t usz, void * & p)
   // prepare head and tail.
   h->b_init(this, head::GCOBJ, tsz, usz);
   p = h->vp;
+  ++n_obj_;
+  sz_obj_ += tsz;
+  usz_obj_ += usz;
   return h;
 }
 
+void alf::gc::minipool::obj_gone(const head * h)
+{
+  --n_obj_;
+  sz_obj_ -= h->sz;
+  usz_obj_ -= h->usz;
+}
+
 void alf::gc::minipool::dealloc_(head * h, void * p)
 {
   if (p != 0 && h != 0) {
@@ -77,10 +93,12 @@ void alf::gc::minipool::fpool_gc_walk()
     switch (h->gctype()) {
     case head::FROZEN:
 
-      if ((h->flags & head::GCBIT) == 0) {
+      if (tracer::active)
+	// diagnostic trace, let tracer do the marking.
+	tracer::active->root("Frozen obj", h->obj());
+      else if (! mark(h)) {
 	// gc_walk this object.
 
-	h->flags |= head::GCBIT; // mark we are visiting.
 	gcobj * obj = h->obj();
 	obj->gc_walker("Frozen obj");
       }
@@ -105,8 +123,7 @@ void alf::gc::minipool::fpool_gc_walk()
   }
 }
 
-// walk through elements in this minipool and turn off head::GCBIT.
-void alf::gc::minipool::gcbit_off()
+void alf::gc::minipool::arena_gc_walk()
 {
   void * ep = reinterpret_cast<void *>(p_ + usz_);
   head * h = reinterpret_cast<head *>(p_);
@@ -117,61 +134,51 @@ void alf::gc::minipool::gcbit_off()
     if (nexth > ep || h->magic != head::MAGIC)
       throw fatal_error("Corrupt minipool");
 
-    h->flags &= ~head::GCBIT; // turn off gcbit.
-    h = nexth;
-  }
-}
-
-void alf::gc::minipool::gc_cleanup()
-{
-  // walk through the buffer and destroy any objects left there.
-  // we also turn off GCBIT whenever it is on.
-
-  const char * bufe = p_ + usz_;
-  char * pp = p_;
-
-  while (pp < bufe) {
-    head * h = reinterpret_cast<head *>(pp);
-    gcobj * obj = reinterpret_cast<gcobj *>(h + 1);
-    std::size_t bsz = h->sz, usz;
-    pp += bsz;
-
     switch (h->gctype()) {
     case head::GCOBJ:
-      // cleanup unreachable object.
-      // TODO: add counters here...
-      usz = h->usz;
-      obj->~gcobj(); // call destructor.
-      new(obj) removed;
-      h->flags = head::REMOVED | head::GCRM;
-      S_.dealloc(bsz, usz);
-      continue;
 
-    case head::GCMOVED:
-      // object has moved, just make sure GCBIT is off.
+      if (tracer::active)
+	tracer::active->root("Arena obj", h->obj());
+      else
+	// stays where it is, see GCpool::move().
+	gc_walk_("Arena obj", h->obj());
+      break;
+
     case head::GCRM:
-      // object already removed, just make sure GCBIT is off.
     case head::GCFROZEN:
-      // object is frozen and moved, just make sure GCBIT is off.
-#if 0
-    case head::FROZEN:
-    case head::UNFROZEN:
-    case head::FREMOVED:
-    case head::FMERGED:
-      // should not cleanup Fpool, anyway, just make sure GCBIT is off.
-    case head::LOBJ:
-    case head::LREMOVED:
-      // should not access Lpool from here but we turn off GCBIT.
-#endif
-      h->flags &= ~head::GCBIT;
-      continue;
+
+      // deleted by user or frozen, skip it.
+      break;
+
     default:
-      // should not get any other values in GCpool
-      throw fatal_error("Invalid object state in gc: ");
+
+      throw fatal_error("Wrong gctype in head");
     }
+    h = nexth;
   }
-  if (pp > bufe)
-    throw fatal_error("Invalid size in gc minipool");
+}
+
+static_assert(alf::gc::head::bsz(0) > 1 << alf::gc::minipool::MARKSHIFT,
+	      "two heads may share a mark bit");
+
+// usz_ may have been larger when the marks were set, clear all of it.
+void alf::gc::minipool::new_marks_()
+{
+  std::size_t n = marks_size_(sz_);
+  if (marks_ == 0)
+    marks_ = new unsigned char[n];
+  std::memset(marks_, 0, n);
+  marks_epoch_ = S_.epoch;
+}
+
+void alf::gc::minipool::discard()
+{
+  // nothing in the pool is looked at, the blocks that are still GCOBJ
+  // are garbage and gc has already finalized those that need it.
+  if (n_obj_)
+    S_.dealloc(n_obj_, sz_obj_, usz_obj_);
+  n_obj_ = 0;
+  sz_obj_ = usz_obj_ = 0;
   usz_ = 0;
 }
 
@@ -181,7 +188,6 @@ void alf::gc::minipool::gc_cleanup()
 void alf::gc::minipool::cleanup()
 {
   // walk through the buffer and destroy any objects left there.
-  // we also turn off GCBIT whenever it is on.
 
   const char * bufe = p_ + usz_;
   char * pp = p_;
@@ -199,6 +205,7 @@ void alf::gc::minipool::cleanup()
       obj->~gcobj(); // call destructor.
       new(obj) removed;
       h->flags = head::REMOVED | head::GCRM;
+      h->p = 0;
       S_.dealloc(bsz, usz);
       continue;
 
@@ -215,21 +222,15 @@ void alf::gc::minipool::cleanup()
       continue;
 
     case head::GCMOVED:
-      // object has moved, just make sure GCBIT is off.
+      // object has moved, nothing to do.
     case head::GCRM:
-      // object already removed, just make sure GCBIT is off.
+      // object already removed.
     case head::GCFROZEN:
-      // object is frozen and moved, just make sure GCBIT is off.
+      // object is frozen and moved.
     case head::UNFROZEN:
-      // Object has moved back to gcpool, turn off GCBIT.
+      // Object has moved back to gcpool.
     case head::FREMOVED:
     case head::FMERGED:
-#if 0
-    case head::LOBJ:
-    case head::LREMOVED:
-      // should not access Lpool from here but we turn off GCBIT.
-#endif
-      h->flags &= ~head::GCBIT;
       continue;
 
     default:
@@ -240,6 +241,8 @@ void alf::gc::minipool::cleanup()
   if (pp > bufe)
     throw fatal_error("Invalid size in minipool");
   usz_ = 0;
+  n_obj_ = 0;
+  sz_obj_ = usz_obj_ = 0;
 }
 
 // if pointer is found in this minipool, return that block.
@@ -36,41 +36,70 @@ struct minipool {
   statistics & S_;
   bool del_; // delete p_ when no longer needed. (we own the pool).
 
+  // GCOBJ blocks in the pool that are neither moved, frozen nor
+  // removed by user, i.e. live or garbage. Only kept for GCpool.
+  int n_obj_;
+  std::size_t sz_obj_;
+  std::size_t usz_obj_;
+
+  // gc mark bits, one for every 1 << MARKSHIFT bytes of p_. Blocks are
+  // larger than that so no two heads share a bit. Kept aside from the
+  // heads so marking doesn't write to the pool memory. Allocated on
+  // first mark. The bits are only valid while marks_epoch_ is the
+  // current S_.epoch, the first mark of a later walk clears them.
+  enum { MARKSHIFT = 6 };
+
+  unsigned char * marks_;
+  std::size_t marks_epoch_;
+
   // do not allocate space for pool yet.
   minipool(statistics & S)
-    : magic_(MAGIC), sz_(0), usz_(0), p_(0), S_(S), del_(false)
+    : magic_(MAGIC), sz_(0), usz_(0), p_(0), S_(S), del_(false),
+      n_obj_(0), sz_obj_(0), usz_obj_(0), marks_(0), marks_epoch_(0)
   { }
 
   // use given pool.
   minipool(statistics & S, char * p, std::size_t sz, bool d = false)
-    : magic_(MAGIC), sz_(sz), usz_(0), p_(p), S_(S), del_(d)
-  { }
+    : magic_(MAGIC), sz_(sz), usz_(0), p_(p), S_(S), del_(d),
+      n_obj_(0), sz_obj_(0), usz_obj_(0), marks_(0), marks_epoch_(0)
+  { if (d) S_.grow(sz); }
 
   // create our own pool
   minipool(statistics & S, std::size_t sz)
-    : magic_(MAGIC), sz_(0), usz_(0), p_(0), S_(S), del_(false)
+    : magic_(MAGIC), sz_(0), usz_(0), p_(0), S_(S), del_(false),
+      n_obj_(0), sz_obj_(0), usz_obj_(0), marks_(0), marks_epoch_(0)
   {
     if (sz) {
       p_ = new char[sz];
       sz_ = sz;
       del_ = true;
+      S_.grow(sz);
     }
   }
 
   // grab a minipool from source.
   minipool(minipool && mp)
     : magic_(MAGIC), sz_(mp.sz_), usz_(mp.usz_),
-      p_(mp.p_), S_(mp.S_), del_(mp.del_)
+      p_(mp.p_), S_(mp.S_), del_(mp.del_),
+      n_obj_(mp.n_obj_), sz_obj_(mp.sz_obj_), usz_obj_(mp.usz_obj_),
+      marks_(mp.marks_), marks_epoch_(mp.marks_epoch_)
   {
     mp.usz_ = mp.sz_ = 0;
+    mp.n_obj_ = 0;
+    mp.sz_obj_ = mp.usz_obj_ = 0;
     mp.p_ = 0;
     mp.del_ = false;
+    mp.marks_ = 0;
   }
 
   ~minipool()
   {
     cleanup();
-    if (del_) delete [] p_;
+    delete [] marks_;
+    if (del_) {
+      delete [] p_;
+      S_.shrink(sz_);
+    }
   }
 
   minipool & use(char * p, std::size_t sz, bool del = false)
@@ -81,9 +110,14 @@ struct minipool {
       // we do not use this from Fpool, if we did we would have to
       // ensure all objects in free list from this pool is removed
       // from free list before we delete p_.
-      if (del_) delete [] p_;
+      if (del_) {
+	delete [] p_;
+	S_.shrink(sz_);
+      }
+      drop_marks_();
       p_ = p; sz_ = sz;
       del_ = del;
+      if (del) S_.grow(sz);
     }
     return *this;
   }
@@ -104,14 +138,39 @@ struct minipool {
   // Fpool gc_walk
   void fpool_gc_walk();
 
-  // gcbit_off
-  void gcbit_off();
+  // gc_walk the objects in an arena chunk, they are all live.
+  void arena_gc_walk();
+
+  // gc mark of the block at h in this epoch, mark() returns the old one.
+  bool marked(const head * h) const
+  {
+    std::size_t k = mark_idx_(h);
+    return marks_epoch_ == S_.epoch && marks_
+      && (marks_[k >> 3] & (1 << (k & 7))) != 0;
+  }
+
+  bool mark(const head * h)
+  {
+    std::size_t k = mark_idx_(h);
+    if (marks_epoch_ != S_.epoch || marks_ == 0)
+      new_marks_();
+    unsigned char & b = marks_[k >> 3];
+    unsigned char m = 1 << (k & 7);
+    if (b & m) return true;
+    b |= m;
+    return false;
+  }
 
   // Move an object from h to this minipool if there is room.
   //head * move(head * h, void * p);
 
-  // cleanup this mini pool - used by gc to clean up old active pool.
-  void gc_cleanup();
+  // the GCOBJ at h is moved, frozen or removed by user.
+  void obj_gone(const head * h);
+
+  // forget all objects - used by gc on the old active pool once live
+  // objects are moved and dead objects needing it are finalized.
+  // Remaining GCOBJ blocks are counted as deallocated.
+  void discard();
 
   // cleanup this mini pool completely.
   // remove all objects. This one works for Fminipools also.
@@ -158,6 +217,22 @@ struct minipool {
   inline
   int block_in_pool_(const void * p, std::size_t sz);
 
+  std::size_t mark_idx_(const head * h) const
+  {
+    return static_cast<std::size_t>
+      (reinterpret_cast<const char *>(h) - p_) >> MARKSHIFT;
+  }
+
+  // bytes of bitmap for n bytes of pool.
+  static std::size_t marks_size_(std::size_t n)
+  { return (n >> (MARKSHIFT + 3)) + 1; }
+
+  // first mark of this epoch, clear or allocate the bitmap.
+  void new_marks_();
+
+  // forget the bitmap, p_ is going away.
+  void drop_marks_() { delete [] marks_; marks_ = 0; }
+
 }; // end of struct minipool
 
 }; // end of namespace gc
@@ -0,0 +1,400 @@
+
+#include <cstring>
+
+#include <algorithm>
+
+#include "../gc.hxx"
+
+#include "head.hxx"
+#include "tail.hxx"
+#include "mpool.hxx"
+#include "tracer.hxx"
+#include "finalizer.hxx"
+#include "limiter.hxx"
+
+// Mpool keeps objects that are too large to copy around at each gc
+// but too small to get a block of their own in Lpool. Each size class
+// has a list of pages and each page is cut in slots of the class size.
+
+////////////////////////
+// mpage
+
+alf::gc::mpage::mpage(statistics & S, int cls, std::size_t bsz,
+		      std::size_t n)
+  : minipool(S, n*bsz), cls_(cls), idx_(0), bsz_(bsz), nslots_(n),
+    free_(0), nfinal_(0), nfrozen_(0), nmarked_(0), fmarked_(0),
+    umarked_(0), unswept_(false)
+{
+  // all slots are blocks from the start, only heads and tails are
+  // written so the rest of the page isn't touched until used.
+  usz_ = n*bsz;
+  std::size_t k = n;
+  while (k) {
+    head * h = slot(--k);
+    h->h_init(this, 0, bsz, 0);
+    tail * t = h->cur_tail();
+    head::fill(t->deadbeef, 0x0b0b0b0b, sizeof(t->deadbeef));
+    t->D_.magic = tail::MAGIC;
+    t->D_.sz = bsz;
+    h->flags = head::REMOVED | head::FREE | head::MFREE;
+    h->p = 0;
+    *reinterpret_cast<head **>(h->obj_charp()) = free_;
+    free_ = h;
+  }
+}
+
+////////////////////////
+// Mpool
+
+// block size of each class, (4 + k%4) << (8 + k/4).
+const std::size_t alf::gc::Mpool::sizes_[NCLASS] = {
+  1024, 1280, 1536, 1792,
+  2048, 2560, 3072, 3584,
+  4096, 5120, 6144, 7168,
+  8192, 10240, 12288, 14336,
+  16384, 20480, 24576, 28672,
+  32768, 40960, 49152, 57344,
+  65536, 81920, 98304, 114688,
+  131072, 163840, 196608, 229376,
+  262144, 327680, 393216, 458752,
+  524288, 655360, 786432, 917504,
+  1048576 };
+
+alf::gc::Mpool::Mpool(statistics & S, Limiter & L)
+  : S_(S), lim_(L), nunswept_(0), nempty_(0)
+{
+  std::memset(cur_, 0, sizeof(cur_));
+}
+
+// static
+int alf::gc::Mpool::size_class(std::size_t usz)
+{
+  if (usz > sizes_[NCLASS - 1]) return -1;
+  std::size_t bsz = sizeof(head) + head::asz(usz) + sizeof(tail);
+  const std::size_t * p = std::lower_bound(sizes_, sizes_ + NCLASS, bsz);
+  return p == sizes_ + NCLASS ? -1 : p - sizes_;
+}
+
+// static
+std::size_t alf::gc::Mpool::class_size(int cls)
+{
+  return sizes_[cls];
+}
+
+// static
+std::size_t alf::gc::Mpool::page_size_(int cls)
+{
+  std::size_t bsz = sizes_[cls];
+  std::size_t n = PAGESZ/bsz;
+  return (n < std::size_t(MINSLOTS) ? std::size_t(MINSLOTS) : n)*bsz;
+}
+
+alf::gc::mpage * alf::gc::Mpool::new_page_(int cls)
+{
+  std::size_t bsz = sizes_[cls];
+  std::size_t n = page_size_(cls)/bsz;
+
+  mpage * pg = new mpage(S_, cls, bsz, n);
+  pg->idx_ = cls_[cls].size();
+  cls_[cls].push_back(pg);
+  pages_.insert(std::upper_bound(pages_.begin(), pages_.end(), pg,
+				 [](const mpage * a, const mpage * b)
+				 { return a->p_ < b->p_; }),
+		pg);
+  return pg;
+}
+
+void alf::gc::Mpool::delete_page_(mpage * pg)
+{
+  // the slots aren't minipool blocks, don't let ~minipool look at them.
+  pg->usz_ = 0;
+  delete pg;
+}
+
+alf::gc::head *
+alf::gc::Mpool::alloc_(int cls, std::size_t usz, unsigned int attr,
+		       void * & ptr)
+{
+  std::vector<mpage *> & v = cls_[cls];
+  std::size_t & k = cur_[cls];
+  mpage * pg = 0;
+  bool tried = false;
+
+  for (;;) {
+    // pages before cur_ were full when we last looked.
+    while (k < v.size()) {
+      pg = v[k];
+      if (pg->unswept_)
+	sweep_(pg, 0);
+      if (pg->free_)
+	break;
+      ++k;
+    }
+    if (k < v.size())
+      break;
+    std::size_t psz = page_size_(cls);
+    if (lim_.room(psz)) {
+      pg = new_page_(cls);
+      break;
+    }
+    // gc may free slots, cur_ is back at the first page after it.
+    if (tried || ! lim_.emergency())
+      lim_.fail(psz);
+    tried = true;
+  }
+
+  head * h = pg->free_;
+  pg->free_ = *reinterpret_cast<head **>(h->obj_charp());
+
+  // the gap after the object is left as it is.
+  std::memset(h, 0, sizeof(head) + head::asz(usz));
+  h->h_init(pg, head::MOBJ, pg->bsz_, usz);
+  ++pg->n_obj_;
+  pg->sz_obj_ += pg->bsz_;
+  pg->usz_obj_ += usz;
+  if (attr & ALLOC_NOFINAL)
+    h->flags |= head::NOFINAL;
+  else
+    ++pg->nfinal_;
+  if (attr & ALLOC_PINNED) {
+    // medium objects don't move, just count it.
+    h->fcnt = 1;
+    ++pg->nfrozen_;
+  }
+  ptr = h->vp;
+  return h;
+}
+
+bool alf::gc::Mpool::dealloc_(head * h, void * p)
+{
+  if (p == 0) return false;
+
+  mpage * pg = mpage::page_of(h);
+
+  // we assume user has already destroyed the object at p
+  // so we do not call destructor.
+  --pg->n_obj_;
+  pg->sz_obj_ -= pg->bsz_;
+  pg->usz_obj_ -= h->usz;
+  if ((h->flags & head::NOFINAL) == 0)
+    --pg->nfinal_;
+  if (h->fcnt)
+    --pg->nfrozen_;
+  free_slot_(pg, h);
+  if (pg->idx_ < cur_[pg->cls_])
+    cur_[pg->cls_] = pg->idx_;
+  return true;
+}
+
+// static
+void alf::gc::Mpool::freeze_(head * h)
+{
+  if (h->fcnt++ == 0)
+    ++mpage::page_of(h)->nfrozen_;
+}
+
+// static
+void alf::gc::Mpool::unfreeze_(head * h)
+{
+  // never drops below 0.
+  if (h->fcnt && --h->fcnt == 0)
+    --mpage::page_of(h)->nfrozen_;
+}
+
+// static
+void alf::gc::Mpool::free_slot_(mpage * pg, head * h)
+{
+  // the rest of the slot is cleared when it is allocated again.
+  h->flags = head::REMOVED | head::FREE | head::MFREE;
+  h->fcnt = 0;
+  h->usz = 0;
+  h->p = 0;
+  h->fmap = 0;
+  *reinterpret_cast<head **>(h->obj_charp()) = pg->free_;
+  pg->free_ = h;
+}
+
+// walk the frozen objs, only pages that have some are looked at.
+void alf::gc::Mpool::gc_walk()
+{
+  for (mpage * pg : pages_) {
+    if (pg->nfrozen_ == 0) continue;
+
+    std::size_t k = 0;
+    for (; k < pg->nslots_; ++k) {
+      head * h = pg->slot(k);
+      if (h->gctype() != head::MOBJ || h->fcnt == 0) continue;
+      if (tracer::active) {
+	// diagnostic trace, let tracer do the marking.
+	tracer::active->root("Frozen obj", h->obj());
+	continue;
+      }
+      if (h->set_visited()) continue; // already seen it, skip it.
+      marked_(h);
+      h->obj()->gc_walker("Frozen obj");
+    }
+  }
+}
+
+// the marked counts tell us how much died on each page without looking
+// at the slots. Only pages where something died that needs its
+// destructor are swept now.
+void alf::gc::Mpool::gc_cleanup(Finalizer & fz)
+{
+  for (mpage * pg : pages_) {
+
+    if (pg->unswept_)
+      throw fatal_error("Mpool page not swept before gc");
+
+    unsigned int dead = pg->n_obj_ - pg->nmarked_;
+    bool sweep = pg->nfinal_ != pg->fmarked_;
+
+    if (dead)
+      S_.dealloc(dead, dead*pg->bsz_, pg->usz_obj_ - pg->umarked_);
+    pg->n_obj_ = pg->nmarked_;
+    pg->sz_obj_ = pg->nmarked_*pg->bsz_;
+    pg->usz_obj_ = pg->umarked_;
+    pg->nfinal_ = pg->fmarked_;
+    pg->nmarked_ = pg->fmarked_ = 0;
+    pg->umarked_ = 0;
+
+    if (pg->n_obj_ == 0)
+      // gc_cleanup2 deletes it once weak pointers are done.
+      ++nempty_;
+
+    pg->unswept_ = true;
+    ++nunswept_;
+    if (sweep)
+      sweep_(pg, & fz);
+  }
+  std::memset(cur_, 0, sizeof(cur_));
+}
+
+void alf::gc::Mpool::gc_cleanup2()
+{
+  if (nempty_ == 0) return;
+
+  // keep the first page of each class so we don't free and allocate
+  // the same page at every gc.
+  std::size_t k = 0, j = 0;
+  for (; k < pages_.size(); ++k) {
+    mpage * pg = pages_[k];
+    if (pg->n_obj_ == 0 && pg->idx_ != 0) {
+      if (pg->unswept_)
+	--nunswept_;
+      cls_[pg->cls_][pg->idx_] = 0;
+      delete_page_(pg);
+    } else
+      pages_[j++] = pg;
+  }
+  pages_.resize(j);
+
+  for (std::vector<mpage *> & v : cls_) {
+    auto e = std::remove(v.begin(), v.end(), static_cast<mpage *>(0));
+    v.erase(e, v.end());
+    for (k = 0; k < v.size(); ++k)
+      v[k]->idx_ = k;
+  }
+  nempty_ = 0;
+}
+
+void alf::gc::Mpool::sweep_(mpage * pg, Finalizer * fz)
+{
+  std::size_t k = 0;
+
+  for (; k < pg->nslots_; ++k) {
+    head * h = pg->slot(k);
+
+    switch (h->gctype()) {
+    case head::MOBJ:
+      if (h->visited() || h->fcnt) continue; // live.
+      if ((h->flags & head::NOFINAL) == 0) {
+	if (fz && fz->deferred())
+	  fz->defer(h, h->obj());
+	else
+	  h->obj()->~gcobj(); // destroy the obj.
+      }
+      free_slot_(pg, h);
+      /* FALLTHRU */
+
+    case head::MFREE:
+      continue;
+
+    default:
+      throw fatal_error("Mpool corrupt, obj flags is " + h->gcflags_str());
+    }
+  }
+  pg->unswept_ = false;
+  --nunswept_;
+}
+
+void alf::gc::Mpool::sweep_all_()
+{
+  if (nunswept_ == 0) return;
+
+  for (mpage * pg : pages_)
+    if (pg->unswept_)
+      sweep_(pg, 0);
+}
+
+void alf::gc::Mpool::start_walk_()
+{
+  for (mpage * pg : pages_) {
+    pg->nmarked_ = pg->fmarked_ = 0;
+    pg->umarked_ = 0;
+  }
+}
+
+// remove all Mpool objs.
+void alf::gc::Mpool::cleanup()
+{
+  for (mpage * pg : pages_) {
+    std::size_t k = 0;
+    for (; k < pg->nslots_; ++k) {
+      head * h = pg->slot(k);
+      if (h->gctype() != head::MOBJ || dead_(h)) continue;
+      std::size_t usz = h->usz;
+      h->obj()->~gcobj();
+      S_.dealloc(pg->bsz_, usz);
+    }
+    delete_page_(pg);
+  }
+  pages_.clear();
+  for (std::vector<mpage *> & v : cls_)
+    v.clear();
+  std::memset(cur_, 0, sizeof(cur_));
+  nunswept_ = nempty_ = 0;
+}
+
+alf::gc::mpage * alf::gc::Mpool::find_(const void * p) const
+{
+  // last page starting at or below p.
+  auto x = std::upper_bound(pages_.begin(), pages_.end(), p,
+			    [](const void * q, const mpage * pg)
+			    { return q < static_cast<const void *>(pg->p_); });
+  if (x == pages_.begin()) return 0;
+  mpage * pg = *--x;
+  return pg->block_in_pool(p) ? pg : 0;
+}
+
+alf::gc::head *
+alf::gc::Mpool::get_block_head(const void * p)
+{
+  mpage * pg = find_(p);
+  return pg ? pg->slot_of(p) : 0;
+}
+
+// like minipool::get_block_head, head::BAD_BLOCK if the area isn't
+// inside a single slot.
+alf::gc::head *
+alf::gc::Mpool::get_block_head(const void * p, const void * q)
+{
+  mpage * pg = find_(p);
+  if (pg == 0) {
+    // q is past the end of the area.
+    pg = q > p ? find_(reinterpret_cast<const char *>(q) - 1) : 0;
+    return pg ? head::BAD_BLOCK : 0;
+  }
+  head * h = pg->slot_of(p);
+  return h->in_block(p, q) ? h : head::BAD_BLOCK;
+}
@@ -0,0 +1,163 @@
+#ifndef __GC_PRIV_MPOOL_HXX__
+#define __GC_PRIV_MPOOL_HXX__
+
+#include <cstdlib>
+
+#include <vector>
+
+#include "../gc.hxx"
+#include "tail.hxx"
+#include "head.hxx"
+#include "minipool.hxx"
+#include "gcstat.hxx"
+
+namespace alf {
+
+namespace gc {
+
+class Finalizer;
+class Limiter;
+
+// mpage is a page of Mpool. It is cut in slots of the same size, each
+// slot is a block with head and tail that is either an MOBJ or MFREE.
+// The minipool part holds the memory, usz_ covers all slots so the page
+// can be walked with next_head() and n_obj_, sz_obj_ and usz_obj_ count
+// the MOBJ blocks.
+struct mpage : minipool {
+
+  int cls_; // size class.
+  std::size_t idx_; // position in the list of its class.
+  std::size_t bsz_; // size of each slot.
+  std::size_t nslots_;
+  head * free_; // MFREE slots, linked through the first word of obj.
+
+  unsigned int nfinal_; // MOBJ blocks without NOFINAL.
+  unsigned int nfrozen_; // MOBJ blocks with fcnt > 0.
+
+  // marked by this gc.
+  unsigned int nmarked_;
+  unsigned int fmarked_; // of which without NOFINAL.
+  std::size_t umarked_;
+
+  // the marks of the last gc are still set on live objects and
+  // unmarked MOBJ blocks are garbage, sweep_() frees them.
+  bool unswept_;
+
+  mpage(statistics & S, int cls, std::size_t bsz, std::size_t n);
+
+  head * slot(std::size_t k) const
+  { return reinterpret_cast<head *>(p_ + k*bsz_); }
+
+  // block that holds p or 0.
+  head * slot_of(const void * p)
+  {
+    if (! block_in_pool(p)) return 0;
+    return slot((reinterpret_cast<const char *>(p) - p_)/bsz_);
+  }
+
+  static mpage * page_of(const head * h)
+  { return static_cast<mpage *>(h->mp); }
+
+}; // end of struct mpage
+
+// Mpool is the pool for medium sized objects, at least medium_size()
+// bytes but less than large_size(). Objects are put in pages of slots
+// of the same size class and are marked in place by gc just like Lpool
+// objects, they never move. Unreachable objects without a destructor
+// are not freed by gc, their page is left unswept and is swept when we
+// allocate from it or before the next walk over the heap. A page with
+// unreachable objects that need their destructor is swept by gc.
+//
+// Lpool owns the Mpool and passes gc on to it.
+class Mpool {
+public:
+
+  // block sizes go from 1K to 1M with 4 classes for each power of 2.
+  enum { NCLASS = 41, PAGESZ = 512*1024, MINSLOTS = 2 };
+
+  Mpool(statistics & S, Limiter & L);
+  ~Mpool() { cleanup(); }
+
+  // size class for an object of usz bytes, -1 if it is too large.
+  static int size_class(std::size_t usz);
+
+  static std::size_t class_size(int cls);
+
+  // ALLOC_NOFINAL and ALLOC_PINNED in attr are handled here.
+  head * alloc_(int cls, std::size_t usz, unsigned int attr, void * & ptr);
+  bool dealloc_(head * h, void * p);
+
+  // fcnt of the MOBJ at h goes up or down.
+  static void freeze_(head * h);
+  static void unfreeze_(head * h);
+
+  // first visit of the MOBJ at h by gc_walk_.
+  static void marked_(head * h)
+  {
+    mpage * pg = mpage::page_of(h);
+    ++pg->nmarked_;
+    pg->umarked_ += h->usz;
+    if ((h->flags & head::NOFINAL) == 0)
+      ++pg->fmarked_;
+  }
+
+  // the MOBJ at h wasn't reached by the last gc and is waiting for
+  // its page to be swept.
+  static bool dead_(const head * h)
+  { return mpage::page_of(h)->unswept_ && h->fcnt == 0 && ! h->visited(); }
+
+  void gc_walk(); // walk through all frozen medium objs.
+  void gc_cleanup(Finalizer & fz); // garbage collect Mpool objs.
+  void gc_cleanup2(); // delete pages left empty by gc_cleanup.
+  // counts of marked objs start at 0.
+  void start_walk_();
+
+  // finish sweeping, gc_walk may mark medium objs after this.
+  void sweep_all_();
+
+  void cleanup(); // remove all objs (called by destructor).
+
+  // if pointer is found in a page, return that block.
+  // otherwise, return 0.
+  head * get_block_head(const void * p);
+
+  head * get_block_head(const void * p, const void * q);
+
+  std::size_t pages() const { return pages_.size(); }
+
+private:
+
+  statistics & S_;
+  Limiter & lim_;
+  std::vector<mpage *> pages_; // sorted on address.
+  std::vector<mpage *> cls_[NCLASS];
+  std::size_t cur_[NCLASS]; // first page of class that may have room.
+  std::size_t nunswept_;
+  std::size_t nempty_; // pages gc_cleanup2 should delete.
+
+  static const std::size_t sizes_[NCLASS];
+
+  // bytes of a page of class cls.
+  static std::size_t page_size_(int cls);
+
+  mpage * new_page_(int cls);
+  void delete_page_(mpage * pg);
+
+  // turn the slot at h into an MFREE slot on the free list.
+  static void free_slot_(mpage * pg, head * h);
+
+  // free unmarked objs. Those that
+  // need it are destroyed or handed to fz.
+  void sweep_(mpage * pg, Finalizer * fz);
+
+  // page holding p or 0.
+  mpage * find_(const void * p) const;
+
+}; // end of class Mpool
+
+}; // end of namespace gc
+
+}; // end of namespace alf
+
+
+#endif
@@ -0,0 +1,61 @@
+
+#include <algorithm>
+
+#include "../gc.hxx"
+
+#include "head.hxx"
+#include "tracer.hxx"
+#include "pathfinder.hxx"
+
+alf::gc::pathfinder::pathfinder(gcobj * target)
+  : target_(target), cur_(NONE), found_(NONE), next_(0)
+{
+  // target may be frozen or unfrozen since the pointer was taken.
+  if (live_head(target_) == 0)
+    target_ = 0;
+}
+
+alf::gc::pathfinder::~pathfinder()
+{ }
+
+alf::gc::gcobj *
+alf::gc::pathfinder::walk(const std::string & txt, gcobj * ptr)
+{
+  head * h = live_head(ptr);
+
+  // once found we just let the rest of the roots go by.
+  if (h == 0 || found_ != NONE || h->set_visited())
+    return ptr;
+
+  if (ptr == target_)
+    found_ = Q_.size();
+  Q_.emplace_back(ptr, cur_, txt);
+  return ptr;
+}
+
+bool alf::gc::pathfinder::drain()
+{
+  std::size_t k = next_;
+
+  while (found_ == NONE && next_ < Q_.size()) {
+    cur_ = next_;
+    // Q_ may grow during gc_walker, don't keep references into it.
+    gcobj * obj = Q_[next_].obj;
+    std::string txt = Q_[next_++].txt;
+    obj->gc_walker(txt);
+  }
+  cur_ = NONE;
+  return next_ != k;
+}
+
+void alf::gc::pathfinder::path(std::vector<retention_step> & v) const
+{
+  v.clear();
+  std::size_t k = found_;
+  while (k != NONE) {
+    const entry & e = Q_[k];
+    v.push_back(retention_step(e.txt, e.obj));
+    k = e.parent;
+  }
+  std::reverse(v.begin(), v.end());
+}
@@ -0,0 +1,66 @@
+#ifndef __GC_PRIV_PATHFINDER_HXX__
+#define __GC_PRIV_PATHFINDER_HXX__
+
+#include <cstdlib>
+
+#include <string>
+#include <vector>
+
+#include "../gc.hxx"
+#include "head.hxx"
+#include "tracer.hxx"
+
+namespace alf {
+
+namespace gc {
+
+// pathfinder is a tracer that searches breadth first from the roots
+// for one object and remembers for each object it reaches which object
+// it was reached from. The first time the target is reached we
+// therefore have a shortest path to it and stop.
+// Unlike gc_walk_ we can't call gc_walker when we reach an object,
+// that would be depth first, so the objects are queued and walked by
+// drain() after all roots are done. The values of ephemerons whose key
+// that reached are walked next as roots and drained again.
+class pathfinder : public tracer {
+public:
+
+  pathfinder(gcobj * target);
+  virtual ~pathfinder();
+
+  virtual gcobj * walk(const std::string & txt, gcobj * ptr);
+
+  // walk the queued objects until target is found.
+  virtual bool drain();
+
+  // path from a root to target, empty if target wasn't reached.
+  void path(std::vector<retention_step> & v) const;
+
+private:
+
+  enum { NONE = ~std::size_t(0) };
+
+  struct entry {
+    gcobj * obj;
+    std::size_t parent; // index of entry we came from, NONE for roots.
+    std::string txt;
+
+    entry(gcobj * o, std::size_t p, const std::string & t)
+      : obj(o), parent(p), txt(t)
+    { }
+  }; // end of struct entry
+
+  gcobj * target_;
+  std::size_t cur_; // entry whose gc_walker is running.
+  std::size_t found_; // entry of target.
+  std::size_t next_; // first entry not walked yet.
+  std::vector<entry> Q_; // in order reached, also the queue.
+
+}; // end of class pathfinder
+
+}; // end of namespace gc
+
+}; // end of namespace alf
+
+
+#endif
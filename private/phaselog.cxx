@@ -0,0 +1,104 @@
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <ctime>
+
+#include <ostream>
+
+#include "../gc.hxx"
+
+#include "phaselog.hxx"
+
+std::size_t alf::gc::PhaseLog::set_capacity(std::size_t n)
+{
+  std::size_t old = cap_;
+
+  // drop the old entries first, a phase that is running when the log
+  // is turned off then finds cap_ 0 and adds nothing.
+  cap_ = 0;
+  delete [] E_;
+  E_ = 0;
+  next_.store(0, std::memory_order_relaxed);
+  if (n) {
+    E_ = new entry[n];
+    for (std::size_t k = 0; k < n; ++k)
+      E_[k].seq.store(0, std::memory_order_relaxed);
+    cap_ = n;
+  }
+  return old;
+}
+
+std::uint64_t alf::gc::PhaseLog::now_()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, & ts);
+  return std::uint64_t(ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+void alf::gc::PhaseLog::phase::begin_()
+{
+  n0_ = L_.count_(to_);
+  sz0_ = L_.size_(to_);
+  t0_ = now_();
+}
+
+void alf::gc::PhaseLog::add_(const phase & p)
+{
+  static thread_local int tid = 0;
+
+  std::uint64_t t = now_();
+
+  // a phase that began before the log was turned on has no start.
+  if (p.t0_ == 0 || p.t0_ > t)
+    return;
+  if (tid == 0)
+    tid = int(syscall(SYS_gettid));
+
+  std::uint64_t k = next_.fetch_add(1, std::memory_order_relaxed);
+  entry & e = E_[k % cap_];
+
+  e.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  e.name = p.name_;
+  e.start = p.t0_;
+  e.dur = t - p.t0_;
+  e.n = count_(p.to_) - p.n0_;
+  e.sz = size_(p.to_) - p.sz0_;
+  e.tid = tid;
+  e.seq.store(k + 1, std::memory_order_release);
+}
+
+std::ostream & alf::gc::PhaseLog::chrome_trace(std::ostream & os) const
+{
+  std::uint64_t end = next_.load(std::memory_order_acquire);
+  std::uint64_t k = end > cap_ ? end - cap_ : 0;
+  const char * sep = "";
+  int pid = int(getpid());
+
+  os << "{\"traceEvents\":[";
+  for (; k < end; ++k) {
+    const entry & e = E_[k % cap_];
+
+    if (e.seq.load(std::memory_order_acquire) != k + 1)
+      continue; // being written or already overwritten.
+    const char * name = e.name;
+    std::uint64_t start = e.start, dur = e.dur;
+    std::size_t n = e.n, sz = e.sz;
+    int tid = e.tid;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (e.seq.load(std::memory_order_relaxed) != k + 1)
+      continue;
+    // trace events are in microseconds.
+    os << sep << "\n{\"name\":\"" << name << "\",\"cat\":\"gc\",\"ph\":\"X\""
+       << ",\"ts\":" << start/1000 << '.' << start/100%10 << start/10%10
+       << start%10
+       << ",\"dur\":" << dur/1000 << '.' << dur/100%10 << dur/10%10
+       << dur%10
+       << ",\"pid\":" << pid << ",\"tid\":" << tid
+       << ",\"args\":{\"objects\":" << n << ",\"bytes\":" << sz << "}}";
+    sep = ",";
+  }
+  return os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
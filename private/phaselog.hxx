@@ -0,0 +1,110 @@
+#ifndef __GC_PRIV_PHASELOG_HXX__
+#define __GC_PRIV_PHASELOG_HXX__
+
+#include <cstdlib>
+#include <cstdint>
+
+#include <atomic>
+#include <iostream>
+
+#include "../gc.hxx"
+#include "minipool.hxx"
+#include "gcstat.hxx"
+
+namespace alf {
+
+namespace gc {
+
+// PhaseLog keeps the last phases of gc, gc_update_pointers(), freeze,
+// unfreeze and resize in a ring buffer, see set_phase_trace(). Each
+// entry has the time the phase began, how long it took and how many
+// objects and bytes were copied or deallocated in it. Phases nest, gc
+// is one phase and walking the roots is another inside it.
+//
+// Only the thread using the heap adds entries. An entry carries the
+// number it was added as and a reader that finds another number
+// there skips it, so the log may be written out while a gc runs in
+// another thread without taking a lock.
+//
+// The log is off (capacity 0) by default, a phase then costs a test.
+class PhaseLog {
+public:
+
+  PhaseLog(statistics & S)
+    : S_(S), E_(0), cap_(0), next_(0)
+  { }
+
+  ~PhaseLog() { delete [] E_; }
+
+  std::size_t capacity() const { return cap_; }
+
+  // keep the last n phases, 0 turns the log off. The log is emptied.
+  // Return old capacity.
+  std::size_t set_capacity(std::size_t n);
+
+  // all phases in the log as Chrome trace event JSON.
+  std::ostream & chrome_trace(std::ostream & os) const;
+
+  // a phase lasts from construction to destruction. Objects and bytes
+  // are what was deallocated meanwhile and, if to is given, what was
+  // copied into to.
+  class phase {
+  public:
+
+    phase(PhaseLog & L, const char * name, const minipool * to = 0)
+      : L_(L), name_(name), to_(to), t0_(0)
+    { if (L.cap_) begin_(); }
+
+    ~phase() { if (L_.cap_) L_.add_(*this); }
+
+  private:
+
+    friend class PhaseLog;
+
+    PhaseLog & L_;
+    const char * name_;
+    const minipool * to_;
+    std::uint64_t t0_;
+    int n0_; // n_d or n_obj_ of to_ at the start.
+    std::size_t sz0_;
+
+    void begin_();
+
+  }; // end of class phase
+
+private:
+
+  struct entry {
+    std::atomic<std::uint64_t> seq; // number + 1, 0 while written.
+    const char * name;
+    std::uint64_t start; // ns, CLOCK_MONOTONIC.
+    std::uint64_t dur;
+    std::size_t n;
+    std::size_t sz;
+    int tid;
+  }; // end of struct entry
+
+  statistics & S_;
+  entry * E_;
+  std::size_t cap_;
+  std::atomic<std::uint64_t> next_; // number of the next entry.
+
+  static std::uint64_t now_();
+
+  // objects and bytes deallocated so far plus those in to.
+  int count_(const minipool * to) const
+  { return S_.n_d + (to ? to->n_obj_ : 0); }
+
+  std::size_t size_(const minipool * to) const
+  { return S_.sz_d + (to ? to->usz_ : 0); }
+
+  void add_(const phase & p);
+
+}; // end of class PhaseLog
+
+}; // end of namespace gc
+
+}; // end of namespace alf
+
+
+#endif
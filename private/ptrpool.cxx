@@ -19,7 +19,13 @@ alf::gc::PtrPool & alf::gc::PtrPool::enlarge()
   // so that we do not call constructors for entries we haven't made.
   entry * p = reinterpret_cast<entry *>(new char[newm*sizeof(entry)]);
   std::memset(p + n_, 0, (newm - n_)*sizeof(entry));
-  std::memcpy(p, T_, n_*sizeof(entry));
+  // entry has a std::string which may point into itself, so move
+  // them over rather than memcpy.
+  std::size_t k = 0;
+  while (k < n_) {
+    new(p + k) entry(std::move(T_[k]));
+    T_[k++].~entry();
+  }
   delete [] reinterpret_cast<char *>(T_);
   T_ = p;
   m_ = newm;
@@ -112,8 +118,23 @@ void alf::gc::PtrPool::gc_walk()
   std::size_t k = 0;
   while (k < n_) {
     gcobj ** pp = T_[k].pp;
-    *pp = gc::gc_walk_(T_[k++].txt, *pp);
+    // the pointer may be in a frozen or large obj, gc_walk only
+    // writes to it if the obj moved.
+    gc::gc_walk(T_[k++].txt, *pp);
+  }
+}
+
+std::size_t alf::gc::PtrPool::set_root_(const std::string & txt, gcobj * p)
+{
+  std::size_t k = 0, n = 0;
+  while (k < n_) {
+    entry & e = T_[k++];
+    if (e.h == 0 && e.txt == txt) {
+      *e.pp = p;
+      ++n;
+    }
   }
+  return n;
 }
 
 void alf::gc::PtrPool::update_pp(head * h1, head * h2, ssize_t delta)
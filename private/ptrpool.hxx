@@ -52,8 +52,33 @@ public:
 
   void gc_walk();
 
+  // gc_walk the registrations for which skip(h) is false, h is the
+  // head of the block the pointer is in, 0 if none.
+  template <typename Skip>
+  void gc_walk_except(Skip skip)
+  {
+    for (std::size_t k = 0; k < n_; ++k)
+      if (! skip(T_[k].h))
+	gc::gc_walk(T_[k].txt, *T_[k].pp);
+  }
+
+  // set each pointer registered with label txt that isn't in a gcobj
+  // to p, return number set. Used by load_image.
+  std::size_t set_root_(const std::string & txt, gcobj * p);
+
   void update_pp(head * h1, head * h2, ssize_t delta);
 
+  // true if pred(h, p) for a registration, h is the head of the block
+  // the pointer is in, 0 if none, and p its value.
+  template <typename Pred>
+  bool find_(Pred pred) const
+  {
+    for (std::size_t k = 0; k < n_; ++k)
+      if (pred(T_[k].h, *T_[k].pp))
+	return true;
+    return false;
+  }
+
 private:
 
   void init();
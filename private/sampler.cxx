@@ -0,0 +1,325 @@
+
+#include <execinfo.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cxxabi.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include "../gc.hxx"
+
+#include "head.hxx"
+#include "gcpool.hxx"
+#include "moved.hxx"
+#include "sampler.hxx"
+
+alf::gc::Sampler::Sampler()
+  : rate_(0), left_(0), rnd_(0x2545f4914f6cdd1dULL)
+{ }
+
+std::size_t alf::gc::Sampler::set_rate(std::size_t r)
+{
+  std::size_t old = rate_;
+  rate_ = r;
+  left_ = r ? next_() : 0;
+  return old;
+}
+
+// exponentially distributed with mean rate_.
+ssize_t alf::gc::Sampler::next_()
+{
+  rnd_ ^= rnd_ << 13;
+  rnd_ ^= rnd_ >> 7;
+  rnd_ ^= rnd_ << 17;
+  // 53 random bits in (0, 1].
+  double u = (double((rnd_ >> 11) + 1)) / 9007199254740992.0;
+  double d = -std::log(u) * double(rate_);
+  return d < 1 ? 1 : ssize_t(d);
+}
+
+double alf::gc::Sampler::weight_(std::size_t usz) const
+{
+  // an allocation of usz bytes is sampled with probability
+  // 1 - exp(-usz/rate).
+  if (rate_ == 0 || usz == 0) return double(usz);
+  double p = 1 - std::exp(-double(usz) / double(rate_));
+  return double(usz) / p;
+}
+
+void alf::gc::Sampler::sample_(head * h, std::size_t usz)
+{
+  left_ = next_();
+
+  // the previous samples are most likely constructed by now.
+  std::size_t j = 0;
+  while (j < pending_.size()) {
+    live_map::iterator p = live_.find(pending_[j++]);
+    if (p != live_.end())
+      resolve_(p->first, p->second);
+  }
+  pending_.clear();
+
+  bucket b;
+  int n = ::backtrace(b.pc, MAXDEPTH);
+  // skip ourselves and allocate().
+  int skip = n > 2 ? 2 : 0;
+  b.depth = n - skip;
+  std::memmove(b.pc, b.pc + skip, b.depth*sizeof(void *));
+  std::string key(reinterpret_cast<const char *>(b.pc),
+		  b.depth*sizeof(void *));
+
+  std::size_t x;
+  auto p = bx_.find(key);
+  if (p == bx_.end()) {
+    b.n_alloc = b.sz_alloc = b.n_live = b.sz_live = 0;
+    x = B_.size();
+    B_.push_back(b);
+    bx_.emplace(std::move(key), x);
+  } else
+    x = p->second;
+
+  bucket & bb = B_[x];
+  ++bb.n_alloc;
+  bb.sz_alloc += usz;
+  ++bb.n_live;
+  bb.sz_live += usz;
+
+  sample s;
+  s.usz = usz;
+  s.bx = x;
+  s.t = 0;
+  s.gcs = 0;
+  live_[h] = s;
+  pending_.push_back(h);
+}
+
+void alf::gc::Sampler::resolve_(head * h, sample & s)
+{
+  if (s.t != 0) return;
+
+  switch (h->gctype()) {
+  case head::GCOBJ:
+  case head::FROZEN:
+  case head::LOBJ:
+  case head::MOBJ:
+    break;
+  default:
+    return;
+  }
+
+  gcobj * obj = h->obj();
+  // vtable pointer is 0 until gcobj constructor has run.
+  if (*reinterpret_cast<void * const *>(obj) == 0) return;
+
+  s.t = & typeid(*obj);
+  type_stat & ts = types_[s.t];
+  ++ts.n_alloc;
+  ts.est_alloc += weight_(s.usz);
+  ++ts.n_live;
+  ts.est_live += weight_(s.usz);
+}
+
+void alf::gc::Sampler::resolve_all_()
+{
+  live_map::iterator p = live_.begin();
+  while (p != live_.end()) {
+    resolve_(p->first, p->second);
+    ++p;
+  }
+}
+
+void alf::gc::Sampler::died_(sample & s)
+{
+  bucket & b = B_[s.bx];
+  --b.n_live;
+  b.sz_live -= s.usz;
+
+  // if we never got the type, count it as unknown (type 0).
+  type_stat & ts = types_[s.t];
+  if (s.t == 0) {
+    ++ts.n_alloc;
+    ts.est_alloc += weight_(s.usz);
+  } else {
+    --ts.n_live;
+    ts.est_live -= weight_(s.usz);
+  }
+  ++ts.n_dead;
+  ts.gcs_dead += s.gcs;
+}
+
+void alf::gc::Sampler::dealloc_(head * h)
+{
+  live_map::iterator p = live_.find(h);
+  if (p == live_.end()) return;
+  // destructor has already run so we can't get the type now.
+  died_(p->second);
+  live_.erase(p);
+}
+
+void alf::gc::Sampler::moved_(head * h, head * h2)
+{
+  live_map::iterator p = live_.find(h);
+  if (p == live_.end()) return;
+  sample s = p->second;
+  live_.erase(p);
+  resolve_(h2, live_[h2] = s);
+}
+
+void alf::gc::Sampler::dropped_(const minipool * mp)
+{
+  live_map::iterator p = live_.begin();
+  while (p != live_.end()) {
+    head * h = p->first;
+    if (h->gctype() == head::GCOBJ && h->mp == mp) {
+      // not destroyed yet, we can still get the type.
+      resolve_(h, p->second);
+      died_(p->second);
+      p = live_.erase(p);
+    } else
+      ++p;
+  }
+}
+
+// called after marking. Objects that survived have either moved
+// (GCpool) or are marked (Lpool and Mpool). Frozen objects always survive.
+// Unreachable objects are still intact so we can get their type.
+void alf::gc::Sampler::gc_sweep(GCpool & gcp)
+{
+  if (live_.empty()) return;
+
+  minipool * act = gcp.active();
+  live_map L;
+
+  live_map::iterator p = live_.begin();
+  while (p != live_.end()) {
+    head * h = p->first;
+    sample & s = p->second;
+    bool alive = false;
+    bool done = false;
+
+    while (! done) {
+      done = true;
+      switch (h->gctype()) {
+      case head::GCMOVED:
+      case head::GCFROZEN:
+	// the moved object left behind knows where it went.
+	h = static_cast<gc::moved *>(h->obj())->desth_;
+	done = false;
+	break;
+
+      case head::UNFROZEN:
+	h = head::get_head(h->p);
+	done = false;
+	break;
+
+      case head::GCOBJ:
+	// only objects copied during this gc are in active pool,
+	// objects in open arenas stay where they are.
+	alive = h->mp == act || h->visited();
+	break;
+
+      case head::FROZEN:
+	alive = true;
+	break;
+
+      case head::LOBJ:
+      case head::MOBJ:
+	alive = h->fcnt != 0 || h->visited();
+	break;
+
+      default:
+	// removed.
+	break;
+      }
+    }
+    resolve_(h, s);
+    if (alive) {
+      ++s.gcs;
+      L[h] = s;
+    } else
+      died_(s);
+    ++p;
+  }
+  live_.swap(L);
+  pending_.clear();
+}
+
+std::ostream & alf::gc::Sampler::report(std::ostream & os)
+{
+  resolve_all_();
+
+  typedef std::pair<const std::type_info *, type_stat> entry;
+  std::vector<entry> v(types_.begin(), types_.end());
+  std::sort(v.begin(), v.end(),
+	    [](const entry & a, const entry & b)
+	    { return a.second.est_live > b.second.est_live; });
+
+  char buf[200];
+  os << "sample rate " << rate_ << " bytes, "
+     << live_.size() << " live samples" << std::endl;
+  os << "     live est.live    alloc est.alloc   dead avg.gcs type"
+     << std::endl;
+
+  std::size_t k = 0;
+  while (k < v.size()) {
+    const entry & e = v[k++];
+    const type_stat & t = e.second;
+    std::string name = "(unknown)";
+    if (e.first) {
+      int st = 0;
+      char * dn = abi::__cxa_demangle(e.first->name(), 0, 0, & st);
+      name = dn ? dn : e.first->name();
+      std::free(dn);
+    }
+    // est_live is a sum of doubles, keep rounding from showing as -0.
+    std::sprintf(buf, "%9zu %9.0f %8zu %9.0f %6zu %7.2f ",
+		 t.n_live, t.n_live ? t.est_live : 0.0, t.n_alloc, t.est_alloc, t.n_dead,
+		 t.n_dead ? double(t.gcs_dead)/double(t.n_dead) : 0.0);
+    os << buf << name << std::endl;
+  }
+  return os;
+}
+
+// pprof "heap_v2" legacy format. pprof does the scaling from
+// sampled to estimated values itself given the rate in the header.
+std::ostream & alf::gc::Sampler::heap_profile(std::ostream & os)
+{
+  char buf[200];
+  std::size_t n_live = 0, sz_live = 0, n_alloc = 0, sz_alloc = 0;
+  std::size_t k = 0;
+
+  while (k < B_.size()) {
+    const bucket & b = B_[k++];
+    n_live += b.n_live;
+    sz_live += b.sz_live;
+    n_alloc += b.n_alloc;
+    sz_alloc += b.sz_alloc;
+  }
+
+  std::sprintf(buf, "heap profile: %6zu: %8zu [%6zu: %8zu] @ heap_v2/%zu\n",
+	       n_live, sz_live, n_alloc, sz_alloc, rate_);
+  os << buf;
+
+  k = 0;
+  while (k < B_.size()) {
+    const bucket & b = B_[k++];
+    std::sprintf(buf, "%6zu: %8zu [%6zu: %8zu] @",
+		 b.n_live, b.sz_live, b.n_alloc, b.sz_alloc);
+    os << buf;
+    std::size_t j = 0;
+    while (j < b.depth) {
+      std::sprintf(buf, " %p", b.pc[j++]);
+      os << buf;
+    }
+    os << '\n';
+  }
+
+  os << "\nMAPPED_LIBRARIES:\n";
+  std::ifstream maps("/proc/self/maps");
+  if (maps)
+    os << maps.rdbuf();
+  return os;
+}
@@ -0,0 +1,144 @@
+#ifndef __GC_PRIV_SAMPLER_HXX__
+#define __GC_PRIV_SAMPLER_HXX__
+
+#include <sys/types.h>
+
+#include <cstdlib>
+
+#include <iostream>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#include "../gc.hxx"
+#include "head.hxx"
+
+namespace alf {
+
+namespace gc {
+
+class GCpool;
+
+// Sampler is an allocation profiler. When enabled it picks roughly
+// one allocation every rate_ bytes (the distance between samples is
+// exponentially distributed so that we do not get in lock step with
+// the allocation pattern of the program) and records a backtrace for it.
+// The dynamic type of the object is not known when allocate() is called
+// since the constructor hasn't run yet so we pick it up from the object
+// later - when gc runs, on a report or when the next sample is taken.
+// gc_sweep() is called by gc after marking so that we can follow
+// the sampled objects as they move and see which of them survive.
+class Sampler {
+public:
+
+  enum { MAXDEPTH = 32 };
+
+  Sampler();
+  ~Sampler() { }
+
+  std::size_t rate() const { return rate_; }
+
+  // set new rate, 0 turns off sampling. Return old rate.
+  std::size_t set_rate(std::size_t r);
+
+  // called by allocate() for every allocation - keep this cheap.
+  void alloc(head * h, std::size_t usz)
+  { if (rate_ != 0 && (left_ -= ssize_t(usz)) < 0) sample_(h, usz); }
+
+  // object at h is about to be deleted by user.
+  void dealloc(head * h)
+  { if (! live_.empty()) dealloc_(h); }
+
+  // object at h has been moved to h2 by freeze or unfreeze.
+  void moved(head * h, head * h2)
+  { if (h != h2 && ! live_.empty()) moved_(h, h2); }
+
+  // the objects in mp are gone without being destroyed one by one.
+  void dropped(const minipool * mp)
+  { if (! live_.empty()) dropped_(mp); }
+
+  // called by GCpool::do_gc_ after all live objects are marked and
+  // moved but before the old pool is cleaned up.
+  void gc_sweep(GCpool & gcp);
+
+  // summary of samples per type.
+  std::ostream & report(std::ostream & os);
+
+  // pprof legacy heap profile format.
+  std::ostream & heap_profile(std::ostream & os);
+
+private:
+
+  // one per unique backtrace.
+  struct bucket {
+    std::size_t depth;
+    void * pc[MAXDEPTH];
+    std::size_t n_alloc; // number of samples.
+    std::size_t sz_alloc; // sampled bytes.
+    std::size_t n_live; // number of samples still alive.
+    std::size_t sz_live; // bytes of samples still alive.
+  }; // end of struct bucket
+
+  // one per type.
+  struct type_stat {
+    std::size_t n_alloc;
+    double est_alloc; // estimated bytes allocated.
+    std::size_t n_live;
+    double est_live; // estimated bytes still alive.
+    std::size_t n_dead;
+    std::size_t gcs_dead; // sum of gc survived by dead samples.
+
+    type_stat()
+      : n_alloc(0), est_alloc(0), n_live(0), est_live(0),
+	n_dead(0), gcs_dead(0)
+    { }
+  }; // end of struct type_stat
+
+  // one per live sampled object.
+  struct sample {
+    std::size_t usz;
+    std::size_t bx; // index into B_.
+    const std::type_info * t; // 0 until the object is constructed.
+    int gcs; // number of gc survived.
+  }; // end of struct sample
+
+  typedef std::unordered_map<head *, sample> live_map;
+  typedef std::unordered_map<const std::type_info *, type_stat> type_map;
+
+  void sample_(head * h, std::size_t usz);
+  void dealloc_(head * h);
+  void moved_(head * h, head * h2);
+  void dropped_(const minipool * mp);
+
+  // try to get the dynamic type of a sampled object.
+  void resolve_(head * h, sample & s);
+  void resolve_all_();
+
+  // the sample at s is no longer alive.
+  void died_(sample & s);
+
+  // estimated number of bytes a sample of usz bytes represents.
+  double weight_(std::size_t usz) const;
+
+  // next distance in bytes to the next sample.
+  ssize_t next_();
+
+  std::size_t rate_;
+  ssize_t left_; // bytes left until next sample.
+  unsigned long long rnd_; // xorshift state.
+
+  std::vector<bucket> B_;
+  std::unordered_map<std::string, std::size_t> bx_; // backtrace -> B_ index.
+  live_map live_;
+  std::vector<head *> pending_; // samples not yet resolved.
+  type_map types_;
+
+}; // end of class Sampler
+
+}; // end of namespace gc
+
+}; // end of namespace alf
+
+
+#endif
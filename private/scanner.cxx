@@ -0,0 +1,127 @@
+
+#include <utility>
+
+#include "../gc.hxx"
+
+#include "scanner.hxx"
+
+int alf::gc::Scanner::set_order(int ord)
+{
+  int old = order_;
+
+  switch (ord) {
+  case COPY_DEPTH_FIRST:
+  case COPY_HIERARCHICAL:
+  case COPY_BREADTH_FIRST:
+    break;
+
+  default:
+    throw gc_error("set_copy_order: invalid order");
+  }
+  order_ = ord;
+  return old;
+}
+
+void alf::gc::Scanner::scan(const std::string & txt, gcobj * obj,
+			    const head * h)
+{
+  std::size_t mark = Q_.size();
+
+  push(txt, obj, h);
+  if (roots_ && order_ == COPY_BREADTH_FIRST)
+    return; // end_roots() walks it.
+  try {
+    if (order_ == COPY_BREADTH_FIRST) {
+      // Cheney order, Q_ is a fifo.
+      std::size_t k = mark;
+      while (k < Q_.size())
+	walk_(k++);
+    } else
+      hier_(mark);
+  }
+  catch (...) {
+    busy_ = false;
+    Q_.erase(Q_.begin() + mark, Q_.end());
+    throw;
+  }
+  Q_.erase(Q_.begin() + mark, Q_.end());
+}
+
+void alf::gc::Scanner::begin_roots()
+{
+  roots_ = true;
+}
+
+void alf::gc::Scanner::end_roots()
+{
+  std::size_t k = 0;
+
+  roots_ = false;
+  try {
+    while (k < Q_.size())
+      walk_(k++);
+  }
+  catch (...) {
+    abort_roots();
+    throw;
+  }
+  Q_.clear();
+}
+
+void alf::gc::Scanner::abort_roots()
+{
+  roots_ = false;
+  busy_ = false;
+  Q_.clear();
+}
+
+std::size_t alf::gc::Scanner::walk_(std::size_t k)
+{
+  // walking pushes to Q_ so don't keep a reference.
+  entry e(std::move(Q_[k]));
+
+  busy_ = true;
+  if (e.fm && typeid(*e.obj) == *e.fm->type)
+    walk_fields_(e.txt, e.obj, *e.fm);
+  else
+    e.obj->gc_walker(e.txt);
+  busy_ = false;
+  return e.sz;
+}
+
+alf::gc::Scanner::frame alf::gc::Scanner::cluster_(std::size_t k)
+{
+  std::size_t first = Q_.size();
+  std::size_t bytes = walk_(k);
+  std::size_t j = first;
+
+  // breadth first within the cluster.
+  while (j < Q_.size() && bytes < CLUSTER_SIZE)
+    bytes += walk_(j++);
+  frame f = { j, Q_.size(), first };
+  return f;
+}
+
+void alf::gc::Scanner::hier_(std::size_t k)
+{
+  std::size_t base = S_.size();
+
+  S_.push_back(cluster_(k));
+  try {
+    while (S_.size() > base) {
+      frame & f = S_.back();
+      if (f.next < f.last) {
+	// each object in the frontier starts a new cluster.
+	std::size_t j = f.next++;
+	S_.push_back(cluster_(j));
+      } else {
+	Q_.erase(Q_.begin() + f.first, Q_.end());
+	S_.pop_back();
+      }
+    }
+  }
+  catch (...) {
+    S_.resize(base);
+    throw;
+  }
+}
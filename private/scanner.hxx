@@ -0,0 +1,109 @@
+#ifndef __GC_PRIV_SCANNER_HXX__
+#define __GC_PRIV_SCANNER_HXX__
+
+#include <cstdlib>
+
+#include <string>
+#include <vector>
+
+#include "../gc.hxx"
+#include "head.hxx"
+
+namespace alf {
+
+namespace gc {
+
+// Scanner decides in which order gc_walk_ walks the objects it has
+// visited and so in which order GCpool::move copies them to the new
+// pool. With COPY_DEPTH_FIRST it isn't used, gc_walk_ walks each object
+// as soon as it is moved. Otherwise gc_walk_ hands each object it
+// reaches from a root to scan(). The objects that this object points
+// to are then only moved and queued by push(). Which of the queued
+// objects is walked next depends on the order.
+//
+// COPY_BREADTH_FIRST walks the queue as a fifo. Between begin_roots()
+// and end_roots() scan() only queues, end_roots() walks the queue so
+// one queue holds what all the roots reach.
+//
+// COPY_HIERARCHICAL walks breadth first until about a page has been
+// copied and then starts over from each object in the frontier, so
+// each page holds a subtree a few levels deep (Wilson, Lam and Moher,
+// "Effective Static-graph Reorganization to Improve Locality in
+// Garbage-Collected Systems").
+class Scanner {
+public:
+
+  // bytes copied breadth first by COPY_HIERARCHICAL.
+  enum { CLUSTER_SIZE = 4096 };
+
+  Scanner() : order_(COPY_DEPTH_FIRST), busy_(false), roots_(false) { }
+
+  int order() const { return order_; }
+
+  // set new order, return old order.
+  int set_order(int ord);
+
+  // true if gc_walk_ is called from an object walked by us.
+  bool busy() const { return busy_; }
+
+  // obj with head h was just visited, walk it later. h is the head
+  // before obj was moved, if it was.
+  void push(const std::string & txt, gcobj * obj, const head * h)
+  { Q_.emplace_back(txt, obj, h->fmap, h->sz); }
+
+  // obj was visited from a root, walk obj and everything it reaches.
+  void scan(const std::string & txt, gcobj * obj, const head * h);
+
+  // bracket the walk of all roots, see above. abort_roots() instead
+  // of end_roots() drops the queue when a root walk threw.
+  void begin_roots();
+  void end_roots();
+  void abort_roots();
+
+private:
+
+  struct entry {
+    std::string txt;
+    gcobj * obj;
+    const field_map * fm;
+    std::size_t sz;
+
+    entry(const std::string & t, gcobj * o, const field_map * f,
+	  std::size_t s)
+      : txt(t), obj(o), fm(f), sz(s) { }
+  }; // end of struct entry
+
+  // walk Q_[k], the objects it points to are pushed.
+  // Return size of Q_[k].
+  std::size_t walk_(std::size_t k);
+
+  // a cluster being walked by hier_(). Q_[next] to Q_[last] is the
+  // part of its frontier not yet walked, Q_ is cut back to first
+  // when it is done.
+  struct frame {
+    std::size_t next;
+    std::size_t last;
+    std::size_t first;
+  }; // end of struct frame
+
+  // walk the cluster from Q_[k], return its frame.
+  frame cluster_(std::size_t k);
+
+  // walk the cluster from Q_[k] and then each object in its frontier,
+  // with an explicit stack so a long list doesn't overflow ours.
+  void hier_(std::size_t k);
+
+  int order_;
+  bool busy_;
+  bool roots_; // between begin_roots() and end_roots().
+  std::vector<entry> Q_;
+  std::vector<frame> S_; // used by hier_().
+
+}; // end of class Scanner
+
+}; // end of namespace gc
+
+}; // end of namespace alf
+
+
+#endif
@@ -0,0 +1,83 @@
+
+#include <cstdio>
+#include <cstring>
+
+#include "../gc.hxx"
+
+#include "head.hxx"
+#include "tracer.hxx"
+#include "snapshot.hxx"
+
+alf::gc::snapshot::snapshot(std::FILE * f)
+  : f_(f), parent_(0), n_nodes_(0), n_edges_(0)
+{
+  put_("GCSNAP\0\0", 8);
+  put_u32_(VERSION);
+  put_u32_(sizeof(void *));
+}
+
+alf::gc::snapshot::~snapshot()
+{ }
+
+std::uint32_t alf::gc::snapshot::type_id_(gcobj * obj)
+{
+  // vtable pointer is 0 if the constructor hasn't run yet.
+  if (*reinterpret_cast<void * const *>(obj) == 0) return 0;
+
+  const std::type_info * t = & typeid(*obj);
+  auto p = types_.find(t);
+  if (p != types_.end())
+    return p->second;
+
+  std::uint32_t id = types_.size() + 1;
+  types_.emplace(t, id);
+  const char * name = t->name();
+  put_u8_('T');
+  put_u32_(id);
+  put_str_(name, std::strlen(name));
+  return id;
+}
+
+alf::gc::gcobj *
+alf::gc::snapshot::walk(const std::string & txt, gcobj * ptr)
+{
+  head * h = live_head(ptr);
+
+  if (h == 0) return ptr;
+
+  if (parent_) {
+    put_u8_('E');
+    put_u64_(reinterpret_cast<std::uintptr_t>(parent_));
+    put_u64_(reinterpret_cast<std::uintptr_t>(ptr));
+  } else {
+    put_u8_('R');
+    put_u64_(reinterpret_cast<std::uintptr_t>(ptr));
+    put_str_(txt.data(), txt.size());
+  }
+  ++n_edges_;
+
+  if (h->set_visited())
+    return ptr;
+
+  std::uint32_t t = type_id_(ptr);
+  put_u8_('N');
+  put_u64_(reinterpret_cast<std::uintptr_t>(ptr));
+  put_u64_(h->usz);
+  put_u32_(t);
+  put_u8_(h->gctype());
+  put_str_(txt.data(), txt.size());
+  ++n_nodes_;
+
+  gcobj * save = parent_;
+  parent_ = ptr;
+  ptr->gc_walker(txt);
+  parent_ = save;
+  return ptr;
+}
+
+void alf::gc::snapshot::finish()
+{
+  put_u8_('Z');
+  put_u64_(n_nodes_);
+  put_u64_(n_edges_);
+}
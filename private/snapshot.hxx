@@ -0,0 +1,75 @@
+#ifndef __GC_PRIV_SNAPSHOT_HXX__
+#define __GC_PRIV_SNAPSHOT_HXX__
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+
+#include "../gc.hxx"
+#include "head.hxx"
+#include "tracer.hxx"
+
+namespace alf {
+
+namespace gc {
+
+// snapshot is a tracer that writes every reachable object and every
+// pointer between them to a file. Objects are written the first time
+// they are reached, so the label of a node is the txt of the first
+// path found to it. Nothing is allocated per node, only one type
+// table entry per type.
+//
+// File format, all integers in native byte order:
+//
+//   header: "GCSNAP\0\0" u32 version u32 sizeof(void *)
+//   'T' u32 id u32 len name           - type, written before first use.
+//   'N' u64 addr u64 usz u32 type u8 gctype u32 len label  - object.
+//   'R' u64 addr u32 len label        - root pointer to addr.
+//   'E' u64 from u64 to               - pointer from object to object.
+//   'Z' u64 nodes u64 edges           - end of file.
+//
+// Type id 0 is reserved for objects whose type is unknown.
+class snapshot : public tracer {
+public:
+
+  enum { VERSION = 1 };
+
+  snapshot(std::FILE * f);
+  virtual ~snapshot();
+
+  virtual gcobj * walk(const std::string & txt, gcobj * ptr);
+
+  // write end record.
+  virtual void finish();
+
+  std::size_t nodes() const { return n_nodes_; }
+  std::size_t edges() const { return n_edges_; }
+
+private:
+
+  void put_(const void * p, std::size_t n) { std::fwrite(p, 1, n, f_); }
+  void put_u8_(std::uint8_t v) { put_(& v, sizeof(v)); }
+  void put_u32_(std::uint32_t v) { put_(& v, sizeof(v)); }
+  void put_u64_(std::uint64_t v) { put_(& v, sizeof(v)); }
+  void put_str_(const char * s, std::size_t n) { put_u32_(n); put_(s, n); }
+
+  std::uint32_t type_id_(gcobj * obj);
+
+  std::FILE * f_;
+  gcobj * parent_; // object whose gc_walker is running, 0 for roots.
+  std::size_t n_nodes_;
+  std::size_t n_edges_;
+  std::unordered_map<const std::type_info *, std::uint32_t> types_;
+
+}; // end of class snapshot
+
+}; // end of namespace gc
+
+}; // end of namespace alf
+
+
+#endif
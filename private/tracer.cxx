@@ -0,0 +1,48 @@
+
+#include <cstdlib>
+
+#include "../gc.hxx"
+
+#include "moved.hxx"
+#include "head.hxx"
+#include "tracer.hxx"
+
+thread_local alf::gc::tracer * alf::gc::tracer::active = 0;
+
+alf::gc::tracer::~tracer()
+{ }
+
+alf::gc::head * alf::gc::tracer::live_head(gcobj * & ptr)
+{
+  if (ptr == 0) return 0;
+
+  head * h = head::get_head_safe(ptr);
+
+  while (h) {
+    switch (h->gctype()) {
+    case head::GCOBJ:
+    case head::FROZEN:
+    case head::LOBJ:
+    case head::MOBJ:
+      return h;
+
+    case head::GCFROZEN:
+    case head::UNFROZEN:
+      // object has moved to Fpool or back to GCpool.
+      ptr = h->p;
+      h = head::get_head_safe(ptr);
+      break;
+
+    case head::GCMOVED:
+      // only seen if we are called during gc, follow it anyway.
+      ptr = static_cast<moved *>(h->obj())->dest_;
+      h = head::get_head_safe(ptr);
+      break;
+
+    default:
+      // removed.
+      return 0;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef __GC_PRIV_TRACER_HXX__
+#define __GC_PRIV_TRACER_HXX__
+
+#include <cstdlib>
+
+#include <string>
+
+#include "../gc.hxx"
+#include "head.hxx"
+
+namespace alf {
+
+namespace gc {
+
+// tracer is the base class for diagnostic walks over the heap.
+// While a tracer is active, gc_walk_ hands every pointer it is given
+// to the tracer instead of moving the object, so a trace never moves
+// or reclaims anything. The walk is started by GCpool::do_trace()
+// which walks the same roots as gc_update_pointers does: PtrPool,
+// FPtrPool and the frozen objects in Fpool and Lpool.
+// Visited objects are marked as during gc and the marks are cleared
+// again when the trace is done.
+class tracer {
+public:
+
+  tracer() { }
+  virtual ~tracer();
+
+  // called by gc_walk_ for each pointer found. Return the value
+  // gc_walk_ should return, normally ptr itself.
+  virtual gcobj * walk(const std::string & txt, gcobj * ptr) = 0;
+
+  // called for each frozen object in Fpool and Lpool, these are roots.
+  virtual void root(const std::string & txt, gcobj * ptr)
+  { walk(txt, ptr); }
+
+  // walk the objects walk() has queued and not walked yet, a tracer
+  // that walks depth first in walk() has none. Return true if any
+  // were walked, their pointers may reach the key of an ephemeron.
+  virtual bool drain() { return false; }
+
+  // called after all roots are walked, before the marks are cleared.
+  virtual void finish() { }
+
+  // find the live block for ptr. Follows frozen and unfrozen
+  // objects to their new place and updates ptr accordingly.
+  // Return 0 if ptr isn't a live managed object.
+  static head * live_head(gcobj * & ptr);
+
+  // the tracer gc_walk_ delegates to, 0 if none. Each thread has
+  // its own since each may walk its own heap.
+  static thread_local tracer * active;
+
+}; // end of class tracer
+
+}; // end of namespace gc
+
+}; // end of namespace alf
+
+
+#endif
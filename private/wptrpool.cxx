@@ -1,6 +1,7 @@
 
 #include "../gc.hxx"
 
+#include "mpool.hxx"
 #include "wptrpool.hxx"
 
 // PtrPool is a special pool to keep track of user's weak pointers.
@@ -30,7 +31,9 @@ alf::gc::WPtrPool & alf::gc::WPtrPool::enlarge()
 // register a pointer.
 void
 alf::gc::WPtrPool::wptr_register(GCpool & gcp, Fpool & fp, Lpool & lp,
-				 gcobj * & p)
+				 gcobj * & p,
+				 reference_queue * q /* = 0 */,
+				 void * tag /* = 0 */ )
 {
   gcobj ** pp = & p;
 
@@ -60,6 +63,7 @@ alf::gc::WPtrPool::wptr_register(GCpool & gcp, Fpool & fp, Lpool & lp,
       // don't register this pointer.
       return;
 
+    if (n_ == m_) enlarge();
     // let us insert it in the proper position
     // we sort on address of the pointer.
     int k = n_;
@@ -68,10 +72,26 @@ alf::gc::WPtrPool::wptr_register(GCpool & gcp, Fpool & fp, Lpool & lp,
     // k < 0 || pp >= T_[k]
     T_[++k].pp = pp;
     T_[k].h = h;
+    T_[k].q = q;
+    T_[k].tag = tag;
     ++n_;
   }
 }
 
+void alf::gc::WPtrPool::set_queue(GCpool & gcp, Fpool & fp, Lpool & lp,
+				  gcobj * & p,
+				  reference_queue * q, void * tag)
+{
+  int k = find(p);
+
+  if (k < 0) {
+    wptr_register(gcp, fp, lp, p, q, tag);
+    return;
+  }
+  T_[k].q = q;
+  T_[k].tag = tag;
+}
+
 // remove a registration of this pointer.
 void alf::gc::WPtrPool::wptr_unregister(gcobj * & p)
 {
@@ -79,9 +99,9 @@ void alf::gc::WPtrPool::wptr_unregister(gcobj * & p)
 
   while (k > 0) {
     if (T_[--k].pp == & p) {
-      if (k < --n_) // k is not last, swap places with last.
-	T_[k] = T_[n_];
-      // From here it is n_ that is removed.
+      // keep the table sorted.
+      --n_;
+      std::memmove(T_ + k, T_ + k + 1, (n_ - k)*sizeof(entry));
       T_[n_] = entry();
       return;
     }
@@ -95,11 +115,10 @@ void alf::gc::WPtrPool::wptr_unregister_all(gcobj * & p)
 
   while (k > 0) {
     if (T_[--k].pp == & p) {
-      if (k < --n_) // k is not last, swap places with last.
-	T_[k] = T_[n_];
-      // From here it is n_ that is removed.
+      // keep the table sorted.
+      --n_;
+      std::memmove(T_ + k, T_ + k + 1, (n_ - k)*sizeof(entry));
       T_[n_] = entry();
-      // T_[k] is formerly T_[n_] which we have processed previously
     }
   }
 }
@@ -108,10 +127,11 @@ void alf::gc::WPtrPool::wptr_unregister_all(gcobj * & p)
 void alf::gc::WPtrPool::wptr_unregister_all()
 {
   std::memset(T_, 0, n_*sizeof(*T_));
+  n_ = 0;
 }
 
 alf::gc::gcobj *
-alf::gc::WPtrPool::gc_update_wptr(gcobj * p)
+alf::gc::WPtrPool::gc_update_wptr(gcobj * p, minipool * dead)
 {
   while (true) {
 
@@ -120,11 +140,20 @@ alf::gc::WPtrPool::gc_update_wptr(gcobj * p)
     switch (h ? h->gctype() : -1) {
 
     case head::GCOBJ:
+      // not moved out of the old pool, object is gone.
+      if (dead && h->mp == dead)
+	return 0;
+      return p;
+
     case head::FROZEN:
     case head::LOBJ:
       // still an object at same location, just continue.
       return p;
 
+    case head::MOBJ:
+      // unreached by gc if its page isn't swept yet.
+      return Mpool::dead_(h) ? 0 : p;
+
     case head::GCMOVED:
     case head::GCFROZEN:
     case head::UNFROZEN:
@@ -138,6 +167,7 @@ alf::gc::WPtrPool::gc_update_wptr(gcobj * p)
     case head::FREMOVED:
     case head::FMERGED:
     case head::LREMOVED:
+    case head::MFREE:
       // object is gone.
       return 0;
 
@@ -149,15 +179,123 @@ alf::gc::WPtrPool::gc_update_wptr(gcobj * p)
   }
 }
 
-void alf::gc::WPtrPool::gc_update_wptrs()
+void alf::gc::WPtrPool::gc_update_wptrs(minipool * dead /* = 0 */ )
 {
   std::size_t k = n_;
   
   while (k) {
-    gcobj ** pp = T_[--k].pp;
-    if (pp && *pp)
-      *pp = gc_update_wptr(*pp);
+    entry & e = T_[--k];
+    gcobj ** pp = e.pp;
+    if (pp && *pp && (*pp = gc_update_wptr(*pp, dead)) == 0 && e.q)
+      e.q->Q_.push_back(e.tag);
   }
+  for (weak_table_ * t : tables_)
+    gc_update_table(t, dead);
+}
+
+void alf::gc::WPtrPool::gc_update_table(weak_table_ * t, minipool * dead)
+{
+  gcobj ** pp = t->slots_;
+  gcobj ** e = pp + t->nslots_;
+  gcobj ** vp = t->values_;
+  std::size_t n = 0;
+
+  for (; pp < e; ++pp)
+    if (*pp && (*pp = gc_update_wptr(*pp, dead)) == 0) {
+      ++n;
+      if (vp)
+	// the value wasn't walked, forget it.
+	vp[pp - t->slots_] = 0;
+    }
+  t->gc_purge_(n);
+}
+
+// static
+bool alf::gc::WPtrPool::gc_reached(gcobj * p)
+{
+  while (true) {
+
+    head * h = head::get_head_safe(p);
+
+    switch (h ? h->gctype() : -1) {
+    case head::GCMOVED:
+      // moved by this gc.
+    case head::FROZEN:
+      // frozen objects are always live.
+      return true;
+
+    case head::GCOBJ:
+    case head::LOBJ:
+    case head::MOBJ:
+      return h->visited();
+
+    case head::GCFROZEN:
+    case head::UNFROZEN:
+      if ((p = h->p) == 0)
+	return false;
+      continue;
+
+    default:
+      // removed.
+      return false;
+    }
+  }
+}
+
+void alf::gc::WPtrPool::gc_walk_ephemerons(bool all)
+{
+  eph_.clear();
+  for (weak_table_ * t : tables_)
+    if (t->values_) {
+      std::size_t k = 0;
+      for (; k < t->nslots_; ++k)
+	if (t->slots_[k] && t->values_[k])
+	  eph_.push_back(std::make_pair(t, k));
+    }
+
+  // walking a value may reach the key of another entry.
+  bool more = true;
+  while (more) {
+    more = false;
+    std::size_t j = 0;
+    while (j < eph_.size()) {
+      weak_table_ * t = eph_[j].first;
+      std::size_t k = eph_[j].second;
+      if (gc_reached(t->slots_[k])) {
+	t->values_[k] = gc_walk_("ephemeron", t->values_[k]);
+	eph_[j] = eph_.back();
+	eph_.pop_back();
+	more = true;
+      } else
+	++j;
+    }
+  }
+  if (all)
+    for (auto & e : eph_)
+      e.first->values_[e.second] =
+	gc_walk_("ephemeron", e.first->values_[e.second]);
+  eph_.clear();
+}
+
+void alf::gc::WPtrPool::table_unregister(weak_table_ * t)
+{
+  std::size_t k = tables_.size();
+
+  while (k-- > 0)
+    if (tables_[k] == t) {
+      tables_[k] = tables_.back();
+      tables_.pop_back();
+      return;
+    }
+}
+
+void alf::gc::WPtrPool::queue_unregister(reference_queue * q)
+{
+  std::size_t k = n_;
+
+  while (k > 0)
+    if (T_[--k].q == q)
+      T_[k].q = 0;
 }
 
 int alf::gc::WPtrPool::find(gcobj * & p) const
@@ -223,22 +361,21 @@ void alf::gc::WPtrPool::update_pp(head * h1, head * h2, ssize_t delta)
       // should move up to j+1-nb..j
       if (j >= be) {
 	// we have already saved the elements from nk..be - 1
-	std::memcpy(T_ + nk, T_ + be, (j + 1 - be)*sizeof(entry));
+	std::memmove(T_ + nk, T_ + be, (j + 1 - be)*sizeof(entry));
 	// T_ + j + 1 - nb..T_ + j
 	std::memcpy(T_ + j + 1 - nb, b, nb*sizeof(entry));
       }
     } else if (delta < 0) {
       // will move to lower addresses, start searching at nk.
+      // j is unsigned, stop at 0 rather than below it.
       j = nk;
-      while (--j >= 0 && pp < T_[j].pp);
-      // j < 0 means we should move the changed entries to beginning
-      // of array.
-      // j >= 0 means 0..j are before these entries and should
-      // stay where they are, entries j+1..nk-1
-      // should move up to nb+j+1..be-1 and the changed entries
-      // should move down to j+1..nb+j
-      std::memmove(T_ + nb + j + 1, T_ + j + 1, (nk - j - 1)*sizeof(entry));
-      std::memcpy(T_ + j + 1, b, nb*sizeof(entry));
+      while (j > 0 && pp < T_[j - 1].pp)
+	--j;
+      // 0..j-1 are before these entries and should stay where they
+      // are, entries j..nk-1 should move up to j+nb..be-1 and the
+      // changed entries should move down to j..j+nb-1.
+      std::memmove(T_ + j + nb, T_ + j, (nk - j)*sizeof(entry));
+      std::memcpy(T_ + j, b, nb*sizeof(entry));
     }
     // don't need b any more.
     delete [] b;
@@ -6,6 +6,7 @@
 
 #include <list>
 #include <string>
+#include <vector>
 
 #include "../gc.hxx"
 #include "moved.hxx"
@@ -33,8 +34,14 @@ public:
 
   WPtrPool & enlarge(); // increase the pointer pool
 
-  // register a pointer.
-  void wptr_register(GCpool & gc, Fpool & fp, Lpool & lp, gcobj * & p);
+  // register a pointer. If q isn't 0 tag is put in q when gc sets
+  // p to 0.
+  void wptr_register(GCpool & gc, Fpool & fp, Lpool & lp, gcobj * & p,
+		     reference_queue * q = 0, void * tag = 0);
+
+  // let the registration of p use q and tag, register p if it isn't.
+  void set_queue(GCpool & gc, Fpool & fp, Lpool & lp, gcobj * & p,
+		 reference_queue * q, void * tag);
 
   // remove a registration of this pointer.
   void wptr_unregister(gcobj * & p);
@@ -45,7 +52,20 @@ public:
   // remove all registrations of all pointers.
   void wptr_unregister_all();
 
-  void gc_update_wptrs();
+  // weak tables are updated with the weak pointers.
+  void table_register(weak_table_ * t) { tables_.push_back(t); }
+  void table_unregister(weak_table_ * t);
+
+  // q is going away, forget it.
+  void queue_unregister(reference_queue * q);
+
+  // walk the values of ephemeron tables whose keys have been reached,
+  // until no more are. If all is true walk the rest too.
+  void gc_walk_ephemerons(bool all);
+
+  // dead is the old pool during gc, objects still GCOBJ there are
+  // garbage.
+  void gc_update_wptrs(minipool * dead = 0);
 
   void update_pp(head * h1, head * h2, ssize_t delta);
 
@@ -56,6 +76,8 @@ private:
   struct entry {
     head * h;
     gcobj ** pp;
+    reference_queue * q; // 0 if none.
+    void * tag;
   };
 
   void init();
@@ -63,11 +85,19 @@ private:
   void swap(entry & a, entry & b)
   { entry tmp = a; a = b; b = tmp; }
 
-  gcobj * gc_update_wptr(gcobj * p);
+  gcobj * gc_update_wptr(gcobj * p, minipool * dead);
+
+  void gc_update_table(weak_table_ * t, minipool * dead);
+
+  // p has been reached in this walk.
+  static bool gc_reached(gcobj * p);
 
   entry * T_;
   size_t n_; // number of elements in use
   size_t m_; // capacity of T_.
+  std::vector<weak_table_ *> tables_;
+  // ephemerons not walked yet, table and index.
+  std::vector<std::pair<weak_table_ *, std::size_t> > eph_;
 
 }; // end of class WPtrPool
 
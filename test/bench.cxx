@@ -0,0 +1,646 @@
+
+// gc benchmarks.
+//
+// usage: bench [-s scale] [-o depth|hier|breadth] [name...]
+//
+// Runs each workload (all if no names are given) and prints one line of
+// JSON per workload on stdout so results can be compared between
+// versions of gc, for example:
+//
+// {"bench":"binary_trees","scale":1,"secs":1.234,"allocs":..., ...}
+//
+// allocs and bytes count calls to allocate() while the workload ran,
+// gcs, gc_secs, max_pause_us and pauses_us are the gc pauses, pauses_us
+// maps the upper bound of each pause bucket in us to a count.
+// peak_rss_kb is the process peak so far (getrusage), workloads
+// run in the order given so run a single workload to get its own peak.
+// order is the gc copy order set by -o. Some workloads add fields of
+// their own, traverse adds the time spent walking the heap after gc.
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../gc.hxx"
+
+namespace gc = alf::gc;
+
+namespace {
+
+//////////////////////////////////
+// objects used by the workloads.
+
+struct tnode : gc::gcobj {
+  tnode * l;
+  tnode * r;
+
+  tnode(tnode * l_, tnode * r_) : l(l_), r(r_) { }
+
+  virtual void gc_walker(const std::string & txt);
+};
+
+void tnode::gc_walker(const std::string & txt)
+{
+  gc::gc_walk(txt, l);
+  gc::gc_walk(txt, r);
+}
+
+struct lnode : gc::gcobj {
+  lnode * next;
+  long val;
+
+  lnode(lnode * n, long v) : next(n), val(v) { }
+
+  virtual void gc_walker(const std::string & txt);
+};
+
+// keep txt as is, a list is walked recursively and
+// txt + ".next" would grow with the length of the list.
+void lnode::gc_walker(const std::string & txt)
+{
+  gc::gc_walk(txt, next);
+}
+
+struct leaf : gc::gcdataobj {
+  long val[4];
+
+  leaf(long v) { val[0] = val[1] = val[2] = val[3] = v; }
+};
+
+struct sym : gc::gcdataobj {
+  long key;
+  char name[24];
+
+  sym(long k) : key(k)
+  { std::snprintf(name, sizeof(name), "sym%ld", k); }
+};
+
+// binary search tree node.
+struct bnode : gc::gcobj {
+  bnode * l;
+  bnode * r;
+  long key;
+
+  bnode(long k) : l(0), r(0), key(k) { }
+
+  virtual void gc_walker(const std::string & txt);
+};
+
+void bnode::gc_walker(const std::string & txt)
+{
+  gc::gc_walk(txt, l);
+  gc::gc_walk(txt, r);
+}
+
+struct big : gc::gcobj {
+  leaf * x;
+  char buf[1];
+
+  big() : x(0) { }
+
+  void * operator new(std::size_t sz, std::size_t n)
+  { return gc::gcobj::operator new(sz + n); }
+
+  virtual void gc_walker(const std::string & txt);
+};
+
+void big::gc_walker(const std::string & txt)
+{
+  gc::gc_walk(txt + ".x", x);
+}
+
+// small deterministic random numbers.
+struct rnd {
+  unsigned long long s;
+
+  rnd(unsigned long long seed = 88172645463325252ULL) : s(seed) { }
+
+  unsigned long long operator () ()
+  {
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+  }
+
+  std::size_t below(std::size_t n) { return (*this)() % n; }
+};
+
+//////////////////////////////////
+// workloads. Each returns a checksum so the work isn't optimized away.
+
+// extra JSON fields for the current workload, e.g. ,"x":1
+std::string extra;
+
+double now();
+
+// build many short lived trees while one long lived tree stays alive.
+tnode * mk_tree(int d)
+{
+  if (d == 0) return new tnode(0, 0);
+  gc::pointer<tnode> l("l", mk_tree(d - 1));
+  gc::pointer<tnode> r("r", mk_tree(d - 1));
+  return new tnode(l, r);
+}
+
+long count_tree(const tnode * t)
+{
+  return t ? 1 + count_tree(t->l) + count_tree(t->r) : 0;
+}
+
+long binary_trees(int scale)
+{
+  const int maxd = 16;
+  gc::pointer<tnode> keep("keep", mk_tree(maxd));
+  long sum = 0;
+  int d = 4;
+
+  while (d <= maxd) {
+    int n = scale << (maxd - d);
+    while (n-- > 0)
+      sum += count_tree(mk_tree(d));
+    d += 2;
+  }
+  return sum + count_tree(keep);
+}
+
+// long lists, gc walks these recursively so this measures
+// deep recursion in gc_walk.
+long long_list(int scale)
+{
+  const long len = 20000;
+  gc::pointer<lnode> head("head");
+  long sum = 0;
+  int round = 4*scale;
+
+  while (round-- > 0) {
+    head = 0;
+    long k = 0;
+    while (k < len)
+      head = new lnode(head, k++);
+    gc::gc();
+    const lnode * p = head;
+    while (p) {
+      sum += p->val;
+      p = p->next;
+    }
+  }
+  return sum;
+}
+
+// many registered root pointers, each gc walks all of them.
+long root_set(int scale)
+{
+  const std::size_t n = 10000;
+  gc::pointer<leaf> * R = new gc::pointer<leaf>[n];
+  std::size_t k = 0;
+  long sum = 0;
+  rnd r;
+
+  while (k < n) {
+    R[k].gc_register("root");
+    R[k] = new leaf(k);
+    ++k;
+  }
+  long iter = 200000L*scale;
+  while (iter-- > 0)
+    R[r.below(n)] = new leaf(iter);
+  gc::gc();
+  k = 0;
+  while (k < n)
+    sum += R[k++]->val[0];
+  delete [] R;
+  return sum;
+}
+
+// symbol table of weak pointers, a ring of strong pointers keep
+// recently used symbols alive.
+long weak_intern(int scale)
+{
+  typedef std::unordered_map<long, gc::weak_pointer<sym> > table;
+  const std::size_t ring = 1000;
+  table T;
+  gc::pointer<sym> * R = new gc::pointer<sym>[ring];
+  std::size_t k = 0;
+  long hits = 0;
+  rnd r;
+
+  while (k < ring)
+    R[k++].gc_register("ring");
+
+  long iter = 200000L*scale;
+  k = 0;
+  while (iter-- > 0) {
+    long key = r.below(20000);
+    table::iterator p = T.find(key);
+    sym * s = 0;
+
+    if (p != T.end() && (s = p->second) != 0)
+      ++hits;
+    else {
+      s = new sym(key);
+      if (p == T.end())
+	T.emplace(key, s);
+      else
+	p->second = s;
+    }
+    R[k++ % ring] = s;
+    if ((iter & 0xffff) == 0)
+      gc::gc();
+  }
+  delete [] R;
+  return hits;
+}
+
+// as weak_intern with a weak_intern_table.
+long weak_table(int scale)
+{
+  gc::weak_intern_table<long, sym> T;
+  const std::size_t ring = 1000;
+  gc::pointer<sym> * R = new gc::pointer<sym>[ring];
+  std::size_t k = 0;
+  long hits = 0;
+  rnd r;
+
+  while (k < ring)
+    R[k++].gc_register("ring");
+
+  long iter = 200000L*scale;
+  k = 0;
+  while (iter-- > 0) {
+    long key = r.below(20000);
+    sym * s = T.find(key);
+
+    if (s != 0)
+      ++hits;
+    else {
+      s = new sym(key);
+      T.insert(key, s);
+    }
+    R[k++ % ring] = s;
+    if ((iter & 0xffff) == 0)
+      gc::gc();
+  }
+  delete [] R;
+  return hits;
+}
+
+// freeze and unfreeze objects while allocating. unfreeze() puts the
+// Fpool block back in the free list so pointers must be updated before
+// the next freeze, i.e. each round does a gc_update_pointers().
+long freeze_churn(int scale)
+{
+  const std::size_t n = 1000;
+  gc::pointer<leaf> * R = new gc::pointer<leaf>[n];
+  std::size_t k = 0;
+  long sum = 0;
+  rnd r;
+
+  while (k < n) {
+    R[k].gc_register("frz");
+    R[k] = new leaf(k);
+    ++k;
+  }
+  long iter = 5000L*scale;
+  while (iter-- > 0) {
+    leaf * p = R[r.below(n)];
+    gc::freeze(p, false);
+    new leaf(iter);
+    gc::unfreeze(p);
+  }
+  gc::gc();
+  k = 0;
+  while (k < n)
+    sum += R[k++]->val[0];
+  delete [] R;
+  return sum;
+}
+
+// objects larger than large_size() go to the large object pool.
+long large_objects(int scale)
+{
+  const std::size_t n = 64;
+  gc::pointer<big> * R = new gc::pointer<big>[n];
+  std::size_t k = 0;
+  long sum = 0;
+  rnd r;
+
+  while (k < n)
+    R[k++].gc_register("big");
+
+  long iter = 500L*scale;
+  while (iter-- > 0) {
+    std::size_t sz = gc::large_size() + r.below(4*gc::large_size());
+    big * b = new(sz) big;
+    R[r.below(n)] = b;
+    b->x = new leaf(iter);
+    sum += b->x->val[0] & 1;
+  }
+  gc::gc();
+  delete [] R;
+  return sum;
+}
+
+// 8K to 100K message buffers, from medium_size() up they stay where
+// they are at each gc instead of being copied.
+long medium_objects(int scale)
+{
+  const std::size_t n = 256;
+  gc::pointer<big> * R = new gc::pointer<big>[n];
+  std::size_t k = 0;
+  long sum = 0;
+  rnd r;
+
+  while (k < n)
+    R[k++].gc_register("msg");
+
+  long iter = 20000L*scale;
+  while (iter-- > 0) {
+    std::size_t sz = 8192 + r.below(92*1024);
+    big * b = new(sz) big;
+    R[r.below(n)] = b;
+    b->buf[sz - 1] = 1;
+    b->x = new leaf(iter);
+    sum += b->x->val[0] & 1;
+    if (iter % 256 == 0)
+      gc::gc();
+  }
+  gc::gc();
+  delete [] R;
+  return sum;
+}
+
+// per request garbage next to a long lived list, in the gc pool or
+// each request in an arena of its own.
+long requests_(int scale, bool arena)
+{
+  gc::pointer<lnode> L("long");
+  std::size_t k = 0;
+  long sum = 0;
+
+  while (k < 20000)
+    L = new lnode(L, k++);
+
+  long iter = 20000L*scale;
+  while (iter-- > 0) {
+    gc::arena_scope * a = arena ? new gc::arena_scope : 0;
+    tnode * t = mk_tree(5);
+    lnode * l = 0;
+    for (k = 0; k < 100; ++k)
+      l = new lnode(l, iter);
+    sum += (t->l != 0) + (l->val & 1);
+    delete a;
+  }
+  gc::gc();
+  return sum;
+}
+
+long requests(int scale)
+{
+  return requests_(scale, false);
+}
+
+long request_arena(int scale)
+{
+  return requests_(scale, true);
+}
+
+// a mix of short, medium and long lived objects of different sizes.
+long mixed(int scale)
+{
+  const std::size_t nlong = 20000;
+  const std::size_t nmed = 2000;
+  gc::pointer<lnode> * L = new gc::pointer<lnode>[nlong];
+  gc::pointer<tnode> * M = new gc::pointer<tnode>[nmed];
+  std::size_t k = 0;
+  long sum = 0;
+  rnd r;
+
+  while (k < nlong)
+    L[k++].gc_register("long");
+  k = 0;
+  while (k < nmed)
+    M[k++].gc_register("med");
+
+  long iter = 200000L*scale;
+  while (iter-- > 0) {
+    switch (r.below(16)) {
+    case 0:
+      // long lived, replaced rarely.
+      if (r.below(16) == 0) {
+	std::size_t x = r.below(nlong);
+	L[x] = new lnode(L[x], iter);
+      }
+      break;
+
+    case 1:
+    case 2:
+      // medium lived small trees.
+      M[r.below(nmed)] = mk_tree(r.below(4));
+      break;
+
+    default:
+      // short lived.
+      sum += (new leaf(iter))->val[1] & 1;
+      break;
+    }
+  }
+  gc::gc();
+  delete [] M;
+  delete [] L;
+  return sum;
+}
+
+// a search tree built in random order with garbage in between so
+// the nodes are scattered until gc copies them in copy order. Then
+// time lookups from the root and in order walks of the whole tree.
+long sum_tree(const bnode * t)
+{
+  return t ? sum_tree(t->l) + t->key + sum_tree(t->r) : 0;
+}
+
+long traverse(int scale)
+{
+  const long n = 200000L*scale;
+  gc::pointer<bnode> root("root");
+  gc::pointer<bnode> x("x");
+  long sum = 0;
+  long k = 0;
+  rnd r;
+
+  while (k++ < n) {
+    x = new bnode(r.below(n*8));
+    new leaf(k);
+    bnode * p = root;
+    if (p == 0) {
+      root = x;
+      continue;
+    }
+    for (;;) {
+      bnode * & q = x->key < p->key ? p->l : p->r;
+      if (q == 0) {
+	q = x;
+	break;
+      }
+      p = q;
+    }
+  }
+  x = 0;
+  gc::gc();
+
+  double t0 = now();
+  rnd r2;
+  long iter = 10*n;
+  while (iter-- > 0) {
+    long key = r2.below(n*8);
+    const bnode * p = root;
+    while (p && p->key != key)
+      p = key < p->key ? p->l : p->r;
+    sum += p != 0;
+  }
+  double t1 = now();
+  iter = 20;
+  while (iter-- > 0)
+    sum += sum_tree(root) & 0xff;
+  double t2 = now();
+
+  char buf[128];
+  std::snprintf(buf, sizeof(buf), ",\"lookup_secs\":%.6f,\"walk_secs\":%.6f",
+		t1 - t0, t2 - t1);
+  extra = buf;
+  return sum;
+}
+
+//////////////////////////////////
+// driver
+
+struct workload {
+  const char * name;
+  long (*f)(int scale);
+};
+
+const workload W[] = {
+  { "binary_trees", binary_trees },
+  { "long_list", long_list },
+  { "root_set", root_set },
+  { "weak_intern", weak_intern },
+  { "weak_table", weak_table },
+  { "freeze_churn", freeze_churn },
+  { "large_objects", large_objects },
+  { "medium_objects", medium_objects },
+  { "requests", requests },
+  { "request_arena", request_arena },
+  { "mixed", mixed },
+  { "traverse", traverse },
+};
+
+const char * const ORDERS[] = { "depth", "hier", "breadth" };
+
+double now()
+{
+  struct timeval tv;
+  gettimeofday(& tv, 0);
+  return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+void run(const workload & w, int scale)
+{
+  gc::gc();
+  gc::reset_num_gc();
+  extra.clear();
+  int n0 = gc::num_allocs();
+  std::size_t b0 = gc::usize_allocated();
+
+  double t0 = now();
+  long check = w.f(scale);
+  double secs = now() - t0;
+
+  int n = gc::num_allocs() - n0;
+  std::size_t b = gc::usize_allocated() - b0;
+  struct timeval gct, maxp;
+  gc::time_gc(& gct);
+  gc::max_gc_pause(& maxp);
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, & ru);
+
+  std::printf("{\"bench\":\"%s\",\"scale\":%d,\"order\":\"%s\","
+	      "\"secs\":%.6f,"
+	      "\"allocs\":%d,\"bytes\":%zu,"
+	      "\"allocs_per_sec\":%.0f,\"bytes_per_sec\":%.0f,"
+	      "\"gcs\":%d,\"gc_secs\":%.6f,\"max_pause_us\":%lld,"
+	      "\"pauses_us\":{",
+	      w.name, scale, ORDERS[gc::copy_order()], secs, n, b,
+	      secs > 0 ? n/secs : 0.0, secs > 0 ? b/secs : 0.0,
+	      gc::num_gc(), gct.tv_sec + gct.tv_usec*1e-6,
+	      maxp.tv_sec*1000000LL + maxp.tv_usec);
+  const char * sep = "";
+  int k = 0;
+  while (k < gc::GC_PAUSE_BUCKETS) {
+    int c = gc::num_gc_pauses(k);
+    if (c) {
+      std::printf("%s\"%llu\":%d", sep, k ? 1ULL << k : 1ULL, c);
+      sep = ",";
+    }
+    ++k;
+  }
+  std::printf("},\"peak_rss_kb\":%ld%s,\"check\":%ld}\n",
+	      ru.ru_maxrss, extra.c_str(), check);
+  std::fflush(stdout);
+}
+
+void usage()
+{
+  std::fprintf(stderr, "usage: bench [-s scale] [-o depth|hier|breadth]"
+	       " [name...]\nworkloads:");
+  for (const workload & w : W)
+    std::fprintf(stderr, " %s", w.name);
+  std::fprintf(stderr, "\n");
+  std::exit(2);
+}
+
+}; // end of anonymous namespace
+
+int main(int argc, char ** argv)
+{
+  int scale = 1;
+  std::vector<const workload *> todo;
+  int k = 1;
+
+  while (k < argc) {
+    if (std::strcmp(argv[k], "-s") == 0 && k + 1 < argc) {
+      scale = std::atoi(argv[k + 1]);
+      k += 2;
+      continue;
+    }
+    if (std::strcmp(argv[k], "-o") == 0 && k + 1 < argc) {
+      int o = 0;
+      while (o < 3 && std::strcmp(argv[k + 1], ORDERS[o]) != 0)
+	++o;
+      if (o == 3) usage();
+      gc::set_copy_order(o);
+      k += 2;
+      continue;
+    }
+    const workload * w = 0;
+    for (const workload & x : W)
+      if (std::strcmp(argv[k], x.name) == 0) w = & x;
+    if (w == 0) usage();
+    todo.push_back(w);
+    ++k;
+  }
+  if (scale < 1) usage();
+  if (todo.empty())
+    for (const workload & x : W)
+      todo.push_back(& x);
+
+  for (const workload * w : todo)
+    run(*w, scale);
+  return 0;
+}
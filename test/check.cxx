@@ -0,0 +1,1751 @@
+// gc checks.
+//
+// usage: check [name...]
+//
+// Runs each check (all if no names are given) and prints one line per
+// check, ok or the failed conditions. Exits with 1 if any check failed.
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../gc.hxx"
+#include "../gccont.hxx"
+#include "../private/gcstat.hxx"
+
+namespace gc = alf::gc;
+
+namespace {
+
+// failed conditions of the current check.
+int failed = 0;
+
+void fail(const char * file, int line, const char * cond)
+{
+  std::printf("  %s:%d: %s\n", file, line, cond);
+  ++failed;
+}
+
+#define CHECK(c) ((c) ? (void)0 : fail(__FILE__, __LINE__, #c))
+
+//////////////////////////////////
+// objects used by the checks.
+
+struct node : gc::gcobj {
+  node * next;
+  long val;
+
+  node(node * n = 0, long v = 0) : next(n), val(v) { }
+
+  virtual void gc_walker(const std::string & txt);
+};
+
+void node::gc_walker(const std::string & txt)
+{
+  gc::gc_walk(txt, next);
+}
+
+// a node with two pointers, each named in the path to what it points to.
+struct snode : gc::gcobj {
+  snode * l;
+  snode * r;
+
+  snode(snode * a = 0, snode * b = 0) : l(a), r(b) { }
+
+  virtual void gc_walker(const std::string & txt);
+};
+
+void snode::gc_walker(const std::string & txt)
+{
+  gc::gc_walk(txt + ".l", l);
+  gc::gc_walk(txt + ".r", r);
+}
+
+struct samp_obj : gc::gcdataobj {
+  long val[2];
+};
+
+// the numbers on the line of sample_report() for a type ending in name.
+bool sample_line(const std::string & name, std::size_t & live,
+		 std::size_t & alloc, std::size_t & dead)
+{
+  std::ostringstream os;
+  gc::sample_report(os);
+  std::istringstream is(os.str());
+  std::string line;
+
+  while (std::getline(is, line)) {
+    if (line.size() < name.size() ||
+	line.compare(line.size() - name.size(), name.size(), name) != 0)
+      continue;
+    double est_live, est_alloc, gcs;
+    return std::sscanf(line.c_str(), "%zu %lf %zu %lf %zu %lf",
+		       & live, & est_live, & alloc, & est_alloc,
+		       & dead, & gcs) == 6;
+  }
+  return false;
+}
+
+// run tools/gcsnap on snapshot fn. sum is its first line, retained
+// gets the retained size of each object by its first path.
+bool gcsnap(const std::string & fn, std::string & sum,
+	    std::map<std::string, unsigned long long> & retained)
+{
+  const char * tool = std::getenv("GCSNAP");
+  std::string cmd = std::string(tool ? tool : "../tools/gcsnap") +
+    " -n 1000 " + fn;
+  std::FILE * f = popen(cmd.c_str(), "r");
+  char buf[1024];
+  unsigned long long ret = 0, self;
+  bool have = false;
+
+  if (f == 0)
+    return false;
+  if (std::fgets(buf, sizeof(buf), f))
+    sum = buf;
+  // objects by retained size, "retained self type" and then the path
+  // on a line of its own, up to the table of types.
+  while (std::fgets(buf, sizeof(buf), f)) {
+    std::string line(buf);
+    if (line.find("count") != std::string::npos)
+      break;
+    if (line.size() > 26 && line.compare(0, 25, std::string(25, ' ')) == 0) {
+      if (have)
+	retained[line.substr(25, line.size() - 26)] = ret;
+      have = false;
+    } else
+      have = std::sscanf(buf, "%llu %llu", & ret, & self) == 2;
+  }
+  return pclose(f) == 0;
+}
+
+//////////////////////////////////
+// checks.
+
+// with rate 1 every allocation is sampled, survivors are live samples
+// and the rest are dead after gc.
+void sampler_counts()
+{
+  static samp_obj * keep[10];
+  for (samp_obj * & p : keep)
+    gc::register_root_ptr("keep", p);
+
+  gc::set_sample_rate(1);
+  int k = 0;
+  while (k < 100) {
+    samp_obj * s = new samp_obj;
+    if (k % 10 == 0)
+      keep[k/10] = s;
+    ++k;
+  }
+  gc::gc();
+
+  std::size_t live = 0, alloc = 0, dead = 0;
+  CHECK(sample_line("samp_obj", live, alloc, dead));
+  CHECK(alloc == 100);
+  CHECK(live == 10);
+  CHECK(dead == 90);
+  gc::set_sample_rate(0);
+  for (samp_obj * & p : keep)
+    p = 0;
+}
+
+// a snapshot has each reachable object and pointer once, moves
+// nothing, and gcsnap finds that an object reached through two others
+// is retained by the one above both.
+void snapshot_dominators()
+{
+  static snode * root;
+  std::string fn = "/tmp/gc-check-" + std::to_string(getpid()) + ".snap";
+  gc::register_root_ptr("snap", root);
+
+  //   root -> a, a -> b c, b -> d, c -> d, d -> e.
+  snode * e = new snode;
+  snode * d = new snode(e);
+  snode * b = new snode(d);
+  snode * c = new snode(d);
+  snode * a = new snode(b, c);
+  root = a;
+  new snode(a, e); // garbage isn't in the snapshot.
+
+  CHECK(gc::heap_snapshot(fn) == 5);
+  CHECK(root == a && a->l == b && a->r == c && b->l == d && c->l == d);
+
+  unsigned long long s = sizeof(snode);
+  std::string sum;
+  std::map<std::string, unsigned long long> R;
+  CHECK(gcsnap(fn, sum, R));
+  std::remove(fn.c_str());
+  CHECK(sum == "5 objects, 6 pointers, " + std::to_string(5*s) +
+	" bytes reachable\n");
+  CHECK(R.size() == 5);
+  CHECK(R["snap"] == 5*s);
+  CHECK(R["snap.l"] == s && R["snap.r"] == s);
+  CHECK(R["snap.l.l"] == 2*s && R["snap.l.l.l"] == s);
+  root = 0;
+}
+
+// an object reached through several pointers in one gc is moved once
+// and every pointer ends up at the copy.
+void shared_object()
+{
+  static node * a, * b, * c;
+  gc::register_root_ptr("a", a);
+  gc::register_root_ptr("b", b);
+  gc::register_root_ptr("c", c);
+
+  node * n = new node(0, 7);
+  a = new node(n, 1);
+  b = new node(n, 2);
+  c = n;
+  gc::gc();
+  CHECK(a->next == c && b->next == c && c->val == 7);
+  c->val = 8;
+  CHECK(a->next->val == 8 && b->next->val == 8);
+  CHECK(gc::gc_pointer_ok(a->next) && gc::gc_pointer_ok(b->next));
+  a = b = c = 0;
+}
+
+// retention_path() gives the shortest path, from the root to obj, and
+// moves nothing.
+void retention_shortest()
+{
+  static node * l, * s;
+  gc::register_root_ptr("long", l);
+  gc::register_root_ptr("short", s);
+
+  node * t = new node(0, 1);
+  l = new node(new node(new node(t, 4), 3), 2);
+  s = new node(t, 5);
+  node * before = t;
+
+  std::vector<gc::retention_step> p = gc::retention_path(t);
+  CHECK(p.size() == 2);
+  CHECK(! p.empty() && p.front().txt == "short" && p.front().obj == s);
+  CHECK(! p.empty() && p.back().obj == t);
+  CHECK(s->next == before && l->next->next->next == before);
+
+  // through a frozen object the path starts there.
+  node * f = l->next;
+  gc::freeze(f);
+  s->next = 0;
+  p = gc::retention_path(t);
+  CHECK(p.size() == 3 && p.front().obj == f && p.back().obj == t);
+  gc::unfreeze(f);
+  l = s = 0;
+}
+
+// a root registered several times is gone after one
+// unregister_all_root_ptrs().
+void unregister_all_roots()
+{
+  static node * p;
+  gc::gc();
+  int n = gc::num_cur_allocs();
+
+  p = new node(0, 1);
+  gc::register_root_ptr("p1", p);
+  gc::register_root_ptr("p2", p);
+  gc::register_root_ptr("p3", p);
+  gc::unregister_root_ptr(p);
+  gc::gc();
+  CHECK(gc::num_cur_allocs() == n + 1);
+  CHECK(p->val == 1);
+
+  gc::unregister_all_root_ptrs(reinterpret_cast<gc::gcobj **>(& p));
+  gc::gc();
+  CHECK(gc::num_cur_allocs() == n);
+}
+
+// gc reports a root to a deleted object instead of walking what is
+// left of it.
+void dangling_root()
+{
+  static node * r;
+  node * x = new node(0, 1);
+  bool thrown = false;
+
+  gc::register_root_ptr("r", r);
+  delete x;
+  r = x;
+  try {
+    gc::gc_update_pointers();
+  } catch (gc::dangling_pointer & e) {
+    thrown = std::string(e.what()).find("r") != std::string::npos;
+  }
+  CHECK(thrown);
+  gc::unregister_root_ptr(r);
+}
+
+// a root that isn't a gcobj, walked through a static gc_walker.
+struct holder {
+  node * p;
+
+  holder() : p(0) { }
+
+  static void gc_walker(const std::string & txt, void * h)
+  { gc::gc_walk(txt, static_cast<holder *>(h)->p); }
+};
+
+// more roots than the first table of PtrPool and FPtrPool holds, each
+// keeps its own name when the table is enlarged.
+void root_names()
+{
+  const int N = 100;
+  static node * v[N];
+  static holder d[N];
+  int k;
+
+  for (k = 0; k < N; ++k) {
+    gc::register_root_ptr("r" + std::to_string(k), v[k]);
+    v[k] = new node(0, k);
+    gc::register_obj_("d" + std::to_string(k), & d[k], holder::gc_walker);
+    d[k].p = new node(0, -k);
+  }
+  gc::gc();
+  for (k = 0; k < N; ++k) {
+    std::vector<gc::retention_step> p = gc::retention_path(v[k]);
+    CHECK(! p.empty() && p.front().txt == "r" + std::to_string(k));
+    CHECK(v[k]->val == k);
+    p = gc::retention_path(d[k].p);
+    CHECK(! p.empty() && p.front().txt == "d" + std::to_string(k));
+    CHECK(d[k].p->val == -k);
+  }
+  for (k = 0; k < N; ++k) {
+    gc::unregister_root_ptr(v[k]);
+    gc::unregister_all_objs_(& d[k]);
+  }
+}
+
+// an object with a weak pointer in it.
+struct wholder : gc::gcobj {
+  wholder * next;
+  gc::weak_pointer<node> w;
+  long val;
+
+  wholder(wholder * n, node * t, long v) : next(n), w(t), val(v) { }
+
+  virtual void gc_walker(const std::string & txt);
+};
+
+void wholder::gc_walker(const std::string & txt)
+{
+  gc::gc_walk(txt, next);
+}
+
+// weak pointers inside objects that gc moves back and forth follow
+// their objects and are cleared when their targets die.
+void weak_pointer_moves()
+{
+  const long N = 30;
+  static node * t[N];
+  static wholder * holders;
+  long k;
+
+  gc::register_root_ptr("holders", holders);
+  for (k = 0; k < N; ++k) {
+    gc::register_root_ptr("target", t[k]);
+    t[k] = new node(0, k);
+    holders = new wholder(holders, t[k], k);
+  }
+  gc::gc();
+  gc::gc();
+  for (k = 1; k < N; k += 2)
+    t[k] = 0;
+  gc::gc();
+
+  for (wholder * h = holders; h; h = h->next) {
+    if (h->val % 2)
+      CHECK(h->w == 0);
+    else
+      CHECK(h->w != 0 && h->w->val == h->val);
+  }
+  gc::unregister_root_ptr(holders);
+  for (k = 0; k < N; ++k)
+    gc::unregister_root_ptr(t[k]);
+}
+
+// the register functions of pointer and weak_pointer return the
+// pointer itself so calls can be chained.
+void pointer_chaining()
+{
+  gc::pointer<node> p;
+  CHECK(& p.gc_register("p").gc_register("p2") == & p);
+  p = new node(0, 1);
+  gc::gc();
+  CHECK(& p.gc_unregister() == & p);
+  gc::gc();
+  CHECK(p->val == 1);
+  CHECK(& p.gc_unregister_all() == & p);
+
+  gc::weak_pointer<node> w;
+  gc::weak_pointer<node> w2(new node(0, 2));
+  w = w2;
+  CHECK(& w.wptr_unregister().wptr_register() == & w);
+  CHECK(w == w2);
+  gc::gc();
+  CHECK(w == 0 && w2 == 0);
+  CHECK(& w.wptr_unregister_all() == & w);
+}
+
+// more weak pointers than the first table holds, inside objects gc
+// moves and some unregistered out of order, still follow their objects
+// and are cleared when those die.
+void weak_pointer_order()
+{
+  const long N = 200;
+  static node * t[N];
+  static wholder * holders;
+  long k;
+
+  gc::register_root_ptr("holders", holders);
+  for (k = 0; k < N; ++k) {
+    gc::register_root_ptr("target", t[k]);
+    t[k] = new node(0, k);
+    holders = new wholder(holders, t[k], k);
+  }
+  // every third, in two passes so they go from all over the table.
+  for (wholder * h = holders; h; h = h->next)
+    if (h->val % 3 == 0 && h->val % 2 == 0)
+      h->w.wptr_unregister();
+  for (wholder * h = holders; h; h = h->next)
+    if (h->val % 3 == 0 && h->val % 2 != 0)
+      h->w.wptr_unregister();
+  gc::gc();
+  gc::gc();
+  for (k = 1; k < N; k += 2)
+    t[k] = 0;
+  gc::gc();
+
+  for (wholder * h = holders; h; h = h->next) {
+    if (h->val % 3 == 0)
+      continue;
+    if (h->val % 2)
+      CHECK(h->w == 0);
+    else
+      CHECK(h->w != 0 && h->w->val == h->val);
+  }
+  gc::unregister_root_ptr(holders);
+  for (k = 0; k < N; ++k)
+    gc::unregister_root_ptr(t[k]);
+}
+
+// frozen objects keep their contents, also when they go to blocks
+// that earlier frozen objects gave back.
+// larger than the Fremoved left in a free block, so an object frozen
+// into one must get its own size.
+struct fobj : gc::gcdataobj {
+  long val[8];
+
+  fobj(long v) { for (long & x : val) x = v; }
+
+  bool ok(long v) const
+  { for (long x : val) if (x != v) return false; return true; }
+};
+
+void freeze_contents()
+{
+  const int N = 50;
+  std::vector<gc::pointer<fobj> > v(N);
+  int k = 0;
+
+  while (k < N) {
+    v[k].gc_register("v");
+    v[k] = new fobj(k);
+    ++k;
+  }
+  for (k = 0; k < N; ++k) {
+    fobj * p = v[k];
+    gc::freeze(p);
+    CHECK(p == v[k] && p->ok(k));
+  }
+  // the first half back to the gc pool, their blocks merge into one
+  // free block.
+  for (k = 0; k < N/2; ++k) {
+    fobj * p = v[k];
+    gc::unfreeze(p);
+    CHECK(p->ok(k));
+  }
+  gc::gc();
+  // frozen again into pieces split off the free block and back, all
+  // of it comes along.
+  for (k = 0; k < N/2; ++k) {
+    fobj * p = v[k];
+    gc::freeze(p);
+    CHECK(p == v[k] && p->ok(k) && gc::gc_pointer_ok(p));
+    gc::unfreeze(p);
+    CHECK(p == v[k] && p->ok(k));
+  }
+  gc::gc();
+  for (k = 0; k < N; ++k)
+    CHECK(v[k]->ok(k) && gc::gc_pointer_ok((fobj *) v[k]));
+  // leave nothing frozen for the next check.
+  for (k = N/2; k < N; ++k) {
+    fobj * p = v[k];
+    gc::unfreeze(p);
+  }
+}
+
+// unfreeze() with do_ptrs false gives the caller the place in the gc
+// pool, nothing else updates its pointer.
+void unfreeze_no_ptrs()
+{
+  gc::pointer<node> a("a", new node(0, 3));
+  node * p = a;
+
+  gc::freeze(p, false);
+  CHECK(p->val == 3 && gc::gc_pointer_ok(p));
+  gc::unfreeze(p, false);
+  CHECK(p->val == 3 && gc::gc_pointer_ok(p));
+  a = p;
+  gc::gc();
+  CHECK(a->val == 3 && gc::gc_pointer_ok((node *) a));
+}
+
+// taking a block from the middle of the Fpool free list leaves the
+// rest of the list in order.
+void free_list_middle()
+{
+  const int N = 9;
+  std::vector<gc::pointer<fobj> > v(N);
+  gc::pointer<node> s("s", new node(0, -1));
+  int k;
+
+  // s lies between v[0] and v[1], its block is too small for an fobj.
+  for (k = 0; k < N; ++k) {
+    v[k].gc_register("v");
+    v[k] = new fobj(k);
+    fobj * p = v[k];
+    gc::freeze(p);
+    if (k == 0) {
+      node * q = s;
+      gc::freeze(q);
+    }
+  }
+  // free list is s, v[4], v[7].
+  node * q = s;
+  gc::unfreeze(q);
+  fobj * p = v[4];
+  gc::unfreeze(p);
+  p = v[7];
+  gc::unfreeze(p);
+
+  // the first takes v[4]'s block, the second must get v[7]'s.
+  gc::pointer<fobj> x("x", new fobj(10));
+  gc::pointer<fobj> y("y", new fobj(11));
+  p = x;
+  gc::freeze(p);
+  p = y;
+  gc::freeze(p);
+  CHECK(x != y && x->ok(10) && y->ok(11));
+  for (k = 0; k < N; ++k)
+    CHECK(v[k]->ok(k));
+  // leave nothing frozen for the next check.
+  for (k = 0; k < N; ++k)
+    if (k != 4 && k != 7) {
+      p = v[k];
+      gc::unfreeze(p);
+    }
+  p = x;
+  gc::unfreeze(p);
+  p = y;
+  gc::unfreeze(p);
+}
+
+// an object frozen and unfrozen again without updating pointers is
+// found through both moves, from each pointer to it.
+void refreeze_no_ptrs()
+{
+  gc::pointer<node> a("a", new node(new node(0, 2), 1));
+  gc::pointer<node> b("b", a->next);
+  node * p = b;
+
+  gc::freeze(p, false);
+  gc::unfreeze(p, false);
+  gc::gc();
+  CHECK(a->next == b && b->val == 2 && a->val == 1);
+  CHECK(gc::gc_pointer_ok(a->next));
+
+  // and frozen once more, the pointers end up in Fpool.
+  p = b;
+  gc::freeze(p, false);
+  gc::unfreeze(p, false);
+  gc::freeze(p, false);
+  gc::gc();
+  CHECK(a->next == p && b == p && p->val == 2);
+  CHECK(gc::gc_pointer_ok(a->next));
+  gc::unfreeze(p);
+  CHECK(a->next == p && b == p && p->val == 2);
+}
+
+// a large object that counts how many are alive.
+struct lobj : gc::gcdataobj {
+  static int live;
+  char b[200*1024];
+
+  lobj() { ++live; }
+  ~lobj() { --live; }
+};
+
+int lobj::live = 0;
+
+// large objects that die in gc, are deleted, or are still alive when
+// the heap goes all have their destructor run once and their block
+// freed, the leak checker sees the rest.
+void large_cleanup()
+{
+  lobj::live = 0;
+  {
+    gc::heap h(32*1024*1024, 32*1024*1024);
+    gc::heap::scope s(h);
+    gc::pointer<lobj> a("a", new lobj);
+    gc::pointer<lobj> b("b", new lobj);
+    gc::pointer<lobj> c("c", new lobj);
+
+    new lobj;
+    new lobj;
+    CHECK(lobj::live == 5);
+    gc::gc();
+    CHECK(lobj::live == 3);
+    lobj * p = c;
+    c = 0;
+    delete p;
+    CHECK(lobj::live == 2);
+  }
+  CHECK(lobj::live == 0);
+}
+
+// counts destructor calls, val must still be there when it runs.
+struct fin : gc::gcdataobj {
+  static int dead;
+  static int bad;
+  long val;
+
+  fin(long v) : val(v) { }
+  ~fin() { ++dead; if (val != 42) ++bad; }
+};
+
+int fin::dead = 0;
+int fin::bad = 0;
+
+struct fin_nofinal : gc::nofinal<gc::gcdataobj> {
+  ~fin_nofinal() { ++fin::dead; }
+};
+
+// unreachable objects wait for run_finalizers() with
+// FINALIZE_ON_DEMAND, budget limits each call and nofinal objects are
+// never counted. FINALIZE_AFTER_GC runs them by the end of gc().
+void finalizer_counts()
+{
+  const int N = 20;
+  int k;
+
+  fin::dead = fin::bad = 0;
+  gc::set_finalize_mode(gc::FINALIZE_ON_DEMAND);
+  for (k = 0; k < N; ++k) {
+    new fin(42);
+    new fin_nofinal;
+  }
+  gc::gc();
+  CHECK(fin::dead == 0 && gc::pending_finalizers() == N);
+  CHECK(gc::run_finalizers(5) == 5 && fin::dead == 5);
+  CHECK(gc::pending_finalizers() == N - 5);
+  CHECK(gc::run_finalizers() == N - 5 && fin::dead == N);
+  CHECK(gc::pending_finalizers() == 0);
+
+  gc::set_finalize_mode(gc::FINALIZE_AFTER_GC);
+  gc::pointer<fin> keep("keep", new fin(42));
+  for (k = 0; k < N; ++k)
+    new fin(42);
+  gc::gc();
+  CHECK(fin::dead == 2*N && gc::pending_finalizers() == 0);
+  CHECK(keep->val == 42 && fin::bad == 0);
+
+  // copies that fill several chunks, half are destroyed before the
+  // next gc adds more.
+  const int M = 10000;
+  gc::set_finalize_mode(gc::FINALIZE_ON_DEMAND);
+  for (k = 0; k < M; ++k)
+    new fin(42);
+  gc::gc();
+  CHECK(gc::run_finalizers(M/2) == M/2);
+  for (k = 0; k < M; ++k)
+    new fin(42);
+  gc::gc();
+  CHECK(gc::pending_finalizers() == M + M/2);
+  CHECK(gc::run_finalizers() == M + M/2);
+  CHECK(fin::dead == 2*N + 2*M && fin::bad == 0);
+  gc::set_finalize_mode(gc::FINALIZE_IN_GC);
+}
+
+struct mnode : gc::mapped<mnode> {
+  mnode * l;
+  mnode * r;
+  long val;
+
+  mnode(long v = 0) : l(0), r(0), val(v) { }
+
+  typedef gc::fields<&mnode::l, &mnode::r> gc_fields;
+};
+
+// adds a pointer the field map of mnode doesn't know about.
+struct mnode_ext : mnode {
+  node * extra;
+
+  mnode_ext(long v) : mnode(v), extra(0) { }
+
+  virtual void gc_walker(const std::string & txt);
+};
+
+void mnode_ext::gc_walker(const std::string & txt)
+{
+  mnode::gc_walker(txt);
+  gc::gc_walk(txt, extra);
+}
+
+// the fields of a mapped class are walked and follow their objects, a
+// derived class with a pointer of its own is walked by its gc_walker.
+void mapped_fields()
+{
+  gc::pointer<mnode> root("root", new mnode(1));
+  root->l = new mnode(2);
+  root->r = new mnode(3);
+  root->r->l = new mnode(4);
+  mnode * e = new mnode_ext(5);
+  root->r->r = e;
+  node * x = new node(0, 42);
+  static_cast<mnode_ext *>(root->r->r)->extra = x;
+
+  int round = 0;
+  while (round++ < 3) {
+    // garbage that reuses the space of anything gc missed.
+    int k = 0;
+    while (k++ < 1000)
+      new node(0, -1);
+    gc::gc();
+  }
+  CHECK(root->val == 1);
+  CHECK(root->l->val == 2);
+  CHECK(root->r->val == 3);
+  CHECK(root->r->l->val == 4 && root->r->r->val == 5);
+  CHECK(static_cast<mnode_ext *>(root->r->r)->extra->val == 42);
+}
+
+// every copy order moves a list and keeps it in order, also when two
+// roots share its tail.
+void copy_orders()
+{
+  const int N = 1000;
+  const int orders[] = { gc::COPY_DEPTH_FIRST, gc::COPY_HIERARCHICAL,
+			 gc::COPY_BREADTH_FIRST };
+
+  for (int order : orders) {
+    int old = gc::set_copy_order(order);
+    gc::pointer<node> a("a");
+    gc::pointer<node> b("b");
+    int k;
+
+    for (k = 0; k < N; ++k) {
+      a = new node(a, k);
+      if (k == N/2)
+	b = a;
+      new node(0, -1);
+    }
+    gc::gc();
+    gc::gc();
+    node * p = a;
+    k = N;
+    while (p && --k >= 0 && p->val == k) {
+      if (k == N/2)
+	CHECK(p == b);
+      p = p->next;
+    }
+    CHECK(p == 0 && k == 0);
+    gc::set_copy_order(old);
+  }
+
+  // breadth first goes one pointer from all roots before two.
+  {
+    int old = gc::set_copy_order(gc::COPY_BREADTH_FIRST);
+    gc::pointer<node> a("a", new node(new node(0, 1), 0));
+    gc::pointer<node> b("b", new node(new node(0, 1), 0));
+    gc::gc();
+    node * first = a < b ? b : a;
+    CHECK(first < a->next && first < b->next);
+    gc::set_copy_order(old);
+  }
+
+  // a list too long to walk recursively, the orders that queue don't.
+  const int L = 1000000;
+  for (int order : { gc::COPY_HIERARCHICAL, gc::COPY_BREADTH_FIRST }) {
+    int old = gc::set_copy_order(order);
+    gc::pointer<node> a("a");
+    int k;
+
+    for (k = 0; k < L; ++k)
+      a = new node(a, k);
+    gc::gc();
+    node * p = a;
+    k = L;
+    while (p && --k >= 0 && p->val == k)
+      p = p->next;
+    CHECK(p == 0 && k == 0);
+    gc::set_copy_order(old);
+  }
+}
+
+// the elements of a pointer array keep their objects alive and follow
+// them, a large one too, and a data array keeps its contents.
+void array_walk()
+{
+  const std::size_t N = 1000, L = 64*1024;
+  gc::pointer<gc::array<node *> > a("a", gc::array<node *>::make(N));
+  gc::pointer<gc::array<node *> > b("b", gc::array<node *>::make(L));
+  gc::pointer<gc::array<long> > d("d", gc::array<long>::make(N));
+  std::size_t k;
+
+  CHECK(a->size() == N && (*a)[N - 1] == 0 && (*d)[0] == 0);
+  for (k = 0; k < N; ++k) {
+    (*a)[k] = new node(0, k);
+    (*d)[k] = k;
+  }
+  for (k = 0; k < L; k += 1000)
+    (*b)[k] = (*a)[k/1000];
+  gc::gc();
+  gc::gc();
+  for (k = 0; k < N; ++k)
+    CHECK((*a)[k]->val == long(k) && (*d)[k] == long(k));
+  for (k = 0; k < L; k += 1000)
+    CHECK((*b)[k] == (*a)[k/1000] && (*b)[k + 1] == 0);
+}
+
+// the name of key k.
+std::string cont_key(int k)
+{
+  char buf[16];
+  std::snprintf(buf, sizeof buf, "key%d", k);
+  return buf;
+}
+
+// containers grow across gcs, a hash_map rehashes while its keys move
+// and erase leaves the rest to be found, all of it survives gc.
+void containers()
+{
+  typedef gc::hash_map<gc::string *, long> map;
+  const int N = 2000;
+  gc::pointer<gc::string> s("s", gc::string::make("hello, world"));
+  gc::pointer<gc::vector<long> > v("v", new gc::vector<long>);
+  gc::pointer<gc::vector<node *> > w("w", new gc::vector<node *>);
+  gc::pointer<map> m("m", new map);
+  int n = gc::num_gc();
+  int k;
+
+  for (k = 0; k < N; ++k) {
+    v->push_back(k);
+    // allocate before calling, gc may move the container.
+    node * x = new node(0, k);
+    w->push_back(x);
+    gc::string * ks = gc::string::make(cont_key(k));
+    m->set(ks, k);
+    // garbage so that gc runs, also from inside the containers.
+    for (int j = 0; j < 16; ++j)
+      gc::array<long>::make(1000);
+  }
+  CHECK(gc::num_gc() > n);
+  CHECK(v->size() == N && w->size() == N && m->size() == N);
+  for (k = 0; k < N; ++k) {
+    CHECK((*v)[k] == k && (*w)[k]->val == k);
+    const long * x = m->find(std::string_view(cont_key(k)));
+    CHECK(x && *x == k);
+  }
+
+  for (k = 0; k < N; k += 3)
+    CHECK(m->erase(std::string_view(cont_key(k))));
+  CHECK(! m->erase(std::string_view(cont_key(0))));
+  gc::gc();
+  CHECK(m->size() == N - (N + 2)/3);
+  for (k = 0; k < N; ++k) {
+    const long * x = m->find(std::string_view(cont_key(k)));
+    if (k % 3 == 0)
+      CHECK(x == 0);
+    else
+      CHECK(x && *x == k);
+  }
+  // set after erase reuses the deleted slots.
+  for (k = 0; k < N; k += 3) {
+    gc::string * ks = gc::string::make(cont_key(k));
+    CHECK(m->set(ks, -k));
+  }
+  gc::gc();
+  CHECK(m->size() == N && *m->find(std::string_view(cont_key(3))) == -3);
+  CHECK(s->view() == "hello, world" && s->c_str()[s->size()] == 0);
+}
+
+// entries of a weak_intern_table go away with their objects, the rest
+// follow their objects through gc. An ephemeron entry goes with its key
+// even if the value points back to it.
+void weak_table_purge()
+{
+  const int N = 100;
+  gc::weak_intern_table<int, node> T;
+  std::vector<gc::pointer<node> > keep(N/2);
+  int k;
+
+  for (k = 0; k < N; ++k) {
+    node * n = T.intern(k, [&] { return new node(0, k); });
+    if (k % 2 == 0)
+      keep[k/2].gc_register("keep") = n;
+  }
+  CHECK(T.size() == N);
+  gc::gc();
+  CHECK(T.size() == N/2);
+  for (k = 0; k < N; ++k) {
+    node * n = T.find(k);
+    CHECK(k % 2 ? n == 0 : n == keep[k/2] && n->val == k);
+  }
+
+  gc::ephemeron_table<node, node> E;
+  node * v = new node(0, 1);
+  v->next = keep[0];
+  E.insert(keep[0], v);
+  E.insert(keep[1], new node(keep[1], 2));
+  keep[0] = 0;
+  gc::gc();
+  CHECK(E.size() == 1 && E.find(keep[1]) && E.find(keep[1])->val == 2);
+}
+
+// pinned objects stay where they are through gc and keep what they
+// point to alive, once unfrozen and unreachable they are destroyed.
+void pinned_objects()
+{
+  fin::dead = fin::bad = 0;
+  lobj::live = 0;
+  fin * f = new (gc::pinned) fin(42);
+  lobj * l = new (gc::pinned) lobj;
+  gc::array<char> * b = gc::array<char>::make(4096, gc::pinned);
+  gc::pointer<node> p("p", new (gc::pinned) node(new node(0, 2), 1));
+  node * pn = p;
+
+  std::memset(b->data(), 'x', b->size());
+  int round = 0;
+  while (round++ < 3) {
+    int k = 0;
+    while (k++ < 1000)
+      new node(0, -1);
+    gc::gc();
+  }
+  CHECK(p == pn && p->val == 1 && p->next->val == 2);
+  CHECK(gc::gc_pointer_ok(p->next));
+  CHECK(f->val == 42 && fin::dead == 0 && lobj::live == 1);
+  CHECK((*b)[0] == 'x' && (*b)[b->size() - 1] == 'x');
+
+  gc::unfreeze(f);
+  gc::unfreeze(l);
+  gc::unfreeze(b);
+  gc::gc();
+  CHECK(fin::dead == 1 && fin::bad == 0 && lobj::live == 0);
+  // deleting one works as for any frozen object.
+  node * q = new (gc::pinned) node(0, 3);
+  delete q;
+  CHECK(gc::gc_pointer_ok(p->next) && p->next->val == 2);
+  pn = p;
+  gc::unfreeze(pn);
+}
+
+// a mapped_file and a buffer keep their place and their bytes through
+// gc while reachable, and are unmapped or freed when they are not.
+void mapped_file_buffer()
+{
+  const std::size_t N = 3*4096 + 100;
+  char fn[] = "/tmp/gccheckXXXXXX";
+  int fd = ::mkstemp(fn);
+  CHECK(fd >= 0);
+  if (fd < 0) return;
+  std::string s(N, 0);
+  for (std::size_t k = 0; k < N; ++k)
+    s[k] = 'a' + k % 26;
+  CHECK(::write(fd, s.data(), N) == ssize_t(N));
+  ::close(fd);
+
+  int mapped = gc::num_cur_mapped();
+  gc::pointer<gc::mapped_file> r("r", gc::mapped_file::open(fn));
+  gc::pointer<gc::mapped_file> w("w",
+    gc::mapped_file::open(fn, gc::mapped_file::PRIVATE, 4096 + 10, 20));
+  gc::pointer<gc::buffer> b("b", gc::buffer::make(64*1024));
+  gc::mapped_file::open(fn, gc::mapped_file::READ_ONLY, 100);
+  gc::buffer::make(64*1024);
+  const char * rp = r->data();
+  char * bp = b->data();
+
+  std::memset(bp, 'x', b->size());
+  w->wdata()[0] = '!';
+  CHECK(gc::num_cur_mapped() == mapped + 3);
+  int allocs = gc::num_cur_allocs();
+  int round = 0;
+  while (round++ < 3) {
+    int k = 0;
+    while (k++ < 1000)
+      new node(0, -1);
+    gc::gc();
+  }
+  CHECK(gc::num_cur_mapped() == mapped + 2);
+  CHECK(gc::num_cur_allocs() <= allocs - 2);
+  CHECK(r->data() == rp && r->size() == N && r->wdata() == 0);
+  CHECK(std::memcmp(r->data(), s.data(), N) == 0);
+  CHECK(w->size() == 20 && w->data()[0] == '!');
+  CHECK(std::memcmp(w->data() + 1, s.data() + 4096 + 11, 19) == 0);
+  CHECK(b->data() == bp && bp[0] == 'x' && bp[b->size() - 1] == 'x');
+  struct iovec v = b->iov(100, 200);
+  CHECK(v.iov_base == bp + 100 && v.iov_len == 200);
+  v = r->iov(N - 10);
+  CHECK(v.iov_base == rp + N - 10 && v.iov_len == 10);
+
+  // the copy on write change is not in the file.
+  r = 0;
+  w = 0;
+  gc::gc();
+  CHECK(gc::num_cur_mapped() == mapped);
+  gc::pointer<gc::mapped_file> again("again", gc::mapped_file::open(fn));
+  CHECK(std::memcmp(again->data(), s.data(), N) == 0);
+  again = 0;
+  ::unlink(fn);
+}
+
+struct inode : gc::mapped<inode> {
+  inode * next;
+  inode * first;
+  gc::array<long> * a;
+  long val;
+
+  inode(inode * n, long v) : next(n), first(0), a(0), val(v) { }
+  inode(const gc::image_t &) { }
+
+  typedef gc::fields<&inode::next, &inode::first, &inode::a> gc_fields;
+};
+
+// number of mappings of file fn in /proc/self/maps.
+int maps_of(const std::string & fn)
+{
+  std::FILE * f = std::fopen("/proc/self/maps", "r");
+  char line[4096];
+  int n = 0;
+
+  if (f == 0) return 0;
+  while (std::fgets(line, sizeof(line), f))
+    if (std::strstr(line, fn.c_str()))
+      ++n;
+  std::fclose(f);
+  return n;
+}
+
+// a list saved with save_image() and dropped comes back with the image
+// through a root of the same label, frozen and with its pointers
+// relocated. The image is unmapped with its heap.
+void image_round_trip()
+{
+  const int N = 100;
+  std::string fn = "/tmp/gc-check-" + std::to_string(getpid()) + ".img";
+  {
+    gc::heap h(32*1024*1024, 32*1024*1024);
+    gc::heap::scope s(h);
+    gc::pointer<inode> l("list");
+    int k;
+
+    gc::image_type<inode>();
+    gc::image_type<gc::array<long> >();
+    for (k = N; k-- > 0; )
+      l = new inode(l, k);
+    l->a = gc::array<long>::make(N);
+    for (inode * p = l; p; p = p->next) {
+      p->first = l;
+      (*l->a)[p->val] = p->val*p->val;
+    }
+    new inode(0, -1); // garbage isn't saved.
+    CHECK(gc::save_image(fn) == N + 1);
+    l = 0;
+    gc::gc();
+
+    int frozen = gc::num_cur_frozen();
+    CHECK(gc::load_image(fn) == N + 1);
+    std::remove(fn.c_str());
+    CHECK(l != 0 && gc::num_cur_frozen() == frozen + N + 1);
+    for (int pass = 0; pass < 2 && l; ++pass) {
+      k = 0;
+      for (inode * p = l; p; p = p->next, ++k)
+	CHECK(p->val == k && p->first == l && (*l->a)[k] == long(k)*k);
+      CHECK(k == N);
+      gc::gc();
+    }
+    CHECK(maps_of(fn) > 0);
+  }
+  CHECK(maps_of(fn) == 0);
+}
+
+// a few thousand fill a frozen minipool, still small enough for the
+// gc pool.
+struct fbig : gc::gcdataobj {
+  long val[500];
+
+  fbig(long v) { val[0] = val[499] = v; }
+
+  bool ok(long v) const { return val[0] == v && val[499] == v; }
+};
+
+// after gc, Fpool minipools left empty are deleted except the first,
+// and the pages of a large free block in a minipool still in use are
+// given back.
+void frozen_release()
+{
+  const std::size_t N = 64*1024;
+  gc::frozen_pool_info f0 = gc::frozen_pool_stats();
+  gc::pointer<gc::array<fbig *> > v("v", gc::array<fbig *>::make(N));
+  std::size_t n = 0, k, last = 0;
+
+  // two more minipools, last is the last one in the first of them.
+  // do_ptrs false, the array is set here.
+  while (n < N && gc::frozen_pool_stats().pools < f0.pools + 3) {
+    fbig * p = new fbig(n);
+    gc::freeze(p, false);
+    (*v)[n++] = p;
+    if (last == 0 && gc::frozen_pool_stats().pools > f0.pools + 1)
+      last = n - 2;
+  }
+  std::size_t pools = gc::frozen_pool_stats().pools;
+  CHECK(last > 0);
+
+  for (k = 1; k < n; ++k) {
+    if (k == last) continue;
+    fbig * p = (*v)[k];
+    gc::unfreeze(p, false);
+    (*v)[k] = p;
+  }
+  gc::gc();
+  gc::frozen_pool_info fi = gc::frozen_pool_stats();
+  CHECK(fi.pools == f0.pools + 1);
+  CHECK(fi.pools_released == f0.pools_released + pools - f0.pools - 1);
+  CHECK(fi.released > f0.released);
+  for (k = 0; k < n; ++k)
+    CHECK((*v)[k]->ok(k));
+  fbig * p = (*v)[0];
+  gc::unfreeze(p, false);
+  (*v)[0] = p;
+  p = (*v)[last];
+  gc::unfreeze(p);
+}
+
+
+// a medium sized object with a destructor and a pointer.
+struct mobj : gc::gcobj {
+  static int dead;
+  node * n;
+  long val;
+  char pad[10*1024];
+
+  mobj(node * p, long v) : n(p), val(v) { }
+  ~mobj() { ++dead; }
+
+  virtual void gc_walker(const std::string & txt) { gc::gc_walk(txt, n); }
+};
+
+int mobj::dead = 0;
+
+
+// medium objects stay where they are, what they point to is kept, dead
+// ones get their destructor once and their slots are taken again.
+void medium_sweep()
+{
+  const int N = 50;
+  std::vector<gc::pointer<mobj> > v(N);
+  std::vector<mobj *> at(N);
+  int k;
+
+  mobj::dead = 0;
+  for (k = 0; k < N; ++k) {
+    v[k].gc_register("v");
+    at[k] = v[k] = new mobj(new node(0, k), k);
+  }
+  for (k = 1; k < N; k += 2)
+    v[k] = 0;
+  gc::gc();
+  gc::gc();
+  CHECK(mobj::dead == N/2);
+  for (k = 0; k < N; k += 2)
+    CHECK(v[k] == at[k] && v[k]->val == k && v[k]->n->val == k);
+
+  // the new ones fill the slots of the dead.
+  std::size_t reused = 0;
+  for (k = 1; k < N; k += 2) {
+    v[k] = new mobj(0, k);
+    for (int j = 1; j < N; j += 2)
+      if (v[k] == at[j]) ++reused;
+  }
+  CHECK(reused == N/2);
+  CHECK(mobj::dead == N/2);
+}
+
+// once the live data shrinks, the half gc copied from is given back
+// and rss drops by about what it held.
+void semispace_rss()
+{
+  const std::size_t M = 1024*1024;
+  const int N = 16*1024; // of 2K each.
+  int old = gc::set_semispace_release(gc::RELEASE_DONTNEED);
+  gc::semispace_info s0 = gc::semispace_stats();
+  gc::pointer<gc::array<gc::array<long> *> > v("v",
+    gc::array<gc::array<long> *>::make(N));
+  int k;
+
+  // 32M of live data, copied to the other half by the next gc.
+  for (k = 0; k < N; ++k) {
+    gc::array<long> * a = gc::array<long>::make(256);
+    std::memset(a->data(), 1, a->size()*sizeof(long));
+    (*v)[k] = a;
+  }
+  gc::gc();
+  // all but one go, the next gc copies from the full half.
+  for (k = 1; k < N; ++k)
+    (*v)[k] = 0;
+  gc::gc();
+  gc::semispace_info si = gc::semispace_stats();
+  CHECK(si.releases > s0.releases && si.released >= 16*M);
+  CHECK(si.rss_before > si.rss_after + 16*M);
+  CHECK((*(*v)[0])[255] == 0x0101010101010101L);
+  gc::set_semispace_release(old);
+}
+
+// report() writes gc time past a minute as hh:mm:ss.
+void report_gc_time()
+{
+  gc::statistics S;
+  struct timeval t = { 3*3600 + 25*60 + 7, 250000 };
+  std::ostringstream os;
+
+  S.gc_add_timing(t);
+  S.report(os);
+  CHECK(os.str().find("(03:25:07.250000)") != std::string::npos);
+}
+
+// drops the objects a heap_callback was given.
+void drop_all(std::size_t, std::size_t, void * data)
+{
+  static_cast<std::vector<gc::pointer<lobj> > *>(data)->clear();
+}
+
+// with a heap limit, a callback gets to drop a cache first, then one
+// emergency gc is done and past that allocation fails with
+// gc_allocation_error while the heap stays below the limit and usable.
+void heap_limit_failure()
+{
+  // small pools so the large objects are most of the heap.
+  gc::heap h(1024*1024, 64*1024);
+  gc::heap::scope s(h);
+  std::vector<gc::pointer<lobj> > cache, keep;
+  std::size_t base = gc::heap_stats().size;
+  std::size_t lim = base + 4*1024*1024;
+  bool thrown = false;
+  int k;
+
+  lobj::live = 0;
+  gc::set_heap_limit(lim);
+  // called about 1M above where we start.
+  gc::add_heap_callback((base + 1024*1024)*100/lim + 1, drop_all, & cache);
+  for (k = 0; k < 100 && gc::heap_stats().callbacks == 0; ++k)
+    cache.emplace_back("cache", new lobj);
+  CHECK(k > 1 && k < 100 && cache.size() == 1);
+
+  try {
+    for (k = 0; k < 100; ++k)
+      keep.emplace_back("keep", new lobj);
+  } catch (gc::gc_allocation_error &) {
+    thrown = true;
+  }
+  gc::heap_info hi = gc::heap_stats();
+  CHECK(thrown && k > 0 && k < 100);
+  CHECK(hi.size <= lim && hi.peak <= lim && hi.limit == lim);
+  // the callback fires again once gc took the heap below it.
+  CHECK(hi.callbacks >= 1 && hi.emergency_gcs > 0 && hi.refused == 1);
+
+  cache.clear();
+  keep.clear();
+  gc::gc();
+  keep.emplace_back("keep", new lobj);
+  CHECK(lobj::live == 1);
+}
+
+// an arena nothing points into is discarded when it closes, what was
+// allocated outside it stays.
+void arena_discard()
+{
+  gc::pointer<node> keep("keep", new node(0, 1));
+  gc::arena_info a0 = gc::arena_stats();
+
+  {
+    gc::arena_scope a;
+    node * n = 0;
+    int k = 0;
+    while (k < 100)
+      n = new node(n, k++);
+  }
+  gc::arena_info a1 = gc::arena_stats();
+  CHECK(a1.opened == a0.opened + 1);
+  CHECK(a1.discarded == a0.discarded + 1 && a1.promoted == a0.promoted);
+  CHECK(a1.size_discarded > a0.size_discarded);
+  gc::gc();
+  CHECK(keep->val == 1);
+}
+
+// a small JSON reader, enough to tell whether the phase trace parses.
+struct json {
+  const char * p;
+
+  void ws() { while (*p == ' ' || *p == '\n' || *p == '\t' || *p == '\r') ++p; }
+  bool lit(const char * s)
+  { std::size_t n = std::strlen(s); if (std::strncmp(p, s, n)) return false; p += n; return true; }
+  bool str()
+  {
+    if (*p++ != '"') return false;
+    while (*p != '"') {
+      if (*p == 0 || (unsigned char) *p < ' ') return false;
+      if (*p++ == '\\' && *p++ == 0) return false;
+    }
+    ++p;
+    return true;
+  }
+  bool num()
+  {
+    const char * s = p;
+    if (*p == '-') ++p;
+    while (*p >= '0' && *p <= '9') ++p;
+    if (p == s || (*s == '-' && p == s + 1)) return false;
+    if (*p == '.') {
+      s = ++p;
+      while (*p >= '0' && *p <= '9') ++p;
+      if (p == s) return false;
+    }
+    return true;
+  }
+  bool value()
+  {
+    ws();
+    if (*p == '{' || *p == '[') {
+      char close = *p++ == '{' ? '}' : ']';
+      ws();
+      if (*p == close) { ++p; return true; }
+      for (;;) {
+	if (close == '}') {
+	  ws();
+	  if (! str()) return false;
+	  ws();
+	  if (*p++ != ':') return false;
+	}
+	if (! value()) return false;
+	ws();
+	if (*p == close) { ++p; return true; }
+	if (*p++ != ',') return false;
+      }
+    }
+    if (*p == '"') return str();
+    if (lit("true") || lit("false") || lit("null")) return true;
+    return num();
+  }
+  bool doc() { if (! value()) return false; ws(); return *p == 0; }
+};
+
+// one "X" event of the phase trace, times in ns.
+struct trace_event {
+  std::string name;
+  unsigned long start, end;
+  int tid;
+};
+
+// the phase trace is valid JSON and, per thread, its "X" events nest:
+// a phase that starts inside another ends inside it too.
+void phase_trace_json()
+{
+  gc::pointer<node> l("l");
+  std::vector<trace_event> ev;
+  std::ostringstream os;
+  int k = 0;
+
+  gc::set_phase_trace();
+  while (k < 1000)
+    l = new node(l, k++);
+  gc::gc();
+  gc::gc_update_pointers();
+  node * n = l;
+  gc::freeze(n);
+  gc::unfreeze(n);
+  l = n;
+  gc::phase_trace(os);
+  gc::set_phase_trace(0);
+
+  std::string s = os.str();
+  json j = { s.c_str() };
+  CHECK(j.doc());
+  std::istringstream is(s);
+  std::string line;
+  while (std::getline(is, line)) {
+    char name[64];
+    unsigned long ts, tsf, dur, durf;
+    int pid, tid;
+    if (std::sscanf(line.c_str(),
+		    "{\"name\":\"%63[^\"]\",\"cat\":\"gc\",\"ph\":\"X\","
+		    "\"ts\":%lu.%lu,\"dur\":%lu.%lu,\"pid\":%d,\"tid\":%d",
+		    name, & ts, & tsf, & dur, & durf, & pid, & tid) != 7)
+      continue;
+    trace_event e = { name, ts*1000 + tsf, 0, tid };
+    e.end = e.start + dur*1000 + durf;
+    ev.push_back(e);
+  }
+  int gcs = 0, inner = 0;
+  for (const trace_event & a : ev) {
+    if (a.name == "gc") ++gcs;
+    for (const trace_event & b : ev) {
+      if (& a == & b || a.tid != b.tid) continue;
+      // b starts inside a, so it must end there too.
+      if (b.start > a.start && b.start < a.end) {
+	CHECK(b.end <= a.end);
+	if (a.name == "gc") ++inner;
+      }
+    }
+  }
+  CHECK(gcs >= 1 && inner > 0);
+  for (const char * p : { "update pointers", "freeze", "unfreeze" }) {
+    bool seen = false;
+    for (const trace_event & e : ev)
+      seen = seen || e.name == p;
+    CHECK(seen);
+  }
+  CHECK(l->val == 999);
+}
+
+// tags of cleared weak pointers end up in their queue, the others and
+// pointers whose queue is gone don't.
+void reference_queue_tags()
+{
+  gc::reference_queue q;
+  gc::pointer<node> keep("keep");
+  std::vector<gc::weak_pointer<node> *> w;
+
+  long k = 0;
+  while (k < 20) {
+    node * n = new node(0, k);
+    if (k % 4 == 0) {
+      n->next = keep;
+      keep = n;
+    }
+    w.push_back(new gc::weak_pointer<node>(n, q, (void *) k));
+    ++k;
+  }
+  // already registered, only the queue is set.
+  gc::weak_pointer<node> late(new node(0, 100));
+  late.set_queue(q, (void *) 100);
+  CHECK(q.empty());
+  gc::gc();
+
+  CHECK(q.size() == 16);
+  void * tag;
+  std::vector<bool> seen(101, false);
+  while (q.poll(tag))
+    seen[(long) tag] = true;
+  k = 0;
+  while (k < 20) {
+    CHECK(seen[k] == (k % 4 != 0));
+    CHECK((*w[k] != 0) == (k % 4 == 0));
+    ++k;
+  }
+  CHECK(seen[100]);
+  CHECK(late == 0);
+
+  // a weak pointer destroyed before gc and one whose queue is gone add
+  // nothing.
+  keep = 0;
+  delete w[0];
+  {
+    gc::reference_queue q2;
+    w[4]->set_queue(q2, (void *) 4);
+  }
+  gc::gc();
+  std::vector<void *> v;
+  CHECK(q.drain(v) == 3);
+  CHECK(q.empty());
+  for (void * t : v)
+    CHECK(t == (void *) 8 || t == (void *) 12 || t == (void *) 16);
+  k = 1;
+  while (k < 20)
+    delete w[k++];
+}
+
+// an arena that a plain member of an object outside or a root points
+// into is promoted and what is reachable in it survives gc.
+void arena_promote()
+{
+  gc::pointer<node> keep("keep", new node(0, 1));
+  gc::pointer<node> root("root");
+  gc::arena_info a1 = gc::arena_stats();
+
+  {
+    gc::arena_scope a;
+    keep->next = new node(new node(0, 3), 2);
+  }
+  gc::arena_info a2 = gc::arena_stats();
+  CHECK(a2.promoted == a1.promoted + 1);
+
+  {
+    gc::arena_scope a;
+    root = new node(0, 4);
+  }
+  gc::arena_info a3 = gc::arena_stats();
+  CHECK(a3.promoted == a2.promoted + 1);
+
+  int round = 0;
+  while (round++ < 3) {
+    // garbage that reuses the space of anything gc missed.
+    gc::arena_scope a;
+    int k = 0;
+    while (k++ < 1000)
+      new node(0, -1);
+    gc::gc();
+  }
+  CHECK(keep->next->val == 2);
+  CHECK(keep->next->next->val == 3);
+  CHECK(root->val == 4);
+  CHECK(gc::arena_stats().discarded == a3.discarded + 3);
+}
+
+// pointers, weak pointers and queues made in one heap and destroyed
+// while another is current leave nothing behind in theirs.
+void heap_owner()
+{
+  gc::heap h2(4*1024*1024, 4*1024*1024);
+  gc::pointer<node> * p;
+  gc::weak_pointer<node> * w;
+  gc::reference_queue * q;
+
+  {
+    gc::heap::scope s(h2);
+    p = new gc::pointer<node>("p", new node(0, 1));
+    q = new gc::reference_queue;
+    w = new gc::weak_pointer<node>(*p, *q, (void *) 1);
+    gc::gc();
+    CHECK(gc::num_cur_allocs() == 1);
+  }
+  delete w;
+  delete q;
+  delete p;
+  {
+    gc::heap::scope s(h2);
+    int k = 0;
+    while (k++ < 1000)
+      new node(0, -1);
+    gc::gc();
+    CHECK(gc::num_cur_allocs() == 0);
+  }
+}
+
+// an object kept only by an ephemeron value whose key is two pointers
+// from a root, and one kept by the value of an ephemeron whose key is
+// in turn such a value, both have a path.
+void retention_ephemeron()
+{
+  gc::pointer<node> root("root", new node(new node(0, 1), 0));
+  gc::ephemeron_table<node, node> E;
+
+  node * t1 = new node(0, 10);
+  node * v1 = new node(t1, 11);
+  E.insert(root->next, v1);
+  node * t2 = new node(0, 20);
+  node * v2 = new node(t2, 21);
+  E.insert(t1, v2);
+
+  std::vector<gc::retention_step> p = gc::retention_path(t1);
+  CHECK(p.size() == 2);
+  CHECK(! p.empty() && p.front().txt == "ephemeron" && p.back().obj == t1);
+
+  p = gc::retention_path(t2);
+  CHECK(p.size() == 2);
+  CHECK(! p.empty() && p.front().obj == v2 && p.back().obj == t2);
+
+  CHECK(gc::retention_path(root->next).size() == 2);
+  CHECK(gc::retention_path(new node(0, -1)).empty());
+}
+
+// an arena that takes a fair part of the gc pool is traced and
+// discarded, also when the heap outside is several times larger.
+void arena_big_heap()
+{
+  gc::pointer<node> l("l");
+  std::vector<gc::pointer<lobj> > big;
+  int k = 0;
+
+  // a list and 40M of large objects next to the 32M gc pool.
+  while (k < 2000)
+    l = new node(l, k++);
+  for (k = 0; k < 200; ++k)
+    big.emplace_back("big", new lobj);
+  gc::arena_info a0 = gc::arena_stats();
+  {
+    gc::arena_scope a(4*1024*1024);
+    k = 0;
+    while (k++ < 1200) {
+      // points out of the arena, nothing points in.
+      gc::array<node *> * x = gc::array<node *>::make(900);
+      (*x)[0] = l;
+    }
+  }
+  gc::arena_info a1 = gc::arena_stats();
+  CHECK(a1.discarded == a0.discarded + 1 && a1.promoted == a0.promoted);
+  CHECK(a1.size_discarded - a0.size_discarded > 8*1024*1024);
+  gc::gc();
+  node * p = l;
+  k = 2000;
+  while (p && --k >= 0 && p->val == k)
+    p = p->next;
+  CHECK(p == 0 && k == 0);
+}
+
+struct lnode : gc::mapped<lnode> {
+  lnode * next;
+  gc::gcobj * data; // not in the map, walked by lnode_data.
+
+  lnode() : next(0), data(0) { }
+
+  typedef gc::fields<&lnode::next> gc_fields;
+};
+
+// the same size as lnode, walks data too.
+struct lnode_data : lnode {
+  virtual void gc_walker(const std::string & txt);
+};
+
+void lnode_data::gc_walker(const std::string & txt)
+{
+  lnode::gc_walker(txt);
+  gc::gc_walk(txt, data);
+}
+
+// an object of a derived class with the size of the mapped class is
+// walked by its own gc_walker, not by the map, in every copy order.
+void mapped_same_size()
+{
+  static_assert(sizeof(lnode_data) == sizeof(lnode), "same size");
+  const int orders[] = { gc::COPY_DEPTH_FIRST, gc::COPY_HIERARCHICAL,
+			 gc::COPY_BREADTH_FIRST };
+
+  for (int order : orders) {
+    int old = gc::set_copy_order(order);
+    gc::pointer<lnode> root("root", new lnode);
+    root->next = new lnode_data;
+    root->next->data = new node(0, 42);
+    int round = 0;
+    while (round++ < 3) {
+      int k = 0;
+      while (k++ < 1000)
+	new node(0, -1);
+      gc::gc();
+    }
+    CHECK(static_cast<node *>(root->next->data)->val == 42);
+    gc::set_copy_order(old);
+  }
+}
+
+struct check {
+  const char * name;
+  void (*f)();
+};
+
+const check C[] = {
+  { "sampler_counts", sampler_counts },
+  { "snapshot_dominators", snapshot_dominators },
+  { "shared_object", shared_object },
+  { "retention_shortest", retention_shortest },
+  { "unregister_all_roots", unregister_all_roots },
+  { "dangling_root", dangling_root },
+  { "root_names", root_names },
+  { "weak_pointer_moves", weak_pointer_moves },
+  { "pointer_chaining", pointer_chaining },
+  { "weak_pointer_order", weak_pointer_order },
+  { "freeze_contents", freeze_contents },
+  { "unfreeze_no_ptrs", unfreeze_no_ptrs },
+  { "free_list_middle", free_list_middle },
+  { "refreeze_no_ptrs", refreeze_no_ptrs },
+  { "large_cleanup", large_cleanup },
+  { "finalizer_counts", finalizer_counts },
+  { "mapped_fields", mapped_fields },
+  { "copy_orders", copy_orders },
+  { "array_walk", array_walk },
+  { "containers", containers },
+  { "weak_table_purge", weak_table_purge },
+  { "pinned_objects", pinned_objects },
+  { "mapped_file_buffer", mapped_file_buffer },
+  { "image_round_trip", image_round_trip },
+  { "frozen_release", frozen_release },
+  { "medium_sweep", medium_sweep },
+  { "semispace_rss", semispace_rss },
+  { "report_gc_time", report_gc_time },
+  { "heap_limit_failure", heap_limit_failure },
+  { "arena_discard", arena_discard },
+  { "phase_trace_json", phase_trace_json },
+  { "reference_queue_tags", reference_queue_tags },
+  { "arena_promote", arena_promote },
+  { "heap_owner", heap_owner },
+  { "retention_ephemeron", retention_ephemeron },
+  { "arena_big_heap", arena_big_heap },
+  { "mapped_same_size", mapped_same_size },
+};
+
+bool run(const check & c)
+{
+  failed = 0;
+  {
+    // a small heap of its own so checks don't see each other.
+    gc::heap h(32*1024*1024, 32*1024*1024);
+    gc::heap::scope s(h);
+    c.f();
+  }
+  std::printf("%s %s\n", c.name, failed ? "FAILED" : "ok");
+  std::fflush(stdout);
+  return failed == 0;
+}
+
+void usage()
+{
+  std::fprintf(stderr, "usage: check [name...]\nchecks:");
+  for (const check & c : C)
+    std::fprintf(stderr, " %s", c.name);
+  std::fprintf(stderr, "\n");
+  std::exit(2);
+}
+
+}; // end of anonymous namespace
+
+int main(int argc, char ** argv)
+{
+  std::vector<const check *> todo;
+  int k = 1;
+  bool ok = true;
+
+  while (k < argc) {
+    const check * c = 0;
+    for (const check & x : C)
+      if (std::strcmp(argv[k], x.name) == 0) c = & x;
+    if (c == 0) usage();
+    todo.push_back(c);
+    ++k;
+  }
+  if (todo.empty())
+    for (const check & x : C)
+      todo.push_back(& x);
+
+  for (const check * c : todo)
+    if (! run(*c))
+      ok = false;
+  return ok ? 0 : 1;
+}
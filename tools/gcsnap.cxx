@@ -0,0 +1,380 @@
+
+// gcsnap - read a heap snapshot written by alf::gc::heap_snapshot()
+// and report the objects and types that retain the most memory.
+//
+// usage: gcsnap [-n count] file
+//
+// The retained size of an object is the size of all objects that
+// would become garbage if that object was removed, i.e. the size of its
+// subtree in the dominator tree. Dominators are computed with the
+// iterative algorithm of Cooper, Harvey and Kennedy, "A Simple, Fast
+// Dominance Algorithm".
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cxxabi.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct node {
+  std::uint64_t addr;
+  std::uint64_t usz;
+  std::uint32_t type;
+  int gctype;
+  std::string label;
+};
+
+struct edge {
+  std::uint64_t from; // 0 is the root.
+  std::uint64_t to;
+};
+
+class reader {
+public:
+
+  reader(std::FILE * f) : f_(f), ok_(true) { }
+
+  bool ok() const { return ok_; }
+  void fail() { ok_ = false; }
+
+  void get(void * p, std::size_t n)
+  { if (ok_ && std::fread(p, 1, n, f_) != n) ok_ = false; }
+
+  std::uint8_t u8() { std::uint8_t v = 0; get(& v, sizeof(v)); return v; }
+  std::uint32_t u32() { std::uint32_t v = 0; get(& v, sizeof(v)); return v; }
+  std::uint64_t u64() { std::uint64_t v = 0; get(& v, sizeof(v)); return v; }
+
+  std::string str()
+  {
+    std::string s(u32(), '\0');
+    if (! s.empty()) get(& s[0], s.size());
+    return s;
+  }
+
+private:
+
+  std::FILE * f_;
+  bool ok_;
+
+}; // end of class reader
+
+std::string demangle(const std::string & name)
+{
+  int st = 0;
+  char * dn = abi::__cxa_demangle(name.c_str(), 0, 0, & st);
+  std::string ret = dn ? dn : name;
+  std::free(dn);
+  return ret;
+}
+
+void usage()
+{
+  std::fprintf(stderr, "usage: gcsnap [-n count] file\n");
+  std::exit(2);
+}
+
+}; // end of anonymous namespace
+
+int main(int argc, char ** argv)
+{
+  std::size_t top = 20;
+  const char * fname = 0;
+  int k = 1;
+
+  while (k < argc) {
+    if (std::strcmp(argv[k], "-n") == 0 && k + 1 < argc) {
+      top = std::strtoul(argv[k + 1], 0, 10);
+      k += 2;
+    } else if (fname == 0 && argv[k][0] != '-')
+      fname = argv[k++];
+    else
+      usage();
+  }
+  if (fname == 0) usage();
+
+  std::FILE * f = std::fopen(fname, "rb");
+  if (f == 0) {
+    std::perror(fname);
+    return 1;
+  }
+
+  reader r(f);
+  char magic[8];
+  r.get(magic, sizeof(magic));
+  if (! r.ok() || std::memcmp(magic, "GCSNAP\0\0", 8) != 0) {
+    std::fprintf(stderr, "%s: not a heap snapshot\n", fname);
+    return 1;
+  }
+  std::uint32_t version = r.u32();
+  std::uint32_t psz = r.u32();
+  if (version != 1 || psz != sizeof(void *)) {
+    std::fprintf(stderr, "%s: unsupported version %u/%u\n", fname,
+		 unsigned(version), unsigned(psz));
+    return 1;
+  }
+
+  // index 0 is the root, 0 in the type table is unknown type.
+  std::vector<node> N(1);
+  std::vector<edge> E;
+  std::vector<std::string> types(1, "(unknown)");
+  std::unordered_map<std::uint64_t, std::uint32_t> ix;
+  bool done = false;
+
+  N[0].addr = 0;
+  N[0].usz = 0;
+  N[0].type = 0;
+  N[0].gctype = 0;
+  N[0].label = "(roots)";
+
+  while (! done && r.ok()) {
+    edge e;
+    node n;
+
+    switch (r.u8()) {
+    case 'T': {
+      std::uint32_t id = r.u32();
+      if (types.size() <= id) types.resize(id + 1);
+      types[id] = demangle(r.str());
+      break;
+    }
+    case 'N':
+      n.addr = r.u64();
+      n.usz = r.u64();
+      n.type = r.u32();
+      n.gctype = r.u8();
+      n.label = r.str();
+      ix[n.addr] = N.size();
+      N.push_back(std::move(n));
+      break;
+
+    case 'R':
+      e.from = 0;
+      e.to = r.u64();
+      r.str(); // root label, node has it too.
+      E.push_back(e);
+      break;
+
+    case 'E':
+      e.from = r.u64();
+      e.to = r.u64();
+      E.push_back(e);
+      break;
+
+    case 'Z':
+      r.u64();
+      r.u64();
+      done = true;
+      break;
+
+    default:
+      r.fail();
+      break;
+    }
+  }
+  std::fclose(f);
+  if (! done) {
+    std::fprintf(stderr, "%s: truncated or corrupt snapshot\n", fname);
+    return 1;
+  }
+
+  // successors and predecessors in compressed form.
+  std::size_t nn = N.size();
+  std::vector<std::uint32_t> so(nn + 1, 0), po(nn + 1, 0);
+  std::vector<std::uint32_t> from, to;
+  from.reserve(E.size());
+  to.reserve(E.size());
+  for (const edge & e : E) {
+    std::uint32_t a = 0, b;
+    if (e.from) {
+      auto p = ix.find(e.from);
+      if (p == ix.end()) continue;
+      a = p->second;
+    }
+    auto p = ix.find(e.to);
+    if (p == ix.end()) continue;
+    b = p->second;
+    from.push_back(a);
+    to.push_back(b);
+    ++so[a + 1];
+    ++po[b + 1];
+  }
+  std::size_t j = 0;
+  while (j < nn) {
+    so[j + 1] += so[j];
+    po[j + 1] += po[j];
+    ++j;
+  }
+  std::vector<std::uint32_t> succ(from.size()), pred(from.size());
+  {
+    std::vector<std::uint32_t> sx(so.begin(), so.end() - 1);
+    std::vector<std::uint32_t> px(po.begin(), po.end() - 1);
+    j = 0;
+    while (j < from.size()) {
+      succ[sx[from[j]]++] = to[j];
+      pred[px[to[j]]++] = from[j];
+      ++j;
+    }
+  }
+
+  // post order numbers by iterative depth first search from root.
+  const std::uint32_t UNDEF = ~std::uint32_t(0);
+  std::vector<std::uint32_t> post(nn, UNDEF);
+  std::vector<std::uint32_t> order; // nodes in post order.
+  {
+    std::vector<std::pair<std::uint32_t, std::uint32_t> > stack;
+    std::vector<char> seen(nn, 0);
+    stack.push_back(std::make_pair(0, so[0]));
+    seen[0] = 1;
+    while (! stack.empty()) {
+      std::uint32_t v = stack.back().first;
+      std::uint32_t & x = stack.back().second;
+      if (x < so[v + 1]) {
+	std::uint32_t w = succ[x++];
+	if (! seen[w]) {
+	  seen[w] = 1;
+	  stack.push_back(std::make_pair(w, so[w]));
+	}
+      } else {
+	post[v] = order.size();
+	order.push_back(v);
+	stack.pop_back();
+      }
+    }
+  }
+
+  // Cooper, Harvey, Kennedy.
+  std::vector<std::uint32_t> idom(nn, UNDEF);
+  idom[0] = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    // reverse post order, skip root which is last.
+    std::size_t i = order.size() - 1;
+    while (i-- > 0) {
+      std::uint32_t b = order[i];
+      std::uint32_t nd = UNDEF;
+      std::uint32_t q = po[b];
+      while (q < po[b + 1]) {
+	std::uint32_t p = pred[q++];
+	if (idom[p] == UNDEF) continue;
+	if (nd == UNDEF) {
+	  nd = p;
+	  continue;
+	}
+	std::uint32_t f1 = p, f2 = nd;
+	while (f1 != f2) {
+	  while (post[f1] < post[f2]) f1 = idom[f1];
+	  while (post[f2] < post[f1]) f2 = idom[f2];
+	}
+	nd = f1;
+      }
+      if (idom[b] != nd) {
+	idom[b] = nd;
+	changed = true;
+      }
+    }
+  }
+
+  // retained size, children come before their dominator in post order.
+  std::vector<std::uint64_t> ret(nn, 0);
+  std::uint64_t total = 0;
+  for (std::uint32_t v : order) {
+    ret[v] += N[v].usz;
+    total += N[v].usz;
+    if (v != 0)
+      ret[idom[v]] += ret[v];
+  }
+
+  std::printf("%zu objects, %zu pointers, %llu bytes reachable\n",
+	      order.size() - 1, from.size(), (unsigned long long)total);
+
+  // objects by retained size.
+  std::vector<std::uint32_t> v(order.begin(), order.end() - 1);
+  std::sort(v.begin(), v.end(),
+	    [& ret](std::uint32_t a, std::uint32_t b)
+	    { return ret[a] > ret[b]; });
+  if (v.size() > top) v.resize(top);
+
+  std::printf("\n    retained       self  type / first path\n");
+  for (std::uint32_t x : v) {
+    const node & n = N[x];
+    std::printf("%12llu %10llu  %s\n%25s%s\n",
+		(unsigned long long)ret[x], (unsigned long long)n.usz,
+		n.type < types.size() ? types[n.type].c_str() : "?",
+		"", n.label.c_str());
+  }
+
+  // per type, retained counts objects not dominated by
+  // another object of the same type.
+  struct tstat {
+    std::uint32_t type;
+    std::size_t n;
+    std::uint64_t self;
+    std::uint64_t retained;
+  };
+  std::vector<tstat> T(types.size());
+  j = 0;
+  while (j < T.size()) {
+    T[j].type = j;
+    T[j].n = 0;
+    T[j].self = T[j].retained = 0;
+    ++j;
+  }
+  for (std::uint32_t x : order) {
+    if (x == 0) continue;
+    if (N[x].type >= T.size()) N[x].type = 0;
+    tstat & t = T[N[x].type];
+    ++t.n;
+    t.self += N[x].usz;
+  }
+  {
+    // walk the dominator tree keeping count of the types on the path.
+    std::vector<std::uint32_t> co(nn + 1, 0), kids(order.size());
+    for (std::uint32_t x : order)
+      if (x != 0) ++co[idom[x] + 1];
+    j = 0;
+    while (j < nn) {
+      co[j + 1] += co[j];
+      ++j;
+    }
+    std::vector<std::uint32_t> cx(co.begin(), co.end() - 1);
+    for (std::uint32_t x : order)
+      if (x != 0) kids[cx[idom[x]]++] = x;
+
+    std::vector<std::size_t> on_path(T.size(), 0);
+    std::vector<std::pair<std::uint32_t, std::uint32_t> > stack;
+    stack.push_back(std::make_pair(0, co[0]));
+    while (! stack.empty()) {
+      std::uint32_t x = stack.back().first;
+      std::uint32_t & i = stack.back().second;
+      if (i < co[x + 1]) {
+	std::uint32_t c = kids[i++];
+	if (on_path[N[c].type]++ == 0)
+	  T[N[c].type].retained += ret[c];
+	stack.push_back(std::make_pair(c, co[c]));
+      } else {
+	if (x != 0) --on_path[N[x].type];
+	stack.pop_back();
+      }
+    }
+  }
+  std::sort(T.begin(), T.end(),
+	    [](const tstat & a, const tstat & b)
+	    { return a.retained > b.retained; });
+
+  std::printf("\n    retained       self    count  type\n");
+  for (const tstat & t : T) {
+    if (t.n == 0) continue;
+    std::printf("%12llu %10llu %8zu  %s\n",
+		(unsigned long long)t.retained, (unsigned long long)t.self,
+		t.n, types[t.type].c_str());
+  }
+  return 0;
+}